@@ -19,6 +19,7 @@
  */
 
 #include "acl.h"
+#include "query.h"
 
 #include "contrib/xxhash/xxhash.h"
 
@@ -31,7 +32,6 @@ void db_acl_free_item(struct db_acl_item* _item)
 	pfcq_free(_item->s_netmask);
 	pfcq_free(_item->s_address);
 	pfcq_free(_item->s_layer3);
-	pthread_spin_destroy(&_item->hits_lock);
 	pfcq_free(_item);
 
 	return;
@@ -48,10 +48,14 @@ void db_acl_free_list_item(struct db_list_item* _item)
 	return;
 }
 
-enum db_acl_action db_check_query_acl(sa_family_t _layer3, pfcq_net_address_t* _address, struct db_request_data* _request_data, struct db_acl* _acl,
-	void** _acl_data, size_t* _acl_data_length)
+enum db_acl_action db_check_query_acl(sa_family_t _layer3, pfcq_net_address_t* _address, struct db_query* _query, struct db_acl* _acl,
+	void** _acl_data, size_t* _acl_data_length, ssize_t* _acl_index)
 {
 	enum db_acl_action ret = DB_ACL_ACTION_ALLOW;
+	uint64_t qname_hash = XXH64(_query->qname, _query->qname_length, DB_HASH_SEED);
+	// Text form is needed for regex matcher only
+	char fqdn[DB_FQDN_MAX_LENGTH];
+	unsigned short int fqdn_ready = 0;
 
 	struct db_acl_item* current_acl_item = NULL;
 	TAILQ_FOREACH(current_acl_item, _acl, tailq)
@@ -83,7 +87,6 @@ enum db_acl_action db_check_query_acl(sa_family_t _layer3, pfcq_net_address_t* _
 			continue;
 
 		// Match request
-		uint64_t fqdn_hash = XXH64((uint8_t*)_request_data->fqdn, strlen(_request_data->fqdn), DB_HASH_SEED);
 		unsigned short int matcher_matched = 0;
 		struct db_list_item* current_list_item = NULL;
 		TAILQ_FOREACH(current_list_item, &current_acl_item->list, tailq)
@@ -95,7 +98,7 @@ enum db_acl_action db_check_query_acl(sa_family_t _layer3, pfcq_net_address_t* _
 					// Match everything
 					break;
 				case DB_ACL_RR_TYPE_ANY:
-					if (_request_data->rr_type != LDNS_RR_TYPE_ANY)
+					if (_query->qtype != LDNS_RR_TYPE_ANY)
 						continue;
 					break;
 				default:
@@ -106,27 +109,28 @@ enum db_acl_action db_check_query_acl(sa_family_t _layer3, pfcq_net_address_t* _
 			switch (current_acl_item->matcher)
 			{
 				case DB_ACL_MATCHER_STRICT:
-					if (fqdn_hash == current_list_item->s_fqdn_hash &&
-							likely(strncmp(_request_data->fqdn, current_list_item->s_fqdn, current_list_item->s_fqdn_length) == 0))
+					if (qname_hash == current_list_item->s_qname_hash &&
+							likely(_query->qname_length == current_list_item->s_qname_length &&
+								memcmp(_query->qname, current_list_item->s_qname, current_list_item->s_qname_length) == 0))
 					{
 						matcher_matched = 1;
 						goto found;
 					}
 					break;
 				case DB_ACL_MATCHER_SUBDOMAIN:
-				{
-					char* pos = strstr(_request_data->fqdn, current_list_item->s_fqdn);
-					size_t fqdn_len = strlen(_request_data->fqdn);
-					size_t list_item_len = strlen(current_list_item->s_fqdn);
-					if (pos && (size_t)(pos - _request_data->fqdn) == fqdn_len - list_item_len)
+					if (db_query_is_subdomain(_query, current_list_item->s_qname, current_list_item->s_qname_length))
 					{
 						matcher_matched = 1;
 						goto found;
 					}
 					break;
-				}
 				case DB_ACL_MATCHER_REGEX:
-					if (regexec(&current_list_item->regex, _request_data->fqdn, 0, NULL, 0) == REG_NOERROR)
+					if (unlikely(!fqdn_ready))
+					{
+						db_query_fqdn(_query, fqdn);
+						fqdn_ready = 1;
+					}
+					if (regexec(&current_list_item->regex, fqdn, 0, NULL, 0) == REG_NOERROR)
 					{
 						matcher_matched = 1;
 						goto found;
@@ -146,18 +150,14 @@ found:
 		switch (current_acl_item->action)
 		{
 			case DB_ACL_ACTION_SET_A:
+				// Parameters live as long as ACL does, no need to copy them
 				*_acl_data_length = sizeof(current_acl_item->action_parameters.set_a);
-				*_acl_data = pfcq_alloc(*_acl_data_length);
-				memcpy(*_acl_data, &current_acl_item->action_parameters.set_a, *_acl_data_length);
+				*_acl_data = &current_acl_item->action_parameters.set_a;
 				break;
 			default:
 				break;
 		}
-		if (unlikely(pthread_spin_lock(&current_acl_item->hits_lock)))
-			panic("pthread_spin_lock");
-		current_acl_item->hits++;
-		if (unlikely(pthread_spin_unlock(&current_acl_item->hits_lock)))
-			panic("pthread_spin_unlock");
+		*_acl_index = current_acl_item->index;
 		break;
 	}
 
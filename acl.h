@@ -27,8 +27,8 @@
 
 void db_acl_free_item(struct db_acl_item* _item) __attribute__((nonnull(1)));
 void db_acl_free_list_item(struct db_list_item* _item) __attribute__((nonnull(1)));
-enum db_acl_action db_check_query_acl(sa_family_t _layer3, pfcq_net_address_t* _address, struct db_request_data* _request_data, struct db_acl* _acl,
-	void** _acl_data, size_t* _acl_data_length) __attribute__((nonnull(2, 3, 4, 5, 6)));
+enum db_acl_action db_check_query_acl(sa_family_t _layer3, pfcq_net_address_t* _address, struct db_query* _query, struct db_acl* _acl,
+	void** _acl_data, size_t* _acl_data_length, ssize_t* _acl_index) __attribute__((nonnull(2, 3, 4, 5, 6, 7)));
 
 #endif /* __ACL_H__ */
 
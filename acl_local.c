@@ -19,11 +19,33 @@
  */
 
 #include "acl.h"
+#include "query.h"
 
 #include "contrib/xxhash/xxhash.h"
 
 #include "acl_local.h"
 
+static void db_acl_local_encode_set_a(struct db_set_a* _set_a)
+{
+	uint8_t* rr = _set_a->answer;
+	uint32_t ttl_nbo = htonl(_set_a->ttl);
+
+	// Owner is a compression pointer to the question name at offset 12
+	*rr++ = 0xc0;
+	*rr++ = DB_DNS_HEADER_LENGTH;
+	*rr++ = 0;
+	*rr++ = LDNS_RR_TYPE_A;
+	*rr++ = 0;
+	*rr++ = LDNS_RR_CLASS_IN;
+	memcpy(rr, &ttl_nbo, sizeof(uint32_t));
+	rr += sizeof(uint32_t);
+	*rr++ = 0;
+	*rr++ = sizeof(struct in_addr);
+	memcpy(rr, &_set_a->address4, sizeof(struct in_addr));
+
+	return;
+}
+
 void db_acl_local_load(dictionary* _config, const char* _acl_name, struct db_acl* _acl)
 {
 	int acl_items_count = iniparser_getsecnkeys(_config, _acl_name);
@@ -36,6 +58,7 @@ void db_acl_local_load(dictionary* _config, const char* _acl_name, struct db_acl
 	const char** acl_items = pfcq_alloc(acl_items_count * sizeof(char*));
 	iniparser_getseckeys(_config, _acl_name, acl_items);
 	TAILQ_INIT(_acl);
+	size_t acl_index = 0;
 	for (int i = 0; i < acl_items_count; i++)
 	{
 		const char* acl_item_expr = iniparser_getstring(_config, acl_items[i], NULL);
@@ -103,8 +126,6 @@ void db_acl_local_load(dictionary* _config, const char* _acl_name, struct db_acl
 		new_acl_item->s_list = pfcq_strdup(acl_item_list);
 		new_acl_item->s_action = pfcq_strdup(acl_item_action);
 		new_acl_item->s_action_parameters = pfcq_strdup(acl_item_action_parameters);
-		if (unlikely(pthread_spin_init(&new_acl_item->hits_lock, PTHREAD_PROCESS_PRIVATE)))
-			panic("pthread_spin_init");
 
 		if (strcmp(acl_item_layer3, DB_CONFIG_IPV4) == 0)
 			new_acl_item->layer3 = PF_INET;
@@ -190,6 +211,7 @@ void db_acl_local_load(dictionary* _config, const char* _acl_name, struct db_acl
 				continue;
 			}
 			new_acl_item->action_parameters.set_a.ttl = strtoll(set_a_ttl, NULL, 10);
+			db_acl_local_encode_set_a(&new_acl_item->action_parameters.set_a);
 			pfcq_free(acl_item_action_parameters_p);
 		} else
 		{
@@ -250,17 +272,26 @@ void db_acl_local_load(dictionary* _config, const char* _acl_name, struct db_acl
 				continue;
 			}
 			new_list_item->s_fqdn = pfcq_strdup(list_item_fqdn);
-			new_list_item->s_fqdn_length = strlen(new_list_item->s_fqdn);
-			new_list_item->s_fqdn_hash = XXH64((uint8_t*)new_list_item->s_fqdn, new_list_item->s_fqdn_length, DB_HASH_SEED);
 
 			pfcq_free(list_item_p);
 
 			switch (new_acl_item->matcher)
 			{
 				case DB_ACL_MATCHER_STRICT:
-					break;
 				case DB_ACL_MATCHER_SUBDOMAIN:
+				{
+					// Queries are matched in lower-cased wire format
+					ssize_t qname_length = db_query_name2wire(new_list_item->s_fqdn, new_list_item->s_qname);
+					if (unlikely(qname_length == -1))
+					{
+						inform("List: %s, invalid FQDN specified in config file\n", acl_item_list);
+						db_acl_free_list_item(new_list_item);
+						continue;
+					}
+					new_list_item->s_qname_length = (size_t)qname_length;
+					new_list_item->s_qname_hash = XXH64(new_list_item->s_qname, new_list_item->s_qname_length, DB_HASH_SEED);
 					break;
+				}
 				case DB_ACL_MATCHER_REGEX:
 					if (unlikely(regcomp(&new_list_item->regex, new_list_item->s_fqdn, REG_EXTENDED | REG_NOSUB)))
 					{
@@ -278,6 +309,8 @@ void db_acl_local_load(dictionary* _config, const char* _acl_name, struct db_acl
 		}
 		pfcq_free(list_items);
 
+		// Hits are counted per worker by this index
+		new_acl_item->index = acl_index++;
 		TAILQ_INSERT_TAIL(_acl, new_acl_item, tailq);
 
 		pfcq_free(acl_item_expr_p);
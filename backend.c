@@ -0,0 +1,364 @@
+/* vim: set tabstop=4:softtabstop=4:shiftwidth=4:noexpandtab */
+
+/*
+ * dnsbalancer - daemon to balance UDP DNS requests over DNS servers
+ * Copyright (C) 2015-2016 Lanet Network
+ * Programmed by Oleksandr Natalenko <o.natalenko@lanet.ua>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "contrib/xxhash/xxhash.h"
+
+#include "types.h"
+
+#include "backend.h"
+
+// Maglev: every forwarder walks its own permutation of slots claiming
+// the first free one, taking turns in proportion to its weight
+static void db_backend_maglev_build(const struct db_backend* _backend, struct db_backend_table* _table)
+{
+	uint64_t* position = pfcq_alloc(_backend->forwarders_count * sizeof(uint64_t));
+	uint64_t* skip = pfcq_alloc(_backend->forwarders_count * sizeof(uint64_t));
+	uint64_t* credit = pfcq_alloc(_backend->forwarders_count * sizeof(uint64_t));
+	uint64_t max_weight = 0;
+	size_t filled = 0;
+
+	for (size_t i = 0; i < DB_MAGLEV_TABLE_SIZE; i++)
+		_table->maglev[i] = DB_MAGLEV_EMPTY;
+
+	for (size_t i = 0; i < _backend->forwarders_count; i++)
+	{
+		const struct db_forwarder* forwarder = _backend->forwarders[i];
+		size_t name_length = strlen(forwarder->name);
+
+		if (!forwarder->active || !forwarder->effective_weight)
+			continue;
+		// Permutation depends on name only, so it survives membership changes
+		position[i] = XXH64(forwarder->name, name_length, DB_HASH_SEED) % DB_MAGLEV_TABLE_SIZE;
+		skip[i] = XXH64(forwarder->name, name_length, ~DB_HASH_SEED) % (DB_MAGLEV_TABLE_SIZE - 1) + 1;
+		if (forwarder->effective_weight > max_weight)
+			max_weight = forwarder->effective_weight;
+	}
+
+	while (likely(_table->alive_count))
+		for (size_t i = 0; i < _backend->forwarders_count; i++)
+		{
+			if (!_backend->forwarders[i]->active || !_backend->forwarders[i]->effective_weight)
+				continue;
+			credit[i] += _backend->forwarders[i]->effective_weight;
+			for (; credit[i] >= max_weight; credit[i] -= max_weight)
+			{
+				while (_table->maglev[position[i]] != DB_MAGLEV_EMPTY)
+					position[i] = (position[i] + skip[i]) % DB_MAGLEV_TABLE_SIZE;
+				_table->maglev[position[i]] = (uint16_t)i;
+				if (++filled == DB_MAGLEV_TABLE_SIZE)
+					goto out;
+			}
+		}
+
+out:
+	pfcq_free(position);
+	pfcq_free(skip);
+	pfcq_free(credit);
+
+	return;
+}
+
+// Vose: every column holds probability of its own forwarder and alias
+// that takes the rest, columns are filled pairing underfull with overfull ones
+static void db_backend_alias_build(const struct db_backend* _backend, struct db_backend_table* _table)
+{
+	double* probability = pfcq_alloc(_table->alive_count * sizeof(double));
+	size_t* small = pfcq_alloc(_table->alive_count * sizeof(size_t));
+	size_t* large = pfcq_alloc(_table->alive_count * sizeof(size_t));
+	size_t small_count = 0;
+	size_t large_count = 0;
+	uint64_t total_weight = 0;
+	size_t column = 0;
+
+	for (size_t i = 0; i < _backend->forwarders_count; i++)
+		if (_backend->forwarders[i]->active)
+			total_weight += _backend->forwarders[i]->effective_weight;
+
+	for (size_t i = 0; i < _backend->forwarders_count; i++)
+	{
+		if (!_backend->forwarders[i]->active || !_backend->forwarders[i]->effective_weight)
+			continue;
+		probability[column] = (double)_backend->forwarders[i]->effective_weight * _table->alive_count / total_weight;
+		_table->alias[column].forwarder = (uint16_t)i;
+		_table->alias[column].alias = (uint16_t)i;
+		_table->alias[column].threshold = UINT32_MAX;
+		if (probability[column] < 1.0)
+			small[small_count++] = column;
+		else
+			large[large_count++] = column;
+		column++;
+	}
+
+	while (small_count && large_count)
+	{
+		size_t less = small[--small_count];
+		size_t more = large[--large_count];
+
+		_table->alias[less].threshold = (uint32_t)(probability[less] * UINT32_MAX);
+		_table->alias[less].alias = _table->alias[more].forwarder;
+		probability[more] -= 1.0 - probability[less];
+		if (probability[more] < 1.0)
+			small[small_count++] = more;
+		else
+			large[large_count++] = more;
+	}
+	// Leftovers differ from 1 by rounding error only and keep their own forwarder
+
+	pfcq_free(probability);
+	pfcq_free(small);
+	pfcq_free(large);
+
+	return;
+}
+
+static uint64_t db_backend_gcd(uint64_t _a, uint64_t _b)
+{
+	while (_b)
+	{
+		uint64_t remainder = _a % _b;
+		_a = _b;
+		_b = remainder;
+	}
+
+	return _a;
+}
+
+// Period of smooth WRR sequence over forwarders in rotation
+static size_t db_backend_schedule_period(const struct db_backend* _backend)
+{
+	uint64_t divisor = 0;
+	uint64_t period = 0;
+
+	for (size_t i = 0; i < _backend->forwarders_count; i++)
+		if (_backend->forwarders[i]->active && _backend->forwarders[i]->effective_weight)
+			divisor = db_backend_gcd(_backend->forwarders[i]->effective_weight, divisor);
+	for (size_t i = 0; i < _backend->forwarders_count; i++)
+		if (_backend->forwarders[i]->active && _backend->forwarders[i]->effective_weight)
+			period += _backend->forwarders[i]->effective_weight / divisor;
+
+	// Any prefix of smooth sequence keeps proportions within one pick per forwarder
+	return period < DB_WRR_SCHEDULE_MAX ? (size_t)period : DB_WRR_SCHEDULE_MAX;
+}
+
+// Smooth WRR (as in nginx): every step each forwarder gains its weight,
+// the richest one is picked and pays back total weight
+static void db_backend_schedule_build(const struct db_backend* _backend, struct db_backend_table* _table)
+{
+	int64_t* current = pfcq_alloc(_backend->forwarders_count * sizeof(int64_t));
+	int64_t total_weight = 0;
+
+	for (size_t i = 0; i < _backend->forwarders_count; i++)
+		if (_backend->forwarders[i]->active)
+			total_weight += (int64_t)_backend->forwarders[i]->effective_weight;
+
+	_table->schedule_length = db_backend_schedule_period(_backend);
+	for (size_t step = 0; step < _table->schedule_length; step++)
+	{
+		ssize_t best = -1;
+
+		for (size_t i = 0; i < _backend->forwarders_count; i++)
+		{
+			if (!_backend->forwarders[i]->active || !_backend->forwarders[i]->effective_weight)
+				continue;
+			current[i] += (int64_t)_backend->forwarders[i]->effective_weight;
+			if (best == -1 || current[i] > current[best])
+				best = i;
+		}
+		current[best] -= total_weight;
+		_table->schedule[step] = (uint16_t)best;
+	}
+
+	pfcq_free(current);
+
+	return;
+}
+
+// Forwarders in rotation, so that random candidates are drawn from the current tier only
+static void db_backend_members_build(const struct db_backend* _backend, struct db_backend_table* _table)
+{
+	size_t member = 0;
+
+	for (size_t i = 0; i < _backend->forwarders_count; i++)
+		if (_backend->forwarders[i]->active && _backend->forwarders[i]->effective_weight)
+			_table->members[member++] = (uint16_t)i;
+
+	return;
+}
+
+// Only the first tier (by priority) with enough alive capacity is in rotation,
+// if there is no such tier, all alive forwarders are
+static void db_backend_tiers(struct db_backend* _backend)
+{
+	uint64_t tier = 0;
+	unsigned short int tier_found = 0;
+
+	for (unsigned short int first = 1;; first = 0)
+	{
+		uint64_t next_tier = UINT64_MAX;
+		unsigned short int next_found = 0;
+		size_t alive_count = 0;
+		uint64_t alive_weight = 0;
+		uint64_t total_weight = 0;
+
+		for (size_t i = 0; i < _backend->forwarders_count; i++)
+			if ((first || _backend->forwarders[i]->priority > tier) && _backend->forwarders[i]->priority <= next_tier)
+			{
+				next_tier = _backend->forwarders[i]->priority;
+				next_found = 1;
+			}
+		if (!next_found)
+			break;
+		tier = next_tier;
+
+		for (size_t i = 0; i < _backend->forwarders_count; i++)
+		{
+			if (_backend->forwarders[i]->priority != tier)
+				continue;
+			total_weight += _backend->forwarders[i]->weight;
+			if (_backend->forwarders[i]->alive)
+			{
+				alive_count++;
+				alive_weight += _backend->forwarders[i]->weight;
+			}
+		}
+		if (alive_count && alive_count >= _backend->tier_min_alive &&
+			alive_weight * 100 >= _backend->tier_min_weight * total_weight)
+		{
+			tier_found = 1;
+			break;
+		}
+	}
+
+	for (size_t i = 0; i < _backend->forwarders_count; i++)
+		_backend->forwarders[i]->active = _backend->forwarders[i]->alive &&
+			(!tier_found || _backend->forwarders[i]->priority == tier);
+
+	return;
+}
+
+static void db_backend_table_build(const struct db_backend* _backend, struct db_backend_table* _table)
+{
+	_table->alive_count = 0;
+	for (size_t i = 0; i < _backend->forwarders_count; i++)
+		if (_backend->forwarders[i]->active && _backend->forwarders[i]->effective_weight)
+			_table->alive_count++;
+
+	switch (_backend->mode)
+	{
+		case DB_BE_MODE_RANDOM:
+			if (likely(_table->alive_count))
+				db_backend_alias_build(_backend, _table);
+			break;
+		case DB_BE_MODE_HASH_L3_L4:
+		case DB_BE_MODE_HASH_L3:
+		case DB_BE_MODE_HASH_L4:
+			db_backend_maglev_build(_backend, _table);
+			break;
+		case DB_BE_MODE_WRR:
+			_table->schedule_length = 0;
+			if (likely(_table->alive_count))
+				db_backend_schedule_build(_backend, _table);
+			break;
+		case DB_BE_MODE_LEAST_OUTSTANDING:
+			db_backend_members_build(_backend, _table);
+			break;
+		default:
+			break;
+	}
+
+	return;
+}
+
+void db_backend_init(struct db_backend* _backend)
+{
+	if (unlikely(_backend->forwarders_count >= DB_MAGLEV_EMPTY))
+		stop("Too many forwarders specified for backend in config file");
+
+	for (size_t i = 0; i < _backend->forwarders_count; i++)
+	{
+		_backend->forwarders[i]->hash = XXH64(_backend->forwarders[i]->name, strlen(_backend->forwarders[i]->name), DB_HASH_SEED);
+		_backend->forwarders[i]->effective_weight = _backend->forwarders[i]->weight;
+		_backend->schedule_size += _backend->forwarders[i]->weight;
+	}
+	// Sum of weights bounds period over any alive subset at any stage of slow start
+	if (_backend->schedule_size > DB_WRR_SCHEDULE_MAX)
+		_backend->schedule_size = DB_WRR_SCHEDULE_MAX;
+
+	for (size_t i = 0; i < 2; i++)
+	{
+		switch (_backend->mode)
+		{
+			case DB_BE_MODE_RANDOM:
+				_backend->tables[i].alias = pfcq_alloc(_backend->forwarders_count * sizeof(struct db_alias));
+				break;
+			case DB_BE_MODE_HASH_L3_L4:
+			case DB_BE_MODE_HASH_L3:
+			case DB_BE_MODE_HASH_L4:
+				_backend->tables[i].maglev = pfcq_alloc(DB_MAGLEV_TABLE_SIZE * sizeof(uint16_t));
+				break;
+			case DB_BE_MODE_WRR:
+				if (unlikely(!_backend->schedule_size))
+					stop("No forwarder with non-zero weight specified for backend in config file");
+				_backend->tables[i].schedule = pfcq_alloc(_backend->schedule_size * sizeof(uint16_t));
+				break;
+			case DB_BE_MODE_LEAST_OUTSTANDING:
+				_backend->tables[i].members = pfcq_alloc(_backend->forwarders_count * sizeof(uint16_t));
+				break;
+			default:
+				break;
+		}
+	}
+	_backend->active_table = 0;
+	db_backend_tiers(_backend);
+	db_backend_table_build(_backend, &_backend->tables[0]);
+
+	return;
+}
+
+void db_backend_done(struct db_backend* _backend)
+{
+	for (size_t i = 0; i < 2; i++)
+	{
+		if (_backend->tables[i].maglev)
+			pfcq_free(_backend->tables[i].maglev);
+		if (_backend->tables[i].alias)
+			pfcq_free(_backend->tables[i].alias);
+		if (_backend->tables[i].schedule)
+			pfcq_free(_backend->tables[i].schedule);
+		if (_backend->tables[i].members)
+			pfcq_free(_backend->tables[i].members);
+	}
+
+	return;
+}
+
+// Called by watchdog only: spare table is filled while workers read the active one
+void db_backend_rebuild(struct db_backend* _backend)
+{
+	unsigned int spare = !__atomic_load_n(&_backend->active_table, __ATOMIC_RELAXED);
+
+	db_backend_tiers(_backend);
+	db_backend_table_build(_backend, &_backend->tables[spare]);
+	__atomic_store_n(&_backend->active_table, spare, __ATOMIC_RELEASE);
+
+	return;
+}
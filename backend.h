@@ -0,0 +1,105 @@
+/* vim: set tabstop=4:softtabstop=4:shiftwidth=4:noexpandtab */
+
+/*
+ * dnsbalancer - daemon to balance UDP DNS requests over DNS servers
+ * Copyright (C) 2015-2016 Lanet Network
+ * Programmed by Oleksandr Natalenko <o.natalenko@lanet.ua>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifndef __BACKEND_H__
+#define __BACKEND_H__
+
+#include "types.h"
+
+#include "contrib/pfcq/pfcq.h"
+
+void db_backend_init(struct db_backend* _backend) __attribute__((nonnull(1)));
+void db_backend_done(struct db_backend* _backend) __attribute__((nonnull(1)));
+void db_backend_rebuild(struct db_backend* _backend) __attribute__((nonnull(1)));
+
+static inline const struct db_backend_table* db_backend_table(const struct db_backend* _backend) __attribute__((always_inline, nonnull(1)));
+static inline ssize_t db_backend_maglev(const struct db_backend* _backend, uint64_t _hash) __attribute__((always_inline, nonnull(1)));
+static inline ssize_t db_backend_alias(const struct db_backend* _backend, uint64_t _random) __attribute__((always_inline, nonnull(1)));
+static inline ssize_t db_backend_schedule(const struct db_backend* _backend, size_t _cursor) __attribute__((always_inline, nonnull(1)));
+static inline ssize_t db_backend_member(const struct db_backend* _backend, const struct db_backend_table* _table, size_t _index) __attribute__((always_inline, nonnull(1, 2)));
+
+static inline const struct db_backend_table* db_backend_table(const struct db_backend* _backend)
+{
+	return &_backend->tables[__atomic_load_n(&_backend->active_table, __ATOMIC_ACQUIRE)];
+}
+
+static inline ssize_t db_backend_maglev(const struct db_backend* _backend, uint64_t _hash)
+{
+	const struct db_backend_table* table = db_backend_table(_backend);
+	uint16_t entry = 0;
+
+	if (unlikely(!table->alive_count))
+		return -1;
+	entry = table->maglev[_hash % DB_MAGLEV_TABLE_SIZE];
+
+	// Table may lag behind health checks or be rewritten under a stalled reader
+	if (unlikely(entry >= _backend->forwarders_count || !_backend->forwarders[entry]->active))
+		return -1;
+
+	return entry;
+}
+
+static inline ssize_t db_backend_alias(const struct db_backend* _backend, uint64_t _random)
+{
+	const struct db_backend_table* table = db_backend_table(_backend);
+	struct db_alias column;
+	uint16_t entry = 0;
+
+	if (unlikely(!table->alive_count))
+		return -1;
+	// High half of random value picks column, low half is tossed against threshold
+	column = table->alias[((_random >> 32) * table->alive_count) >> 32];
+	entry = (uint32_t)_random < column.threshold ? column.forwarder : column.alias;
+
+	if (unlikely(entry >= _backend->forwarders_count || !_backend->forwarders[entry]->active))
+		return -1;
+
+	return entry;
+}
+
+static inline ssize_t db_backend_schedule(const struct db_backend* _backend, size_t _cursor)
+{
+	const struct db_backend_table* table = db_backend_table(_backend);
+	size_t length = table->schedule_length;
+	uint16_t entry = 0;
+
+	if (unlikely(!length))
+		return -1;
+	entry = table->schedule[_cursor % length];
+
+	if (unlikely(entry >= _backend->forwarders_count || !_backend->forwarders[entry]->active))
+		return -1;
+
+	return entry;
+}
+
+static inline ssize_t db_backend_member(const struct db_backend* _backend, const struct db_backend_table* _table, size_t _index)
+{
+	uint16_t entry = _table->members[_index];
+
+	if (unlikely(entry >= _backend->forwarders_count || !_backend->forwarders[entry]->active))
+		return -1;
+
+	return entry;
+}
+
+#endif /* __BACKEND_H__ */
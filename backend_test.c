@@ -0,0 +1,333 @@
+/* vim: set tabstop=4:softtabstop=4:shiftwidth=4:noexpandtab */
+
+/*
+ * dnsbalancer - daemon to balance UDP DNS requests over DNS servers
+ * Copyright (C) 2015-2016 Lanet Network
+ * Programmed by Oleksandr Natalenko <o.natalenko@lanet.ua>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+
+#include "backend.h"
+
+#define DB_TEST_FORWARDERS		5
+
+struct db_test_backend
+{
+	struct db_backend backend;
+	struct db_forwarder forwarders[DB_TEST_FORWARDERS];
+	struct db_forwarder* pointers[DB_TEST_FORWARDERS];
+	char names[DB_TEST_FORWARDERS][16];
+};
+
+static void db_test_backend_init(struct db_test_backend* _test, enum db_backend_mode _mode, const uint64_t* _weights)
+{
+	pfcq_zero(_test, sizeof(struct db_test_backend));
+	_test->backend.mode = _mode;
+	_test->backend.forwarders = _test->pointers;
+	_test->backend.forwarders_count = DB_TEST_FORWARDERS;
+
+	for (size_t i = 0; i < DB_TEST_FORWARDERS; i++)
+	{
+		snprintf(_test->names[i], sizeof(_test->names[i]), "frw_%zu", i);
+		_test->forwarders[i].name = _test->names[i];
+		_test->forwarders[i].weight = _weights[i];
+		_test->forwarders[i].alive = 1;
+		_test->pointers[i] = &_test->forwarders[i];
+	}
+
+	db_backend_init(&_test->backend);
+
+	return;
+}
+
+static uint64_t db_test_total_weight(const struct db_test_backend* _test)
+{
+	uint64_t ret = 0;
+
+	for (size_t i = 0; i < DB_TEST_FORWARDERS; i++)
+		if (_test->forwarders[i].active)
+			ret += _test->forwarders[i].effective_weight;
+
+	return ret;
+}
+
+// Every forwarder owns its weighted share of Maglev slots
+static void db_test_maglev_shares(const struct db_test_backend* _test)
+{
+	size_t owned[DB_TEST_FORWARDERS] = {0};
+	uint64_t total_weight = db_test_total_weight(_test);
+
+	for (uint64_t i = 0; i < DB_MAGLEV_TABLE_SIZE; i++)
+	{
+		ssize_t entry = db_backend_maglev(&_test->backend, i);
+		assert(entry >= 0 && entry < DB_TEST_FORWARDERS);
+		assert(_test->forwarders[entry].active);
+		owned[entry]++;
+	}
+
+	for (size_t i = 0; i < DB_TEST_FORWARDERS; i++)
+	{
+		double expected = _test->forwarders[i].active ?
+			(double)DB_MAGLEV_TABLE_SIZE * _test->forwarders[i].effective_weight / total_weight : 0;
+		assert(owned[i] >= expected * 0.99 && owned[i] <= expected * 1.01 + 1);
+	}
+
+	return;
+}
+
+static void db_test_maglev(void)
+{
+	const uint64_t weights[DB_TEST_FORWARDERS] = {1, 2, 3, 4, 10};
+	const uint64_t even[DB_TEST_FORWARDERS] = {1, 1, 1, 1, 1};
+	static uint16_t before[DB_MAGLEV_TABLE_SIZE];
+	struct db_test_backend test;
+	size_t moved = 0;
+	size_t lost = 0;
+
+	db_test_backend_init(&test, DB_BE_MODE_HASH_L3, even);
+	db_test_maglev_shares(&test);
+	db_backend_done(&test.backend);
+
+	db_test_backend_init(&test, DB_BE_MODE_HASH_L3_L4, weights);
+	db_test_maglev_shares(&test);
+	for (uint64_t i = 0; i < DB_MAGLEV_TABLE_SIZE; i++)
+		before[i] = (uint16_t)db_backend_maglev(&test.backend, i);
+
+	// Dead forwarder is reported as such until the table is rebuilt...
+	test.forwarders[2].alive = 0;
+	test.forwarders[2].active = 0;
+	for (uint64_t i = 0; i < DB_MAGLEV_TABLE_SIZE; i++)
+		if (before[i] == 2)
+			assert(db_backend_maglev(&test.backend, i) == -1);
+
+	// ...and then its slots are taken over, while others mostly stay where they were
+	db_backend_rebuild(&test.backend);
+	db_test_maglev_shares(&test);
+	for (uint64_t i = 0; i < DB_MAGLEV_TABLE_SIZE; i++)
+	{
+		ssize_t entry = db_backend_maglev(&test.backend, i);
+		assert(entry != 2);
+		if (before[i] == 2)
+			lost++;
+		else if (entry != before[i])
+			moved++;
+	}
+	assert(lost);
+	assert(moved < (DB_MAGLEV_TABLE_SIZE - lost) / 100);
+
+	// Revived forwarder gets the same slots back
+	test.forwarders[2].alive = 1;
+	db_backend_rebuild(&test.backend);
+	for (uint64_t i = 0; i < DB_MAGLEV_TABLE_SIZE; i++)
+		assert(db_backend_maglev(&test.backend, i) == before[i]);
+
+	// Nobody is left
+	for (size_t i = 0; i < DB_TEST_FORWARDERS; i++)
+		test.forwarders[i].alive = 0;
+	db_backend_rebuild(&test.backend);
+	assert(db_backend_maglev(&test.backend, 0) == -1);
+
+	db_backend_done(&test.backend);
+
+	return;
+}
+
+static uint64_t db_test_random(uint64_t* _state)
+{
+	*_state ^= *_state << 13;
+	*_state ^= *_state >> 7;
+	*_state ^= *_state << 17;
+
+	return *_state;
+}
+
+// Probability of every forwarder summed up over alias columns matches its weight,
+// and sampling follows it too
+static void db_test_alias_shares(const struct db_test_backend* _test)
+{
+	const struct db_backend_table* table = db_backend_table(&_test->backend);
+	double probability[DB_TEST_FORWARDERS] = {0};
+	size_t picked[DB_TEST_FORWARDERS] = {0};
+	uint64_t total_weight = db_test_total_weight(_test);
+	uint64_t state = 0x9e3779b97f4a7c15ULL;
+	const size_t samples = 1000000;
+
+	for (size_t i = 0; i < table->alive_count; i++)
+	{
+		double threshold = (double)table->alias[i].threshold / ((double)UINT32_MAX + 1);
+		probability[table->alias[i].forwarder] += threshold / table->alive_count;
+		probability[table->alias[i].alias] += (1 - threshold) / table->alive_count;
+	}
+
+	for (size_t i = 0; i < samples; i++)
+	{
+		ssize_t entry = db_backend_alias(&_test->backend, db_test_random(&state));
+		assert(entry >= 0 && entry < DB_TEST_FORWARDERS);
+		assert(_test->forwarders[entry].active);
+		picked[entry]++;
+	}
+
+	for (size_t i = 0; i < DB_TEST_FORWARDERS; i++)
+	{
+		double expected = _test->forwarders[i].active ? (double)_test->forwarders[i].effective_weight / total_weight : 0;
+		assert(probability[i] > expected - 1e-6 && probability[i] < expected + 1e-6);
+		// 5 sigma of binomial distribution at most
+		assert(picked[i] >= samples * expected - 5 * sqrt(samples * expected) - 1 &&
+			picked[i] <= samples * expected + 5 * sqrt(samples * expected) + 1);
+	}
+
+	return;
+}
+
+static void db_test_alias(void)
+{
+	const uint64_t weights[DB_TEST_FORWARDERS] = {1, 2, 3, 4, 10};
+	const uint64_t skewed[DB_TEST_FORWARDERS] = {1, 1, 1, 1, 1000};
+	struct db_test_backend test;
+
+	db_test_backend_init(&test, DB_BE_MODE_RANDOM, weights);
+	db_test_alias_shares(&test);
+
+	// Dead forwarder is never picked, before the rebuild as well as after it
+	test.forwarders[4].alive = 0;
+	test.forwarders[4].active = 0;
+	for (uint64_t i = 0; i < 100000; i++)
+		assert(db_backend_alias(&test.backend, i * 0x9e3779b97f4a7c15ULL) != 4);
+	db_backend_rebuild(&test.backend);
+	db_test_alias_shares(&test);
+
+	// Warming up forwarder takes its effective weight only
+	test.forwarders[4].alive = 1;
+	test.forwarders[4].effective_weight = 5;
+	db_backend_rebuild(&test.backend);
+	db_test_alias_shares(&test);
+
+	// Zero weight is out of rotation
+	test.forwarders[1].effective_weight = 0;
+	db_backend_rebuild(&test.backend);
+	assert(db_backend_table(&test.backend)->alive_count == DB_TEST_FORWARDERS - 1);
+	db_test_alias_shares(&test);
+
+	for (size_t i = 0; i < DB_TEST_FORWARDERS; i++)
+		test.forwarders[i].alive = 0;
+	db_backend_rebuild(&test.backend);
+	assert(db_backend_alias(&test.backend, 0) == -1);
+
+	db_backend_done(&test.backend);
+
+	db_test_backend_init(&test, DB_BE_MODE_RANDOM, skewed);
+	db_test_alias_shares(&test);
+	db_backend_done(&test.backend);
+
+	return;
+}
+
+// Smooth WRR: every forwarder gets exactly its share over the period, and any prefix
+// of the schedule is off its share by less than one pick
+static void db_test_schedule_smooth(const struct db_test_backend* _test)
+{
+	const struct db_backend_table* table = db_backend_table(&_test->backend);
+	size_t picked[DB_TEST_FORWARDERS] = {0};
+	uint64_t total_weight = db_test_total_weight(_test);
+	ssize_t previous = -1;
+	size_t run = 0;
+
+	assert(table->schedule_length);
+	for (size_t i = 0; i < table->schedule_length; i++)
+	{
+		ssize_t entry = db_backend_schedule(&_test->backend, i);
+		assert(entry >= 0 && entry < DB_TEST_FORWARDERS);
+		assert(_test->forwarders[entry].active);
+		picked[entry]++;
+
+		for (size_t j = 0; j < DB_TEST_FORWARDERS; j++)
+		{
+			double share = _test->forwarders[j].active ?
+				(double)(i + 1) * _test->forwarders[j].effective_weight / total_weight : 0;
+			assert(picked[j] > share - 1 && picked[j] < share + 1);
+		}
+
+		// Heavy forwarder does not come in bursts longer than its weight to the rest
+		run = entry == previous ? run + 1 : 1;
+		previous = entry;
+		assert(total_weight == _test->forwarders[entry].effective_weight ||
+			run <= _test->forwarders[entry].effective_weight / (total_weight - _test->forwarders[entry].effective_weight) + 1);
+	}
+
+	for (size_t i = 0; i < DB_TEST_FORWARDERS; i++)
+		assert(picked[i] * total_weight == (_test->forwarders[i].active ? table->schedule_length * _test->forwarders[i].effective_weight : 0));
+
+	// Schedule repeats itself
+	for (size_t i = 0; i < table->schedule_length; i++)
+		assert(db_backend_schedule(&_test->backend, i) == db_backend_schedule(&_test->backend, i + table->schedule_length));
+
+	return;
+}
+
+static void db_test_schedule(void)
+{
+	const uint64_t weights[DB_TEST_FORWARDERS] = {1, 2, 3, 4, 10};
+	const uint64_t skewed[DB_TEST_FORWARDERS] = {100, 1, 1, 1, 1};
+	const uint64_t even[DB_TEST_FORWARDERS] = {2, 2, 2, 2, 2};
+	struct db_test_backend test;
+
+	db_test_backend_init(&test, DB_BE_MODE_WRR, weights);
+	db_test_schedule_smooth(&test);
+	assert(db_backend_table(&test.backend)->schedule_length == 20);
+
+	test.forwarders[4].alive = 0;
+	db_backend_rebuild(&test.backend);
+	db_test_schedule_smooth(&test);
+	assert(db_backend_table(&test.backend)->schedule_length == 10);
+
+	// Warming up forwarder takes its effective weight only
+	test.forwarders[4].alive = 1;
+	test.forwarders[4].effective_weight = 3;
+	db_backend_rebuild(&test.backend);
+	db_test_schedule_smooth(&test);
+	assert(db_backend_table(&test.backend)->schedule_length == 13);
+
+	for (size_t i = 0; i < DB_TEST_FORWARDERS; i++)
+		test.forwarders[i].alive = 0;
+	db_backend_rebuild(&test.backend);
+	assert(db_backend_schedule(&test.backend, 0) == -1);
+	db_backend_done(&test.backend);
+
+	db_test_backend_init(&test, DB_BE_MODE_WRR, skewed);
+	db_test_schedule_smooth(&test);
+	db_backend_done(&test.backend);
+
+	// Common divisor is taken out of the period
+	db_test_backend_init(&test, DB_BE_MODE_WRR, even);
+	db_test_schedule_smooth(&test);
+	assert(db_backend_table(&test.backend)->schedule_length == DB_TEST_FORWARDERS);
+	db_backend_done(&test.backend);
+
+	return;
+}
+
+int main(void)
+{
+	db_test_maglev();
+	db_test_alias();
+	db_test_schedule();
+
+	printf("%s\n", "backend: OK");
+
+	return 0;
+}
@@ -0,0 +1,128 @@
+/* vim: set tabstop=4:softtabstop=4:shiftwidth=4:noexpandtab */
+
+/*
+ * dnsbalancer - daemon to balance UDP DNS requests over DNS servers
+ * Copyright (C) 2015-2016 Lanet Network
+ * Programmed by Oleksandr Natalenko <o.natalenko@lanet.ua>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/socket.h>
+
+#include "batch.h"
+
+void db_batch_init(struct db_batch* _batch, size_t _size, size_t _packet_size)
+{
+	pfcq_zero(_batch, sizeof(struct db_batch));
+
+	_batch->size = _size;
+	_batch->packet_size = _packet_size;
+	_batch->headers = pfcq_alloc(_size * sizeof(struct mmsghdr));
+	_batch->iovecs = pfcq_alloc(_size * sizeof(struct iovec));
+	_batch->addresses = pfcq_alloc(_size * sizeof(pfcq_net_address_t));
+	_batch->accounted = pfcq_alloc(_size * sizeof(unsigned short int));
+	_batch->buffer = pfcq_alloc(_size * _packet_size);
+
+	for (size_t i = 0; i < _size; i++)
+	{
+		_batch->iovecs[i].iov_base = db_batch_packet(_batch, i);
+		_batch->iovecs[i].iov_len = _packet_size;
+		_batch->headers[i].msg_hdr.msg_iov = &_batch->iovecs[i];
+		_batch->headers[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	return;
+}
+
+void db_batch_done(struct db_batch* _batch)
+{
+	pfcq_free(_batch->buffer);
+	pfcq_free(_batch->accounted);
+	pfcq_free(_batch->addresses);
+	pfcq_free(_batch->iovecs);
+	pfcq_free(_batch->headers);
+	pfcq_zero(_batch, sizeof(struct db_batch));
+
+	return;
+}
+
+ssize_t db_batch_recv(struct db_batch* _batch, int _fd)
+{
+	int ret = -1;
+
+	for (size_t i = 0; i < _batch->size; i++)
+	{
+		_batch->iovecs[i].iov_len = _batch->packet_size;
+		_batch->headers[i].msg_hdr.msg_name = &_batch->addresses[i];
+		_batch->headers[i].msg_hdr.msg_namelen = (socklen_t)sizeof(pfcq_net_address_t);
+		_batch->headers[i].msg_len = 0;
+	}
+
+	// Drain whatever is queued on the socket without blocking
+	ret = recvmmsg(_fd, _batch->headers, (unsigned int)_batch->size, MSG_DONTWAIT, NULL);
+	_batch->count = ret == -1 ? 0 : (size_t)ret;
+
+	return ret;
+}
+
+uint8_t* db_batch_push(struct db_batch* _batch, const uint8_t* _data, size_t _length,
+	const pfcq_net_address_t* _address, socklen_t _address_length, unsigned short int _accounted)
+{
+	if (unlikely(db_batch_full(_batch) || _length > _batch->packet_size))
+		return NULL;
+
+	size_t index = _batch->count++;
+	uint8_t* ret = db_batch_packet(_batch, index);
+
+	if (likely(_data))
+		memcpy(ret, _data, _length);
+	_batch->iovecs[index].iov_len = _length;
+	if (_address)
+	{
+		_batch->addresses[index] = *_address;
+		_batch->headers[index].msg_hdr.msg_name = &_batch->addresses[index];
+		_batch->headers[index].msg_hdr.msg_namelen = _address_length;
+	} else
+	{
+		_batch->headers[index].msg_hdr.msg_name = NULL;
+		_batch->headers[index].msg_hdr.msg_namelen = 0;
+	}
+	_batch->headers[index].msg_len = 0;
+	_batch->accounted[index] = _accounted;
+
+	return ret;
+}
+
+size_t db_batch_send(struct db_batch* _batch, int _fd)
+{
+	size_t ret = 0;
+	size_t sent = 0;
+
+	while (likely(sent < _batch->count))
+	{
+		int sendmmsg_res = sendmmsg(_fd, _batch->headers + sent, (unsigned int)(_batch->count - sent), 0);
+		if (unlikely(sendmmsg_res == -1))
+		{
+			// Skip the packet that failed, just like single send() does
+			_batch->headers[sent].msg_len = 0;
+			sent++;
+		} else
+		{
+			sent += (size_t)sendmmsg_res;
+			ret++;
+		}
+	}
+
+	return ret;
+}
@@ -0,0 +1,49 @@
+/* vim: set tabstop=4:softtabstop=4:shiftwidth=4:noexpandtab */
+
+/*
+ * dnsbalancer - daemon to balance UDP DNS requests over DNS servers
+ * Copyright (C) 2015-2016 Lanet Network
+ * Programmed by Oleksandr Natalenko <o.natalenko@lanet.ua>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "types.h"
+
+void db_batch_init(struct db_batch* _batch, size_t _size, size_t _packet_size) __attribute__((nonnull(1)));
+void db_batch_done(struct db_batch* _batch) __attribute__((nonnull(1)));
+ssize_t db_batch_recv(struct db_batch* _batch, int _fd) __attribute__((nonnull(1)));
+uint8_t* db_batch_push(struct db_batch* _batch, const uint8_t* _data, size_t _length,
+	const pfcq_net_address_t* _address, socklen_t _address_length, unsigned short int _accounted) __attribute__((nonnull(1)));
+size_t db_batch_send(struct db_batch* _batch, int _fd) __attribute__((nonnull(1)));
+
+static inline uint8_t* db_batch_packet(struct db_batch* _batch, size_t _index) __attribute__((always_inline, nonnull(1)));
+static inline int db_batch_full(struct db_batch* _batch) __attribute__((always_inline, nonnull(1)));
+
+static inline uint8_t* db_batch_packet(struct db_batch* _batch, size_t _index)
+{
+	return _batch->buffer + _index * _batch->packet_size;
+}
+
+static inline int db_batch_full(struct db_batch* _batch)
+{
+	return _batch->count == _batch->size;
+}
+
+#endif /* __BATCH_H__ */
+
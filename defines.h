@@ -26,7 +26,9 @@
 #define DB_HASH_SEED						(0xda9d9374347ffd15)
 
 #define DB_CONFIG_REQUEST_TTL_KEY			"general:request_ttl"
-#define DB_CONFIG_GC_INTERVAL_KEY			"general:gc_interval"
+#define DB_CONFIG_UPSTREAM_TIMEOUT_KEY		"general:upstream_timeout"
+#define DB_CONFIG_SERVFAIL_ON_TIMEOUT_KEY	"general:servfail_on_timeout"
+#define DB_CONFIG_TIMER_RESOLUTION_KEY		"general:timer_resolution"
 #define DB_CONFIG_WATCHDOG_INTERVAL_KEY		"general:watchdog_interval"
 #define DB_CONFIG_STATS_ENABLED_KEY			"stats:enabled"
 #define DB_CONFIG_STATS_LAYER3_KEY			"stats:layer3"
@@ -43,6 +45,21 @@
 #define DB_CONFIG_HASH_L3_L4				"hash_l3+l4"
 #define DB_CONFIG_HASH_L3					"hash_l3"
 #define DB_CONFIG_HASH_L4					"hash_l4"
+#define DB_CONFIG_LEAST_OUTSTANDING			"least_outstanding"
+#define DB_CONFIG_PEAK_EWMA					"peak_ewma"
+#define DB_CONFIG_HASH_QNAME				"hash_qname"
+#define DB_CONFIG_HASH_QNAME_QTYPE			"hash_qname+qtype"
+#define DB_CONFIG_WRR						"wrr"
+#define DB_CONFIG_OVERFLOW_SERVFAIL			"servfail"
+#define DB_CONFIG_OVERFLOW_REFUSED			"refused"
+#define DB_CONFIG_OVERFLOW_DROP				"drop"
+#define DB_CONFIG_SLOW_START_LINEAR			"linear"
+#define DB_CONFIG_SLOW_START_EXPONENTIAL	"exponential"
+#define DB_CONFIG_IO_ENGINE_EPOLL			"epoll"
+#define DB_CONFIG_IO_ENGINE_URING			"uring"
+#define DB_CONFIG_IO_ENGINE_XDP				"xdp"
+#define DB_CONFIG_XDP_MODE_NATIVE			"native"
+#define DB_CONFIG_XDP_MODE_SKB				"skb"
 #define DB_CONFIG_LIST_SEPARATOR			","
 #define DB_CONFIG_PARAMETERS_SEPARATOR		"/"
 #define DB_CONFIG_ACL_MATCHER_STRICT		"strict"
@@ -59,16 +76,53 @@
 #define DB_CONFIG_RELOAD_RETRY_KEY			"reload_retry"
 #define DB_DEFAULT_RLIMIT					32768
 #define DB_DEFAULT_REQUEST_TTL				10000
-#define DB_DEFAULT_GC_INTERVAL				1000
+#define DB_DEFAULT_TIMER_RESOLUTION			10
 #define DB_DEFAULT_WATCHDOG_INTERVAL		1000
 #define DB_DEFAULT_STATS_PORT				8083
 #define DB_DEFAULT_DNS_PORT					53
 #define DB_DEFAULT_DNS_PACKET_SIZE			4096
+#define DB_DNS_HEADER_LENGTH				12
+#define DB_QNAME_MAX_LENGTH					255
+#define DB_QUESTION_MAX_LENGTH				(DB_DNS_HEADER_LENGTH + DB_QNAME_MAX_LENGTH + 4)
+#define DB_RETRY_QUERY_MAX_LENGTH			512
+#define DB_DEFAULT_RETRY_TIMEOUT			200
+#define DB_FQDN_MAX_LENGTH					1024
+#define DB_SET_A_ANSWER_LENGTH				16
 #define DB_DEFAULT_FORWARDER_CHECK_ATTEMPTS	3
 #define DB_DEFAULT_FORWARDER_CHECK_TIMEOUT	500
 #define DB_DEFAULT_WEIGHT					1
 #define DB_LATENCY_BUCKETS					25
 #define DB_DEFAULT_RELOAD_RETRY				500
+#define DB_REQUEST_IDS						(UINT16_MAX + 1)
+#define DB_REQUEST_SLOTS_MIN				64
+#define DB_CACHE_LINE_SIZE					64
+#define DB_POOL_SLAB_OBJECTS				256
+#define DB_TIMER_BITS						6
+#define DB_TIMER_SLOTS						(1 << DB_TIMER_BITS)
+#define DB_TIMER_LEVELS						4
+#define DB_PEAK_EWMA_HALF_LIFE				1000000
+#define DB_MAGLEV_TABLE_SIZE				65537
+#define DB_MAGLEV_EMPTY						UINT16_MAX
+#define DB_WRR_SCHEDULE_MAX					65536
+#define DB_SLOW_START_FLOOR					10
+#define DB_OUTLIER_WINDOW					10
+#define DB_OUTLIER_MAX_LEVEL				16
+#define DB_DEFAULT_OUTLIER_CONSECUTIVE_FAILURES	5
+#define DB_DEFAULT_OUTLIER_TIMEOUT_RATIO	50
+#define DB_DEFAULT_OUTLIER_SERVFAIL_RATIO	50
+#define DB_DEFAULT_OUTLIER_MIN_REQUESTS		20
+#define DB_DEFAULT_OUTLIER_EJECTION_TIME	30000
+#define DB_DEFAULT_OUTLIER_MAX_EJECTION_TIME	300000
+#define DB_DEFAULT_BATCH_SIZE				1
+#define DB_MAX_BATCH_SIZE					1024
+#define DB_URING_ENTRIES					1024
+#define DB_URING_BUFFERS					1024
+#define DB_XDP_FRAMES						4096
+#define DB_XDP_NEIGHBOURS					4096
+#define DB_XDP_TTL							64
+#ifndef DB_XDP_PROGRAM_PATH
+#define DB_XDP_PROGRAM_PATH					"/usr/share/dnsbalancer/dnsbalancer_xdp.o"
+#endif /* DB_XDP_PROGRAM_PATH */
 
 #endif /* __DEFINES_H__ */
 
@@ -190,6 +190,10 @@ int main(int argc, char** argv, char** envp)
 		old_g_ctx = g_ctx;
 		old_l_ctx = l_ctx;
 
+		// Frontends that own exclusive resources go down before the new context takes them over
+		if (old_l_ctx)
+			db_local_context_release(old_l_ctx);
+
 		g_ctx = db_global_context_load(config_file);
 		l_ctx = db_local_context_load(config_file, g_ctx);
 
@@ -18,6 +18,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <limits.h>
 #include <signal.h>
 #include <sys/eventfd.h>
 
@@ -26,13 +27,51 @@
 #endif
 
 #include "acl_local.h"
+#include "backend.h"
+#include "stats.h"
 #include "watchdog.h"
 #include "worker.h"
+#include "worker_xdp.h"
 
 #include "contrib/iniparser/iniparser.h"
 
 #include "local_context.h"
 
+static uint64_t db_backend_getint(dictionary* _config, const char* _backend, const char* _key, int _default, int _min, int _max)
+{
+	char* key = pfcq_mstring("%s:%s", _backend, _key);
+	int value = iniparser_getint(_config, key, _default);
+
+	if (unlikely(value < _min || value > _max))
+	{
+		inform("Backend: %s\n", _backend);
+		inform("Key: %s\n", _key);
+		stop("Backend parameter is out of range");
+	}
+	pfcq_free(key);
+
+	return (uint64_t)value;
+}
+
+static void db_outlier_detection_load(dictionary* _config, const char* _backend, struct db_outlier_detection* _outlier)
+{
+	_outlier->enabled = (unsigned short int)db_backend_getint(_config, _backend, "outlier_detection", 0, 0, 1);
+	_outlier->consecutive_failures = db_backend_getint(_config, _backend, "outlier_consecutive_failures",
+		DB_DEFAULT_OUTLIER_CONSECUTIVE_FAILURES, 0, INT_MAX);
+	_outlier->timeout_ratio = db_backend_getint(_config, _backend, "outlier_timeout_ratio",
+		DB_DEFAULT_OUTLIER_TIMEOUT_RATIO, 0, 100);
+	_outlier->servfail_ratio = db_backend_getint(_config, _backend, "outlier_servfail_ratio",
+		DB_DEFAULT_OUTLIER_SERVFAIL_RATIO, 0, 100);
+	_outlier->min_requests = db_backend_getint(_config, _backend, "outlier_min_requests",
+		DB_DEFAULT_OUTLIER_MIN_REQUESTS, 1, INT_MAX);
+	_outlier->ejection_time = db_backend_getint(_config, _backend, "outlier_ejection_time",
+		DB_DEFAULT_OUTLIER_EJECTION_TIME, 1, INT_MAX);
+	_outlier->max_ejection_time = db_backend_getint(_config, _backend, "outlier_max_ejection_time",
+		DB_DEFAULT_OUTLIER_MAX_EJECTION_TIME, (int)_outlier->ejection_time, INT_MAX);
+
+	return;
+}
+
 struct db_local_context* db_local_context_load(const char* _config_file, struct db_global_context* _g_ctx)
 {
 	struct db_local_context* ret = NULL;
@@ -128,12 +167,98 @@ struct db_local_context* db_local_context_load(const char* _config_file, struct
 		char* frontend_layer3_key = pfcq_mstring("%s:%s", frontend, "layer3");
 		char* frontend_bind_key = pfcq_mstring("%s:%s", frontend, "bind");
 		char* frontend_acl_key = pfcq_mstring("%s:%s", frontend, "acl");
+		char* frontend_batch_size_key = pfcq_mstring("%s:%s", frontend, "batch_size");
+		char* frontend_request_pool_limit_key = pfcq_mstring("%s:%s", frontend, "request_pool_limit");
+		char* frontend_io_engine_key = pfcq_mstring("%s:%s", frontend, "io_engine");
+		char* frontend_xdp_interface_key = pfcq_mstring("%s:%s", frontend, "xdp_interface");
+		char* frontend_xdp_queue_key = pfcq_mstring("%s:%s", frontend, "xdp_queue");
+		char* frontend_xdp_mode_key = pfcq_mstring("%s:%s", frontend, "xdp_mode");
+		char* frontend_xdp_zerocopy_key = pfcq_mstring("%s:%s", frontend, "xdp_zerocopy");
+		char* frontend_xdp_program_key = pfcq_mstring("%s:%s", frontend, "xdp_program");
 
 		ret->frontends[ret->frontends_count]->name = pfcq_strdup(frontend);
 		ret->frontends[ret->frontends_count]->workers_count = pfcq_hint_cpus((int)iniparser_getint(config, frontend_workers_key, -1));
 		ret->frontends[ret->frontends_count]->workers_pool = pfpthq_init(frontend, ret->frontends[ret->frontends_count]->workers_count);
 		ret->frontends[ret->frontends_count]->workers = pfcq_alloc(ret->frontends[ret->frontends_count]->workers_count * sizeof(struct db_worker*));
 		ret->frontends[ret->frontends_count]->dns_max_packet_length = (int)iniparser_getint(config, frontend_dns_max_packet_length_key, DB_DEFAULT_DNS_PACKET_SIZE);
+		int frontend_batch_size = iniparser_getint(config, frontend_batch_size_key, DB_DEFAULT_BATCH_SIZE);
+		if (unlikely(frontend_batch_size < 1 || frontend_batch_size > DB_MAX_BATCH_SIZE))
+		{
+			inform("Frontend: %s\n", frontend);
+			stop("Batch size must be between 1 and 1024");
+		}
+		ret->frontends[ret->frontends_count]->batch_size = (size_t)frontend_batch_size;
+		int frontend_request_pool_limit = iniparser_getint(config, frontend_request_pool_limit_key, 0);
+		if (unlikely(frontend_request_pool_limit < 0))
+		{
+			inform("Frontend: %s\n", frontend);
+			stop("Request pool limit must not be negative");
+		}
+		ret->frontends[ret->frontends_count]->request_pool_limit = (size_t)frontend_request_pool_limit;
+
+		const char* frontend_io_engine = iniparser_getstring(config, frontend_io_engine_key, DB_CONFIG_IO_ENGINE_EPOLL);
+		if (likely(strcmp(frontend_io_engine, DB_CONFIG_IO_ENGINE_EPOLL) == 0))
+			ret->frontends[ret->frontends_count]->io_engine = DB_IO_ENGINE_EPOLL;
+		else if (strcmp(frontend_io_engine, DB_CONFIG_IO_ENGINE_URING) == 0)
+		{
+#ifdef DB_HAVE_LIBURING
+			ret->frontends[ret->frontends_count]->io_engine = DB_IO_ENGINE_URING;
+#else /* DB_HAVE_LIBURING */
+			inform("Frontend: %s\n", frontend);
+			stop("io_uring engine support is not compiled in");
+#endif /* DB_HAVE_LIBURING */
+		} else if (strcmp(frontend_io_engine, DB_CONFIG_IO_ENGINE_XDP) == 0)
+		{
+#ifdef DB_HAVE_XDP
+			ret->frontends[ret->frontends_count]->io_engine = DB_IO_ENGINE_XDP;
+#else /* DB_HAVE_XDP */
+			inform("Frontend: %s\n", frontend);
+			stop("AF_XDP engine support is not compiled in");
+#endif /* DB_HAVE_XDP */
+		} else
+		{
+			inform("Frontend: %s\n", frontend);
+			stop("Unknown I/O engine specified in config file");
+		}
+
+		if (ret->frontends[ret->frontends_count]->io_engine == DB_IO_ENGINE_XDP)
+		{
+			const char* frontend_xdp_interface = iniparser_getstring(config, frontend_xdp_interface_key, NULL);
+			if (unlikely(!frontend_xdp_interface))
+			{
+				inform("Frontend: %s\n", frontend);
+				stop("No XDP interface specified in config file");
+			}
+			ret->frontends[ret->frontends_count]->xdp_interface = pfcq_strdup(frontend_xdp_interface);
+			ret->frontends[ret->frontends_count]->xdp_program =
+				pfcq_strdup(iniparser_getstring(config, frontend_xdp_program_key, DB_XDP_PROGRAM_PATH));
+
+			int frontend_xdp_queue = iniparser_getint(config, frontend_xdp_queue_key, 0);
+			if (unlikely(frontend_xdp_queue < 0 || frontend_xdp_queue + ret->frontends[ret->frontends_count]->workers_count > DB_XDP_MAX_QUEUES))
+			{
+				inform("Frontend: %s\n", frontend);
+				stop("XDP queues of all workers must fit into the XSK map");
+			}
+			ret->frontends[ret->frontends_count]->xdp_queue = (size_t)frontend_xdp_queue;
+
+			const char* frontend_xdp_mode = iniparser_getstring(config, frontend_xdp_mode_key, DB_CONFIG_XDP_MODE_NATIVE);
+			if (likely(strcmp(frontend_xdp_mode, DB_CONFIG_XDP_MODE_NATIVE) == 0))
+				ret->frontends[ret->frontends_count]->xdp_mode = DB_XDP_MODE_NATIVE;
+			else if (strcmp(frontend_xdp_mode, DB_CONFIG_XDP_MODE_SKB) == 0)
+				ret->frontends[ret->frontends_count]->xdp_mode = DB_XDP_MODE_SKB;
+			else
+			{
+				inform("Frontend: %s\n", frontend);
+				stop("Unknown XDP mode specified in config file");
+			}
+
+			ret->frontends[ret->frontends_count]->xdp_zerocopy = (unsigned short int)iniparser_getint(config, frontend_xdp_zerocopy_key, 0);
+			if (unlikely(ret->frontends[ret->frontends_count]->xdp_zerocopy && ret->frontends[ret->frontends_count]->xdp_mode == DB_XDP_MODE_SKB))
+			{
+				inform("Frontend: %s\n", frontend);
+				stop("XDP zero-copy requires native XDP mode");
+			}
+		}
 
 		const char* frontend_layer3 = iniparser_getstring(config, frontend_layer3_key, NULL);
 		if (unlikely(!frontend_layer3))
@@ -208,12 +333,46 @@ struct db_local_context* db_local_context_load(const char* _config_file, struct
 			ret->frontends[ret->frontends_count]->backend.mode = DB_BE_MODE_HASH_L3;
 		else if (likely(strcmp(backend_mode, DB_CONFIG_HASH_L4) == 0))
 			ret->frontends[ret->frontends_count]->backend.mode = DB_BE_MODE_HASH_L4;
+		else if (likely(strcmp(backend_mode, DB_CONFIG_LEAST_OUTSTANDING) == 0))
+			ret->frontends[ret->frontends_count]->backend.mode = DB_BE_MODE_LEAST_OUTSTANDING;
+		else if (likely(strcmp(backend_mode, DB_CONFIG_PEAK_EWMA) == 0))
+			ret->frontends[ret->frontends_count]->backend.mode = DB_BE_MODE_PEAK_EWMA;
+		else if (likely(strcmp(backend_mode, DB_CONFIG_HASH_QNAME) == 0))
+			ret->frontends[ret->frontends_count]->backend.mode = DB_BE_MODE_HASH_QNAME;
+		else if (likely(strcmp(backend_mode, DB_CONFIG_HASH_QNAME_QTYPE) == 0))
+			ret->frontends[ret->frontends_count]->backend.mode = DB_BE_MODE_HASH_QNAME_QTYPE;
+		else if (likely(strcmp(backend_mode, DB_CONFIG_WRR) == 0))
+			ret->frontends[ret->frontends_count]->backend.mode = DB_BE_MODE_WRR;
 		else
 		{
 			inform("Backend: %s\n", frontend_backend);
 			stop("Unknown backend mode specified in config file");
 		}
 
+		db_outlier_detection_load(config, frontend_backend, &ret->frontends[ret->frontends_count]->backend.outlier);
+		ret->frontends[ret->frontends_count]->backend.tier_min_alive =
+			(size_t)db_backend_getint(config, frontend_backend, "tier_min_alive", 1, 1, INT_MAX);
+		ret->frontends[ret->frontends_count]->backend.tier_min_weight =
+			db_backend_getint(config, frontend_backend, "tier_min_weight", 0, 0, 100);
+		ret->frontends[ret->frontends_count]->backend.max_retries =
+			(size_t)db_backend_getint(config, frontend_backend, "max_retries", 0, 0, UINT16_MAX);
+		ret->frontends[ret->frontends_count]->backend.retry_timeout =
+			db_backend_getint(config, frontend_backend, "retry_timeout", DB_DEFAULT_RETRY_TIMEOUT, 1, INT_MAX);
+		char* backend_overflow_action_key = pfcq_mstring("%s:%s", frontend_backend, "overflow_action");
+		const char* backend_overflow_action = iniparser_getstring(config, backend_overflow_action_key, DB_CONFIG_OVERFLOW_SERVFAIL);
+		if (likely(strcmp(backend_overflow_action, DB_CONFIG_OVERFLOW_SERVFAIL) == 0))
+			ret->frontends[ret->frontends_count]->backend.overflow_action = DB_OVERFLOW_SERVFAIL;
+		else if (strcmp(backend_overflow_action, DB_CONFIG_OVERFLOW_REFUSED) == 0)
+			ret->frontends[ret->frontends_count]->backend.overflow_action = DB_OVERFLOW_REFUSED;
+		else if (strcmp(backend_overflow_action, DB_CONFIG_OVERFLOW_DROP) == 0)
+			ret->frontends[ret->frontends_count]->backend.overflow_action = DB_OVERFLOW_DROP;
+		else
+		{
+			inform("Backend: %s\n", frontend_backend);
+			stop("Unknown overflow action specified in config file");
+		}
+		pfcq_free(backend_overflow_action_key);
+
 		const char* backend_forwarders = iniparser_getstring(config, backend_forwarders_key, NULL);
 		if (unlikely(!backend_forwarders))
 		{
@@ -240,6 +399,10 @@ struct db_local_context* db_local_context_load(const char* _config_file, struct
 			char* forwarder_check_timeout_key = pfcq_mstring("%s:%s", forwarder, "check_timeout");
 			char* forwarder_check_query_key = pfcq_mstring("%s:%s", forwarder, "check_query");
 			char* forwarder_weight_key = pfcq_mstring("%s:%s", forwarder, "weight");
+			char* forwarder_slow_start_key = pfcq_mstring("%s:%s", forwarder, "slow_start");
+			char* forwarder_slow_start_mode_key = pfcq_mstring("%s:%s", forwarder, "slow_start_mode");
+			char* forwarder_priority_key = pfcq_mstring("%s:%s", forwarder, "priority");
+			char* forwarder_max_outstanding_key = pfcq_mstring("%s:%s", forwarder, "max_outstanding");
 
 			const char* forwarder_host = iniparser_getstring(config, forwarder_host_key, NULL);
 			if (unlikely(!forwarder_host))
@@ -300,16 +463,39 @@ struct db_local_context* db_local_context_load(const char* _config_file, struct
 			}
 			ret->frontends[ret->frontends_count]->backend.forwarders[ret->frontends[ret->frontends_count]->backend.forwarders_count]->check_query =
 				pfcq_strdup(forwarder_check_query);
-			if (unlikely(pthread_spin_init(&ret->frontends[ret->frontends_count]->backend.forwarders[ret->frontends[ret->frontends_count]->backend.forwarders_count]->stats.in_lock,
-							PTHREAD_PROCESS_PRIVATE)))
-				panic("pthread_spin_init");
-			if (unlikely(pthread_spin_init(&ret->frontends[ret->frontends_count]->backend.forwarders[ret->frontends[ret->frontends_count]->backend.forwarders_count]->stats.out_lock,
-							PTHREAD_PROCESS_PRIVATE)))
-				panic("pthread_spin_init");
 			ret->frontends[ret->frontends_count]->backend.forwarders[ret->frontends[ret->frontends_count]->backend.forwarders_count]->weight =
 				(uint64_t)iniparser_getint(config, forwarder_weight_key, DB_DEFAULT_WEIGHT);
-			ret->frontends[ret->frontends_count]->backend.total_weight +=
-				ret->frontends[ret->frontends_count]->backend.forwarders[ret->frontends[ret->frontends_count]->backend.forwarders_count]->weight;
+			int forwarder_slow_start = iniparser_getint(config, forwarder_slow_start_key, 0);
+			if (unlikely(forwarder_slow_start < 0))
+			{
+				inform("Forwarder: %s\n", forwarder);
+				stop("Slow start window must not be negative");
+			}
+			ret->frontends[ret->frontends_count]->backend.forwarders[ret->frontends[ret->frontends_count]->backend.forwarders_count]->slow_start = (uint64_t)forwarder_slow_start;
+			const char* forwarder_slow_start_mode = iniparser_getstring(config, forwarder_slow_start_mode_key, DB_CONFIG_SLOW_START_LINEAR);
+			if (likely(strcmp(forwarder_slow_start_mode, DB_CONFIG_SLOW_START_LINEAR) == 0))
+				ret->frontends[ret->frontends_count]->backend.forwarders[ret->frontends[ret->frontends_count]->backend.forwarders_count]->slow_start_mode = DB_SLOW_START_LINEAR;
+			else if (strcmp(forwarder_slow_start_mode, DB_CONFIG_SLOW_START_EXPONENTIAL) == 0)
+				ret->frontends[ret->frontends_count]->backend.forwarders[ret->frontends[ret->frontends_count]->backend.forwarders_count]->slow_start_mode = DB_SLOW_START_EXPONENTIAL;
+			else
+			{
+				inform("Forwarder: %s\n", forwarder);
+				stop("Unknown slow start mode specified in config file");
+			}
+			int forwarder_priority = iniparser_getint(config, forwarder_priority_key, 0);
+			if (unlikely(forwarder_priority < 0))
+			{
+				inform("Forwarder: %s\n", forwarder);
+				stop("Forwarder priority must not be negative");
+			}
+			ret->frontends[ret->frontends_count]->backend.forwarders[ret->frontends[ret->frontends_count]->backend.forwarders_count]->priority = (uint64_t)forwarder_priority;
+			int forwarder_max_outstanding = iniparser_getint(config, forwarder_max_outstanding_key, 0);
+			if (unlikely(forwarder_max_outstanding < 0))
+			{
+				inform("Forwarder: %s\n", forwarder);
+				stop("Forwarder in-flight cap must not be negative");
+			}
+			ret->frontends[ret->frontends_count]->backend.forwarders[ret->frontends[ret->frontends_count]->backend.forwarders_count]->max_outstanding = (uint64_t)forwarder_max_outstanding;
 
 			pfcq_free(forwarder_host_key);
 			pfcq_free(forwarder_port_key);
@@ -318,11 +504,17 @@ struct db_local_context* db_local_context_load(const char* _config_file, struct
 			pfcq_free(forwarder_check_timeout_key);
 			pfcq_free(forwarder_check_query_key);
 			pfcq_free(forwarder_weight_key);
+			pfcq_free(forwarder_slow_start_key);
+			pfcq_free(forwarder_slow_start_mode_key);
+			pfcq_free(forwarder_priority_key);
+			pfcq_free(forwarder_max_outstanding_key);
 
 			ret->frontends[ret->frontends_count]->backend.forwarders_count++;
 		}
 		pfcq_free(backend_forwarders_iterator_p);
 
+		db_backend_init(&ret->frontends[ret->frontends_count]->backend);
+
 		pfcq_free(backend_mode_key);
 		pfcq_free(backend_forwarders_key);
 
@@ -361,6 +553,14 @@ struct db_local_context* db_local_context_load(const char* _config_file, struct
 		pfcq_free(frontend_layer3_key);
 		pfcq_free(frontend_bind_key);
 		pfcq_free(frontend_acl_key);
+		pfcq_free(frontend_batch_size_key);
+		pfcq_free(frontend_request_pool_limit_key);
+		pfcq_free(frontend_io_engine_key);
+		pfcq_free(frontend_xdp_interface_key);
+		pfcq_free(frontend_xdp_queue_key);
+		pfcq_free(frontend_xdp_mode_key);
+		pfcq_free(frontend_xdp_zerocopy_key);
+		pfcq_free(frontend_xdp_program_key);
 
 		ret->frontends_count++;
 	}
@@ -372,34 +572,71 @@ struct db_local_context* db_local_context_load(const char* _config_file, struct
 	ret->watchdog_eventfd = eventfd(0, 0);
 	if (unlikely(ret->watchdog_eventfd == -1))
 		panic("eventfd");
-	pfpthq_inc(ret->watchdog_pool, &ret->watchdog_id, "watchdog", db_watchdog, (void*)ret);
 
 	for (size_t i = 0; i < ret->frontends_count; i++)
 	{
 		if (unlikely(pthread_spin_init(&ret->frontends[i]->backend.queries_lock, PTHREAD_PROCESS_PRIVATE)))
 			panic("pthread_spin_init");
-		if (unlikely(pthread_spin_init(&ret->frontends[i]->stats.in_lock, PTHREAD_PROCESS_PRIVATE)))
-			panic("pthread_spin_init");
-		if (unlikely(pthread_spin_init(&ret->frontends[i]->stats.out_lock, PTHREAD_PROCESS_PRIVATE)))
-			panic("pthread_spin_init");
-		if (unlikely(pthread_spin_init(&ret->frontends[i]->stats.in_invalid_lock, PTHREAD_PROCESS_PRIVATE)))
-			panic("pthread_spin_init");
+
+#ifdef DB_HAVE_XDP
+		// Workers register their AF_XDP sockets in the program maps
+		if (ret->frontends[i]->io_engine == DB_IO_ENGINE_XDP)
+			db_frontend_xdp_load(ret->frontends[i]);
+#endif /* DB_HAVE_XDP */
 
 		for (int j = 0; j < ret->frontends[i]->workers_count; j++)
 		{
 			struct db_worker* new_worker = pfcq_alloc(sizeof(struct db_worker));
 			new_worker->frontend = ret->frontends[i];
+			new_worker->index = (size_t)j;
 			new_worker->eventfd = eventfd(0, 0);
 			if (unlikely(new_worker->eventfd == -1))
 				panic("eventfd");
+			db_stats_worker_init(new_worker);
 			ret->frontends[i]->workers[j] = new_worker;
 			pfpthq_inc(ret->frontends[i]->workers_pool, &new_worker->id, ret->frontends[i]->name, db_worker, new_worker);
 		}
 	}
 
+	// Watchdog reads worker stats for outlier detection, so it goes last
+	pfpthq_inc(ret->watchdog_pool, &ret->watchdog_id, "watchdog", db_watchdog, (void*)ret);
+
 	return ret;
 }
 
+static void db_frontend_stop(struct db_frontend* _frontend)
+{
+	if (!_frontend->workers_pool)
+		return;
+
+	for (int i = 0; i < _frontend->workers_count; i++)
+		if (unlikely(eventfd_write(_frontend->workers[i]->eventfd, 1) == -1))
+			panic("eventfd_write");
+	pfpthq_wait(_frontend->workers_pool);
+	pfpthq_done(_frontend->workers_pool);
+	_frontend->workers_pool = NULL;
+
+#ifdef DB_HAVE_XDP
+	if (_frontend->xdp)
+	{
+		db_frontend_xdp_unload(_frontend);
+		_frontend->xdp = NULL;
+	}
+#endif /* DB_HAVE_XDP */
+
+	return;
+}
+
+void db_local_context_release(struct db_local_context* _l_ctx)
+{
+	// AF_XDP queues and the attached program cannot be shared, so the next context must not overlap with these frontends
+	for (size_t i = 0; i < _l_ctx->frontends_count; i++)
+		if (_l_ctx->frontends[i]->io_engine == DB_IO_ENGINE_XDP)
+			db_frontend_stop(_l_ctx->frontends[i]);
+
+	return;
+}
+
 void db_local_context_unload(struct db_local_context* _l_ctx)
 {
 	if (unlikely(eventfd_write(_l_ctx->watchdog_eventfd, 1) == -1))
@@ -409,32 +646,26 @@ void db_local_context_unload(struct db_local_context* _l_ctx)
 
 	for (size_t i = 0; i < _l_ctx->frontends_count; i++)
 	{
+		db_frontend_stop(_l_ctx->frontends[i]);
 		for (int j = 0; j < _l_ctx->frontends[i]->workers_count; j++)
-			if (unlikely(eventfd_write(_l_ctx->frontends[i]->workers[j]->eventfd, 1) == -1))
-				panic("eventfd_write");
-		pfpthq_wait(_l_ctx->frontends[i]->workers_pool);
-		pfpthq_done(_l_ctx->frontends[i]->workers_pool);
-		for (int j = 0; j < _l_ctx->frontends[i]->workers_count; j++)
+		{
+			db_stats_worker_done(_l_ctx->frontends[i]->workers[j]);
 			pfcq_free(_l_ctx->frontends[i]->workers[j]);
+		}
+		if (_l_ctx->frontends[i]->xdp_interface)
+			pfcq_free(_l_ctx->frontends[i]->xdp_interface);
+		if (_l_ctx->frontends[i]->xdp_program)
+			pfcq_free(_l_ctx->frontends[i]->xdp_program);
 		for (size_t j = 0; j < _l_ctx->frontends[i]->backend.forwarders_count; j++)
 		{
 			pfcq_free(_l_ctx->frontends[i]->backend.forwarders[j]->name);
 			pfcq_free(_l_ctx->frontends[i]->backend.forwarders[j]->check_query);
-			if (unlikely(pthread_spin_destroy(&_l_ctx->frontends[i]->backend.forwarders[j]->stats.in_lock)))
-				panic("pthread_spin_destroy");
-			if (unlikely(pthread_spin_destroy(&_l_ctx->frontends[i]->backend.forwarders[j]->stats.out_lock)))
-				panic("pthread_spin_destroy");
 			pfcq_free(_l_ctx->frontends[i]->backend.forwarders[j]);
 		}
+		db_backend_done(&_l_ctx->frontends[i]->backend);
 		pfcq_free(_l_ctx->frontends[i]->backend.forwarders);
 		pfcq_free(_l_ctx->frontends[i]->workers);
 		pfcq_free(_l_ctx->frontends[i]->name);
-		if (unlikely(pthread_spin_destroy(&_l_ctx->frontends[i]->stats.in_lock)))
-			panic("pthread_spin_destroy");
-		if (unlikely(pthread_spin_destroy(&_l_ctx->frontends[i]->stats.out_lock)))
-			panic("pthread_spin_destroy");
-		if (unlikely(pthread_spin_destroy(&_l_ctx->frontends[i]->stats.in_invalid_lock)))
-			panic("pthread_spin_destroy");
 		if (unlikely(pthread_spin_destroy(&_l_ctx->frontends[i]->backend.queries_lock)))
 			panic("pthread_spin_destroy");
 		switch (_l_ctx->frontends[i]->acl_source)
@@ -26,6 +26,7 @@
 #include "types.h"
 
 struct db_local_context* db_local_context_load(const char* _config_file, struct db_global_context* _g_ctx) __attribute__((nonnull(1, 2)));
+void db_local_context_release(struct db_local_context* _l_ctx) __attribute__((nonnull(1)));
 void db_local_context_unload(struct db_local_context* _l_ctx) __attribute__((nonnull(1)));
 
 #endif /* __LOCAL_CONTEXT_H__ */
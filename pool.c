@@ -0,0 +1,108 @@
+/* vim: set tabstop=4:softtabstop=4:shiftwidth=4:noexpandtab */
+
+/*
+ * dnsbalancer - daemon to balance UDP DNS requests over DNS servers
+ * Copyright (C) 2015-2016 Lanet Network
+ * Programmed by Oleksandr Natalenko <o.natalenko@lanet.ua>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include "types.h"
+
+#include "pool.h"
+
+static void db_pool_grow(struct db_pool* _pool)
+{
+	uint8_t* slab = NULL;
+	size_t slab_size = _pool->object_size * _pool->slab_objects;
+
+	if (unlikely(posix_memalign((void**)&slab, DB_CACHE_LINE_SIZE, slab_size)))
+		panic("posix_memalign");
+	if (unlikely(!_pool->slabs))
+		_pool->slabs = pfcq_alloc(sizeof(void*));
+	else
+		_pool->slabs = pfcq_realloc(_pool->slabs, (_pool->slabs_count + 1) * sizeof(void*));
+	_pool->slabs[_pool->slabs_count] = slab;
+
+	// Thread new objects into free list keeping their order
+	for (size_t i = _pool->slab_objects; i > 0; i--)
+	{
+		void** object = (void**)(slab + (i - 1) * _pool->object_size);
+		*object = _pool->free_list;
+		_pool->free_list = object;
+	}
+	__atomic_store_n(&_pool->slabs_count, _pool->slabs_count + 1, __ATOMIC_RELAXED);
+
+	return;
+}
+
+void db_pool_init(struct db_pool* _pool, size_t _object_size, size_t _limit)
+{
+	pfcq_zero(_pool, sizeof(struct db_pool));
+
+	// Every object starts on its own cache line
+	_pool->object_size = (_object_size + DB_CACHE_LINE_SIZE - 1) & ~((size_t)DB_CACHE_LINE_SIZE - 1);
+	_pool->slab_objects = DB_POOL_SLAB_OBJECTS;
+	_pool->limit = _limit;
+
+	return;
+}
+
+void db_pool_done(struct db_pool* _pool)
+{
+	for (size_t i = 0; i < _pool->slabs_count; i++)
+		free(_pool->slabs[i]);
+	if (_pool->slabs)
+		pfcq_free(_pool->slabs);
+	_pool->slabs = NULL;
+	_pool->slabs_count = 0;
+	_pool->free_list = NULL;
+	_pool->used = 0;
+
+	return;
+}
+
+void* db_pool_alloc(struct db_pool* _pool)
+{
+	void** ret = NULL;
+
+	if (unlikely(_pool->limit && _pool->used == _pool->limit))
+	{
+		__atomic_store_n(&_pool->exhausted, _pool->exhausted + 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	if (unlikely(!_pool->free_list))
+		db_pool_grow(_pool);
+	ret = _pool->free_list;
+	_pool->free_list = *ret;
+
+	__atomic_store_n(&_pool->used, _pool->used + 1, __ATOMIC_RELAXED);
+	if (unlikely(_pool->used > _pool->peak))
+		__atomic_store_n(&_pool->peak, _pool->used, __ATOMIC_RELAXED);
+
+	return ret;
+}
+
+void db_pool_free(struct db_pool* _pool, void* _object)
+{
+	*(void**)_object = _pool->free_list;
+	_pool->free_list = _object;
+	__atomic_store_n(&_pool->used, _pool->used - 1, __ATOMIC_RELAXED);
+
+	return;
+}
+
@@ -0,0 +1,34 @@
+/* vim: set tabstop=4:softtabstop=4:shiftwidth=4:noexpandtab */
+
+/*
+ * dnsbalancer - daemon to balance UDP DNS requests over DNS servers
+ * Copyright (C) 2015-2016 Lanet Network
+ * Programmed by Oleksandr Natalenko <o.natalenko@lanet.ua>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include "types.h"
+
+void db_pool_init(struct db_pool* _pool, size_t _object_size, size_t _limit) __attribute__((nonnull(1)));
+void db_pool_done(struct db_pool* _pool) __attribute__((nonnull(1)));
+void* db_pool_alloc(struct db_pool* _pool) __attribute__((nonnull(1), warn_unused_result));
+void db_pool_free(struct db_pool* _pool, void* _object) __attribute__((nonnull(1, 2)));
+
+#endif /* __POOL_H__ */
+
@@ -0,0 +1,104 @@
+/* vim: set tabstop=4:softtabstop=4:shiftwidth=4:noexpandtab */
+
+/*
+ * dnsbalancer - daemon to balance UDP DNS requests over DNS servers
+ * Copyright (C) 2015-2016 Lanet Network
+ * Programmed by Oleksandr Natalenko <o.natalenko@lanet.ua>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "pool.h"
+
+static void db_test_pool_alloc(void)
+{
+	struct db_pool pool;
+	void* objects[DB_POOL_SLAB_OBJECTS * 2 + 1];
+
+	db_pool_init(&pool, 40, 0);
+	assert(pool.object_size == DB_CACHE_LINE_SIZE);
+
+	// Crossing slab boundary twice
+	for (size_t i = 0; i < DB_POOL_SLAB_OBJECTS * 2 + 1; i++)
+	{
+		objects[i] = db_pool_alloc(&pool);
+		assert(objects[i]);
+		assert(((uintptr_t)objects[i] & (DB_CACHE_LINE_SIZE - 1)) == 0);
+		memset(objects[i], (int)(i & 0xff), 40);
+	}
+	assert(pool.slabs_count == 3);
+	assert(pool.used == DB_POOL_SLAB_OBJECTS * 2 + 1);
+	assert(pool.peak == pool.used);
+
+	// Nobody scribbled over anybody else
+	for (size_t i = 0; i < DB_POOL_SLAB_OBJECTS * 2 + 1; i++)
+		for (size_t j = 0; j < 40; j++)
+			assert(((uint8_t*)objects[i])[j] == (uint8_t)(i & 0xff));
+
+	// Freed objects are handed out again before the pool grows
+	db_pool_free(&pool, objects[3]);
+	db_pool_free(&pool, objects[7]);
+	assert(pool.used == DB_POOL_SLAB_OBJECTS * 2 - 1);
+	assert(db_pool_alloc(&pool) == objects[7]);
+	assert(db_pool_alloc(&pool) == objects[3]);
+	assert(pool.slabs_count == 3);
+	assert(pool.peak == pool.used);
+
+	db_pool_done(&pool);
+	assert(!pool.slabs_count);
+	assert(!pool.used);
+
+	// Pool is good to go again after being emptied
+	assert(db_pool_alloc(&pool));
+	assert(pool.slabs_count == 1);
+	db_pool_done(&pool);
+
+	return;
+}
+
+static void db_test_pool_limit(void)
+{
+	struct db_pool pool;
+	void* objects[3];
+
+	db_pool_init(&pool, DB_CACHE_LINE_SIZE + 1, 3);
+	assert(pool.object_size == DB_CACHE_LINE_SIZE * 2);
+
+	for (size_t i = 0; i < 3; i++)
+		assert((objects[i] = db_pool_alloc(&pool)));
+	assert(!db_pool_alloc(&pool));
+	assert(!db_pool_alloc(&pool));
+	assert(pool.exhausted == 2);
+
+	db_pool_free(&pool, objects[1]);
+	assert(db_pool_alloc(&pool) == objects[1]);
+	assert(pool.exhausted == 2);
+	assert(pool.peak == 3);
+
+	db_pool_done(&pool);
+
+	return;
+}
+
+int main(void)
+{
+	db_test_pool_alloc();
+	db_test_pool_limit();
+
+	printf("%s\n", "pool: OK");
+
+	return 0;
+}
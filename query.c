@@ -0,0 +1,191 @@
+/* vim: set tabstop=4:softtabstop=4:shiftwidth=4:noexpandtab */
+
+/*
+ * dnsbalancer - daemon to balance UDP DNS requests over DNS servers
+ * Copyright (C) 2015-2016 Lanet Network
+ * Programmed by Oleksandr Natalenko <o.natalenko@lanet.ua>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+
+#include "query.h"
+
+static inline uint8_t db_query_lower(uint8_t _c) __attribute__((always_inline));
+
+static inline uint8_t db_query_lower(uint8_t _c)
+{
+	return (_c >= 'A' && _c <= 'Z') ? (uint8_t)(_c | 0x20) : _c;
+}
+
+int db_query_parse(const uint8_t* _buffer, size_t _length, struct db_query* _query)
+{
+	size_t offset = DB_DNS_HEADER_LENGTH;
+
+	if (unlikely(_length < DB_DNS_HEADER_LENGTH))
+		return -1;
+	// Only 1 query is processed within 1 DNS packet
+	if (unlikely(db_query_u16(_buffer + 4) != 1))
+		return -1;
+
+	_query->id = db_query_u16(_buffer);
+	_query->response = (unsigned short int)((_buffer[2] & 0x80) != 0);
+	_query->qname_length = 0;
+
+	for (;;)
+	{
+		if (unlikely(offset >= _length))
+			return -1;
+		uint8_t label = _buffer[offset++];
+		// Compression pointers and extended labels make no sense within the question
+		if (unlikely(label & 0xc0))
+			return -1;
+		if (unlikely(_query->qname_length + 1 + label > DB_QNAME_MAX_LENGTH || offset + label > _length))
+			return -1;
+		_query->qname[_query->qname_length++] = label;
+		if (!label)
+			break;
+		for (size_t i = 0; i < label; i++)
+			_query->qname[_query->qname_length++] = db_query_lower(_buffer[offset + i]);
+		offset += label;
+	}
+
+	if (unlikely(offset + 4 > _length))
+		return -1;
+	_query->qtype = db_query_u16(_buffer + offset);
+	_query->qclass = db_query_u16(_buffer + offset + 2);
+	offset += 4;
+	_query->question_end = offset;
+
+	// OPT RR is expected to be the only record following the question of a query
+	_query->edns = (unsigned short int)(
+		db_query_u16(_buffer + 6) == 0 &&
+		db_query_u16(_buffer + 8) == 0 &&
+		db_query_u16(_buffer + 10) != 0 &&
+		offset + 11 <= _length &&
+		_buffer[offset] == 0 &&
+		db_query_u16(_buffer + offset + 1) == LDNS_RR_TYPE_OPT);
+
+	return 0;
+}
+
+size_t db_query_fqdn(const struct db_query* _query, char* _fqdn)
+{
+	size_t ret = 0;
+	size_t offset = 0;
+
+	if (unlikely(!_query->qname[0]))
+		_fqdn[ret++] = '.';
+
+	while (_query->qname[offset])
+	{
+		uint8_t label = _query->qname[offset++];
+		for (size_t i = 0; i < label; i++)
+		{
+			uint8_t c = _query->qname[offset + i];
+			switch (c)
+			{
+				case '.':
+				case ';':
+				case '(':
+				case ')':
+				case '\\':
+				case '"':
+					_fqdn[ret++] = '\\';
+					_fqdn[ret++] = (char)c;
+					break;
+				default:
+					if (unlikely(c < 0x21 || c > 0x7e))
+						ret += (size_t)sprintf(_fqdn + ret, "\\%03u", c);
+					else
+						_fqdn[ret++] = (char)c;
+					break;
+			}
+		}
+		offset += label;
+		_fqdn[ret++] = '.';
+	}
+	_fqdn[ret] = '\0';
+
+	return ret;
+}
+
+ssize_t db_query_name2wire(const char* _name, uint8_t* _wire)
+{
+	size_t ret = 0;
+	size_t label_offset = 0;
+	size_t label_length = 0;
+	const char* p = _name;
+
+	// Root is both "." and ""
+	if (*p == '.' && *(p + 1) == '\0')
+		p++;
+
+	_wire[ret++] = 0;
+	while (*p)
+	{
+		uint8_t c = (uint8_t)*p++;
+		if (c == '.')
+		{
+			if (unlikely(!label_length))
+				return -1;
+			_wire[label_offset] = (uint8_t)label_length;
+			label_offset = ret;
+			label_length = 0;
+			if (unlikely(ret >= DB_QNAME_MAX_LENGTH))
+				return -1;
+			_wire[ret++] = 0;
+			continue;
+		}
+		if (c == '\\')
+		{
+			if (*p >= '0' && *p <= '9' && *(p + 1) >= '0' && *(p + 1) <= '9' && *(p + 2) >= '0' && *(p + 2) <= '9')
+			{
+				unsigned int value = (unsigned int)((*p - '0') * 100 + (*(p + 1) - '0') * 10 + (*(p + 2) - '0'));
+				if (unlikely(value > UINT8_MAX))
+					return -1;
+				c = (uint8_t)value;
+				p += 3;
+			} else if (likely(*p))
+				c = (uint8_t)*p++;
+			else
+				return -1;
+		}
+		if (unlikely(label_length == 63 || ret >= DB_QNAME_MAX_LENGTH - 1))
+			return -1;
+		_wire[ret++] = db_query_lower(c);
+		label_length++;
+	}
+
+	// Trailing dot is optional
+	if (label_length)
+	{
+		_wire[label_offset] = (uint8_t)label_length;
+		_wire[ret++] = 0;
+	}
+
+	return (ssize_t)ret;
+}
+
+int db_query_is_subdomain(const struct db_query* _query, const uint8_t* _wire, size_t _wire_length)
+{
+	size_t offset = 0;
+
+	// Walk label boundaries until the rest of qname is as long as the domain
+	while (_query->qname_length - offset > _wire_length)
+		offset += (size_t)_query->qname[offset] + 1;
+
+	return _query->qname_length - offset == _wire_length && memcmp(_query->qname + offset, _wire, _wire_length) == 0;
+}
+
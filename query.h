@@ -0,0 +1,47 @@
+/* vim: set tabstop=4:softtabstop=4:shiftwidth=4:noexpandtab */
+
+/*
+ * dnsbalancer - daemon to balance UDP DNS requests over DNS servers
+ * Copyright (C) 2015-2016 Lanet Network
+ * Programmed by Oleksandr Natalenko <o.natalenko@lanet.ua>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifndef __QUERY_H__
+#define __QUERY_H__
+
+#include "types.h"
+
+int db_query_parse(const uint8_t* _buffer, size_t _length, struct db_query* _query) __attribute__((nonnull(1, 3)));
+size_t db_query_fqdn(const struct db_query* _query, char* _fqdn) __attribute__((nonnull(1, 2)));
+ssize_t db_query_name2wire(const char* _name, uint8_t* _wire) __attribute__((nonnull(1, 2)));
+int db_query_is_subdomain(const struct db_query* _query, const uint8_t* _wire, size_t _wire_length) __attribute__((nonnull(1, 2)));
+
+static inline uint16_t db_query_u16(const uint8_t* _buffer) __attribute__((always_inline, nonnull(1)));
+static inline ldns_pkt_rcode db_query_rcode(const uint8_t* _buffer) __attribute__((always_inline, nonnull(1)));
+
+static inline uint16_t db_query_u16(const uint8_t* _buffer)
+{
+	return (uint16_t)((_buffer[0] << 8) | _buffer[1]);
+}
+
+static inline ldns_pkt_rcode db_query_rcode(const uint8_t* _buffer)
+{
+	return (ldns_pkt_rcode)(_buffer[3] & 0x0f);
+}
+
+#endif /* __QUERY_H__ */
+
@@ -0,0 +1,267 @@
+/* vim: set tabstop=4:softtabstop=4:shiftwidth=4:noexpandtab */
+
+/*
+ * dnsbalancer - daemon to balance UDP DNS requests over DNS servers
+ * Copyright (C) 2015-2016 Lanet Network
+ * Programmed by Oleksandr Natalenko <o.natalenko@lanet.ua>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "query.h"
+
+static size_t db_test_packet(uint8_t* _buffer, const uint8_t* _qname, size_t _qname_length, unsigned short int _edns)
+{
+	size_t ret = 0;
+
+	pfcq_zero(_buffer, DB_DNS_HEADER_LENGTH);
+	_buffer[0] = 0xbe;
+	_buffer[1] = 0xef;
+	_buffer[5] = 1;
+	_buffer[11] = _edns ? 1 : 0;
+	ret = DB_DNS_HEADER_LENGTH;
+
+	memcpy(_buffer + ret, _qname, _qname_length);
+	ret += _qname_length;
+	// IN A
+	_buffer[ret++] = 0;
+	_buffer[ret++] = 1;
+	_buffer[ret++] = 0;
+	_buffer[ret++] = 1;
+
+	if (_edns)
+	{
+		const uint8_t opt[] = {0, 0, 41, 0x10, 0, 0, 0, 0, 0, 0, 0};
+		memcpy(_buffer + ret, opt, sizeof(opt));
+		ret += sizeof(opt);
+	}
+
+	return ret;
+}
+
+// Name of _length bytes on the wire made of 63-byte labels and a shorter last one
+static size_t db_test_long_qname(uint8_t* _qname, size_t _length)
+{
+	size_t ret = 0;
+
+	while (_length - ret > 1)
+	{
+		size_t label = _length - ret - 2;
+		if (label > 63)
+			label = 63;
+		_qname[ret++] = (uint8_t)label;
+		memset(_qname + ret, 'a', label);
+		ret += label;
+	}
+	_qname[ret++] = 0;
+
+	return ret;
+}
+
+static void db_test_parse(void)
+{
+	const uint8_t qname[] = "\3www\7ExAmPlE\3com";
+	uint8_t buffer[512];
+	struct db_query query;
+	char fqdn[DB_QNAME_MAX_LENGTH * 4 + 1];
+
+	size_t length = db_test_packet(buffer, qname, sizeof(qname), 0);
+	assert(db_query_parse(buffer, length, &query) == 0);
+	assert(query.id == 0xbeef);
+	assert(!query.response);
+	assert(!query.edns);
+	assert(query.qtype == LDNS_RR_TYPE_A);
+	assert(query.qclass == 1);
+	assert(query.question_end == length);
+	assert(query.qname_length == sizeof(qname));
+	assert(memcmp(query.qname, "\3www\7example\3com", sizeof(qname)) == 0);
+	assert(db_query_fqdn(&query, fqdn) == strlen("www.example.com."));
+	assert(strcmp(fqdn, "www.example.com.") == 0);
+
+	length = db_test_packet(buffer, qname, sizeof(qname), 1);
+	assert(db_query_parse(buffer, length, &query) == 0);
+	assert(query.edns);
+	assert(query.question_end == length - 11);
+
+	// Root
+	length = db_test_packet(buffer, (const uint8_t*)"", 1, 0);
+	assert(db_query_parse(buffer, length, &query) == 0);
+	assert(query.qname_length == 1);
+	assert(db_query_fqdn(&query, fqdn) == 1);
+	assert(strcmp(fqdn, ".") == 0);
+
+	return;
+}
+
+static void db_test_parse_truncated(void)
+{
+	const uint8_t qname[] = "\3www\7example\3com";
+	uint8_t buffer[512];
+	struct db_query query;
+
+	// Every cut short of the whole question is rejected, whether it is in the header, a label or qtype/qclass
+	size_t length = db_test_packet(buffer, qname, sizeof(qname), 0);
+	for (size_t i = 0; i < length; i++)
+		assert(db_query_parse(buffer, i, &query) == -1);
+
+	// Label claims more bytes than the packet has
+	length = db_test_packet(buffer, (const uint8_t*)"\x3fwww", 5, 0);
+	assert(db_query_parse(buffer, length, &query) == -1);
+
+	// Only one question is accepted
+	length = db_test_packet(buffer, qname, sizeof(qname), 0);
+	buffer[5] = 2;
+	assert(db_query_parse(buffer, length, &query) == -1);
+	buffer[5] = 0;
+	assert(db_query_parse(buffer, length, &query) == -1);
+
+	// OPT RR cut short is not EDNS, but the question is still fine
+	length = db_test_packet(buffer, qname, sizeof(qname), 1);
+	assert(db_query_parse(buffer, length - 1, &query) == 0);
+	assert(!query.edns);
+
+	return;
+}
+
+static void db_test_parse_compression(void)
+{
+	uint8_t buffer[512];
+	struct db_query query;
+
+	// Pointer back to the header
+	size_t length = db_test_packet(buffer, (const uint8_t*)"\xc0\x0c", 2, 0);
+	assert(db_query_parse(buffer, length, &query) == -1);
+
+	// Pointer after a regular label
+	length = db_test_packet(buffer, (const uint8_t*)"\3www\xc0\x0c", 6, 0);
+	assert(db_query_parse(buffer, length, &query) == -1);
+
+	// Extended label types
+	length = db_test_packet(buffer, (const uint8_t*)"\x41www", 5, 0);
+	assert(db_query_parse(buffer, length, &query) == -1);
+	length = db_test_packet(buffer, (const uint8_t*)"\x80www", 5, 0);
+	assert(db_query_parse(buffer, length, &query) == -1);
+
+	return;
+}
+
+static void db_test_parse_oversize(void)
+{
+	uint8_t qname[DB_QNAME_MAX_LENGTH * 2];
+	uint8_t buffer[DB_QNAME_MAX_LENGTH * 3];
+	struct db_query query;
+
+	size_t qname_length = db_test_long_qname(qname, DB_QNAME_MAX_LENGTH);
+	size_t length = db_test_packet(buffer, qname, qname_length, 0);
+	assert(db_query_parse(buffer, length, &query) == 0);
+	assert(query.qname_length == DB_QNAME_MAX_LENGTH);
+
+	qname_length = db_test_long_qname(qname, DB_QNAME_MAX_LENGTH + 1);
+	length = db_test_packet(buffer, qname, qname_length, 0);
+	assert(db_query_parse(buffer, length, &query) == -1);
+
+	qname_length = db_test_long_qname(qname, sizeof(qname));
+	length = db_test_packet(buffer, qname, qname_length, 0);
+	assert(db_query_parse(buffer, length, &query) == -1);
+
+	return;
+}
+
+static void db_test_name2wire(void)
+{
+	uint8_t wire[DB_QNAME_MAX_LENGTH + 1];
+	char name[DB_QNAME_MAX_LENGTH * 2];
+
+	assert(db_query_name2wire("Example.COM", wire) == 13);
+	assert(memcmp(wire, "\7example\3com", 13) == 0);
+	assert(db_query_name2wire("example.com.", wire) == 13);
+	assert(memcmp(wire, "\7example\3com", 13) == 0);
+	assert(db_query_name2wire(".", wire) == 1);
+	assert(wire[0] == 0);
+	assert(db_query_name2wire("", wire) == 1);
+
+	assert(db_query_name2wire("a\\.b.c", wire) == 7);
+	assert(memcmp(wire, "\3a.b\1c", 7) == 0);
+	assert(db_query_name2wire("\\065\\066", wire) == 4);
+	assert(memcmp(wire, "\2ab", 4) == 0);
+
+	assert(db_query_name2wire("a..b", wire) == -1);
+	assert(db_query_name2wire(".a", wire) == -1);
+	assert(db_query_name2wire("\\256", wire) == -1);
+	assert(db_query_name2wire("a\\", wire) == -1);
+
+	// 63 bytes is the longest label
+	memset(name, 'a', 63);
+	name[63] = '\0';
+	assert(db_query_name2wire(name, wire) == 65);
+	name[63] = 'a';
+	name[64] = '\0';
+	assert(db_query_name2wire(name, wire) == -1);
+
+	// 255 bytes is the longest name on the wire
+	for (size_t i = 0; i < 4; i++)
+	{
+		memset(name + i * 64, 'a', 63);
+		name[i * 64 + 63] = '.';
+	}
+	name[3 * 64 + 61] = '\0';
+	assert(db_query_name2wire(name, wire) == DB_QNAME_MAX_LENGTH);
+	name[3 * 64 + 61] = 'a';
+	name[3 * 64 + 62] = '\0';
+	assert(db_query_name2wire(name, wire) == -1);
+
+	return;
+}
+
+static void db_test_is_subdomain(void)
+{
+	const uint8_t qname[] = "\3www\7example\3com";
+	uint8_t buffer[512];
+	uint8_t wire[DB_QNAME_MAX_LENGTH + 1];
+	struct db_query query;
+
+	size_t length = db_test_packet(buffer, qname, sizeof(qname), 0);
+	assert(db_query_parse(buffer, length, &query) == 0);
+
+	assert(db_query_is_subdomain(&query, wire, (size_t)db_query_name2wire("example.com", wire)));
+	assert(db_query_is_subdomain(&query, wire, (size_t)db_query_name2wire("www.example.com", wire)));
+	assert(db_query_is_subdomain(&query, wire, (size_t)db_query_name2wire(".", wire)));
+	assert(!db_query_is_subdomain(&query, wire, (size_t)db_query_name2wire("ample.com", wire)));
+	assert(!db_query_is_subdomain(&query, wire, (size_t)db_query_name2wire("a.www.example.com", wire)));
+
+	// Domain is matched on label boundaries, not as a plain suffix
+	length = db_test_packet(buffer, (const uint8_t*)"\12badexample\3com", 16, 0);
+	assert(db_query_parse(buffer, length, &query) == 0);
+	assert(!db_query_is_subdomain(&query, wire, (size_t)db_query_name2wire("example.com", wire)));
+	assert(db_query_is_subdomain(&query, wire, (size_t)db_query_name2wire("badexample.com", wire)));
+	assert(db_query_is_subdomain(&query, wire, (size_t)db_query_name2wire("com", wire)));
+
+	return;
+}
+
+int main(void)
+{
+	db_test_parse();
+	db_test_parse_truncated();
+	db_test_parse_compression();
+	db_test_parse_oversize();
+	db_test_name2wire();
+	db_test_is_subdomain();
+
+	printf("%s\n", "query: OK");
+
+	return 0;
+}
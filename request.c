@@ -20,134 +20,242 @@
 
 #include "contrib/xxhash/xxhash.h"
 
+#include "pool.h"
+#include "timer.h"
+
 #include "request.h"
 
-struct db_request_data db_make_request_data(ldns_pkt* _packet, int _forwarder_socket)
+// In-flight record must fit into one cache line
+typedef char db_request_size_check[sizeof(struct db_request) <= DB_CACHE_LINE_SIZE ? 1 : -1];
+
+uint64_t db_request_fingerprint(const struct db_query* _query)
 {
-	struct db_request_data ret;
-	ldns_rr* rr = NULL;
-	ldns_rdf* owner = NULL;
-	char* owner_str = NULL;
-
-	pfcq_zero(&ret, sizeof(struct db_request_data));
-
-	rr = ldns_rr_list_rr(ldns_pkt_question(_packet), 0);
-	ret.rr_type = ldns_rr_get_type(rr);
-	ret.rr_class = ldns_rr_get_class(rr);
-	owner = ldns_rr_owner(rr);
-	ldns_dname2canonical(owner);
-	owner_str = ldns_rdf2str(owner);
-	strncpy(ret.fqdn, owner_str, HOST_NAME_MAX);
-	free(owner_str);
-	ret.forwarder_socket = _forwarder_socket;
-	ret.hash = XXH64((uint8_t*)&ret.rr_type, sizeof(ldns_rr_type), DB_HASH_SEED);
-	ret.hash = XXH64((uint8_t*)&ret.rr_class, sizeof(ldns_rr_class), ret.hash);
-	ret.hash = XXH64((uint8_t*)ret.fqdn, strlen(ret.fqdn), ret.hash);
-	ret.hash = XXH64((uint8_t*)&ret.forwarder_socket, sizeof(int), ret.hash);
+	uint64_t ret = 0;
+
+	ret = XXH64((const uint8_t*)&_query->qtype, sizeof(uint16_t), DB_HASH_SEED);
+	ret = XXH64((const uint8_t*)&_query->qclass, sizeof(uint16_t), ret);
+	ret = XXH64(_query->qname, _query->qname_length, ret);
 
 	return ret;
 }
 
-int db_compare_request_data(struct db_request_data _data1, struct db_request_data _data2)
+uint64_t db_request_clock(void)
 {
-	return
-		_data1.hash == _data2.hash &&
-		likely(
-			_data1.rr_type == _data2.rr_type &&
-			_data1.rr_class == _data2.rr_class &&
-			_data1.forwarder_socket == _data2.forwarder_socket &&
-			strncmp(_data1.fqdn, _data2.fqdn, HOST_NAME_MAX) == 0);
+	struct timespec current_time;
+
+	if (unlikely(clock_gettime(CLOCK_MONOTONIC, &current_time)))
+		panic("clock_gettime");
+
+	return (uint64_t)current_time.tv_sec * 1000000ULL + (uint64_t)current_time.tv_nsec / 1000ULL;
 }
 
-struct db_request* db_make_request(ldns_pkt* _packet, struct db_request_data _data, pfcq_net_address_t _address, size_t _forwarder_index)
+struct db_request* db_make_request(struct db_pool* _pool, const struct db_query* _query, const pfcq_net_address_t* _address, size_t _forwarder_index)
 {
 	struct db_request* ret = NULL;
 
-	ret = pfcq_alloc(sizeof(struct db_request));
+	ret = db_pool_alloc(_pool);
+	if (unlikely(!ret))
+		return NULL;
 
-	ret->original_id = ldns_pkt_id(_packet);
-	ret->data = _data;
-	ret->client_address = _address;
-	if (unlikely(clock_gettime(CLOCK_REALTIME, &ret->ctime)))
-		panic("clock_gettime");
-	ret->forwarder_index = _forwarder_index;
+	ret->original_id = _query->id;
+	ret->fingerprint = db_request_fingerprint(_query);
+	switch (_address->address.sa_family)
+	{
+		case AF_INET:
+			memcpy(ret->client_address, &_address->address4.sin_addr, sizeof(struct in_addr));
+			ret->client_port = _address->address4.sin_port;
+			ret->client_scope_id = 0;
+			break;
+		case AF_INET6:
+			memcpy(ret->client_address, &_address->address6.sin6_addr, sizeof(struct in6_addr));
+			ret->client_port = _address->address6.sin6_port;
+			ret->client_scope_id = _address->address6.sin6_scope_id;
+			break;
+		default:
+			panic("socket domain");
+			break;
+	}
+	// Low 32 bits of microseconds wrap every ~71 minutes, which is far beyond any request TTL
+	ret->ctime = (uint32_t)db_request_clock();
+	ret->forwarder_index = (uint16_t)_forwarder_index;
 
 	return ret;
 }
 
-uint16_t db_insert_request(struct db_request_list* _list, struct db_request* _request)
+void db_request_client_address(const struct db_request* _request, sa_family_t _layer3, pfcq_net_address_t* _address)
 {
-	uint16_t index = 0;
-	uint32_t index_container = 0;
-
-	if (unlikely(pthread_spin_lock(&_list->list_index_lock)))
-		panic("pthread_spin_lock");
-	index = _list->list_index;
-	index_container = _list->list_index;
-	index_container++;
-	_list->list_index = (uint16_t)(index_container % UINT16_MAX);
-	if (unlikely(pthread_spin_unlock(&_list->list_index_lock)))
-		panic("pthread_spin_unlock");
-
-	if (unlikely(pthread_mutex_lock(&_list->list[index].requests_lock)))
-		panic("pthread_mutex_lock");
-	TAILQ_INSERT_TAIL(&_list->list[index].requests, _request, tailq);
-	_list->list[index].requests_count++;
-	if (unlikely(pthread_mutex_unlock(&_list->list[index].requests_lock)))
-		panic("pthread_mutex_unlock");
-
-	if (unlikely(pthread_spin_lock(&_list->requests_count_lock)))
-		panic("pthread_spin_lock");
-	_list->requests_count++;
-	if (unlikely(pthread_spin_unlock(&_list->requests_count_lock)))
-		panic("pthread_spin_unlock");
-
-	return index;
+	pfcq_zero(_address, sizeof(pfcq_net_address_t));
+	switch (_layer3)
+	{
+		case PF_INET:
+			_address->address4.sin_family = AF_INET;
+			memcpy(&_address->address4.sin_addr, _request->client_address, sizeof(struct in_addr));
+			_address->address4.sin_port = _request->client_port;
+			break;
+		case PF_INET6:
+			_address->address6.sin6_family = AF_INET6;
+			memcpy(&_address->address6.sin6_addr, _request->client_address, sizeof(struct in6_addr));
+			_address->address6.sin6_port = _request->client_port;
+			_address->address6.sin6_scope_id = _request->client_scope_id;
+			break;
+		default:
+			panic("socket domain");
+			break;
+	}
+
+	return;
 }
 
-struct db_request* db_eject_request(struct db_request_list* _list, uint16_t _index, struct db_request_data _data)
+// Slots are probed linearly from ID, which is random already; once the map spans all 2^16 IDs,
+// every ID sits right in its own slot
+static size_t db_request_slot(const struct db_request_ids* _ids, uint16_t _id)
 {
-	struct db_request* ret = NULL;
+	size_t slot = _id & _ids->mask;
 
-	struct db_request* current_request = NULL;
-	if (unlikely(pthread_mutex_lock(&_list->list[_index].requests_lock)))
-		panic("pthread_mutex_lock");
-	TAILQ_FOREACH(current_request, &_list->list[_index].requests, tailq)
-	{
-		if (db_compare_request_data(current_request->data, _data))
+	while (_ids->slots[slot] && _ids->slots[slot]->id != _id)
+		slot = (slot + 1) & _ids->mask;
+
+	return slot;
+}
+
+static void db_request_resize(struct db_request_ids* _ids, size_t _slots)
+{
+	struct db_request** slots = _ids->slots;
+	size_t count = slots ? _ids->mask + 1 : 0;
+
+	_ids->slots = _slots ? pfcq_alloc(_slots * sizeof(struct db_request*)) : NULL;
+	_ids->mask = _slots ? _slots - 1 : 0;
+	for (size_t i = 0; i < count; i++)
+		if (slots[i])
+			_ids->slots[db_request_slot(_ids, slots[i]->id)] = slots[i];
+	if (slots)
+		pfcq_free(slots);
+
+	return;
+}
+
+static void db_request_release(struct db_request_table* _table, struct db_request* _request)
+{
+	struct db_request_ids* ids = &_table->forwarders[_request->forwarder_index];
+	size_t slot = db_request_slot(ids, _request->id);
+
+	db_timer_del(&_request->timer);
+
+	// Following entries of the probe run are shifted back into the hole, so no tombstones are left;
+	// map spanning all IDs keeps every entry in its home slot, so there is nothing to shift
+	ids->slots[slot] = NULL;
+	if (likely(ids->mask + 1 < DB_REQUEST_IDS))
+		for (size_t next = (slot + 1) & ids->mask; ids->slots[next]; next = (next + 1) & ids->mask)
 		{
-			ret = current_request;
-			break;
+			size_t home = ids->slots[next]->id & ids->mask;
+			if (((next - home) & ids->mask) >= ((next - slot) & ids->mask))
+			{
+				ids->slots[slot] = ids->slots[next];
+				ids->slots[next] = NULL;
+				slot = next;
+			}
 		}
-	}
-	if (likely(ret))
+	ids->used--;
+	// Idle forwarder gives its memory back
+	if (!ids->used && ids->mask + 1 > DB_REQUEST_SLOTS_MIN)
+		db_request_resize(ids, 0);
+
+	// Only the owning worker writes the counter, others just read it
+	__atomic_store_n(&_table->count, _table->count - 1, __ATOMIC_RELAXED);
+
+	return;
+}
+
+void db_request_table_init(struct db_request_table* _table, size_t _forwarders_count, struct db_pool* _pool, pfcq_fprng_context_t* _fprng_context)
+{
+	// ID maps are allocated on first request to forwarder and grow with the load
+	_table->pool = _pool;
+	_table->fprng_context = _fprng_context;
+	_table->forwarders_count = _forwarders_count;
+	_table->forwarders = pfcq_alloc(_forwarders_count * sizeof(struct db_request_ids));
+	_table->count = 0;
+
+	return;
+}
+
+void db_request_table_done(struct db_request_table* _table)
+{
+	for (size_t i = 0; i < _table->forwarders_count; i++)
 	{
-		TAILQ_REMOVE(&_list->list[_index].requests, ret, tailq);
-		_list->list[_index].requests_count--;
-		if (unlikely(pthread_spin_lock(&_list->requests_count_lock)))
-			panic("pthread_spin_lock");
-		_list->requests_count--;
-		if (unlikely(pthread_spin_unlock(&_list->requests_count_lock)))
-			panic("pthread_spin_unlock");
+		if (!_table->forwarders[i].slots)
+			continue;
+		for (size_t j = 0; j <= _table->forwarders[i].mask; j++)
+			if (_table->forwarders[i].slots[j])
+				db_pool_free(_table->pool, _table->forwarders[i].slots[j]);
+		pfcq_free(_table->forwarders[i].slots);
 	}
+	pfcq_free(_table->forwarders);
+	_table->forwarders_count = 0;
+	__atomic_store_n(&_table->count, 0, __ATOMIC_RELAXED);
+
+	return;
+}
 
-	if (unlikely(pthread_mutex_unlock(&_list->list[_index].requests_lock)))
-		panic("pthread_mutex_unlock");
+int db_insert_request(struct db_request_table* _table, struct db_request* _request)
+{
+	struct db_request_ids* ids = &_table->forwarders[_request->forwarder_index];
+	uint16_t id = 0;
+	size_t slot = 0;
+
+	// Every ID of this forwarder socket is still in flight
+	if (unlikely(ids->used == DB_REQUEST_IDS))
+		return -1;
+
+	// Map is kept at most half full until it spans all IDs
+	if (unlikely(!ids->slots))
+		db_request_resize(ids, DB_REQUEST_SLOTS_MIN);
+	else if (unlikely((ids->used + 1) * 2 > ids->mask + 1 && ids->mask + 1 < DB_REQUEST_IDS))
+		db_request_resize(ids, (ids->mask + 1) * 2);
+
+	// Random ID that is not in flight, so upstream IDs stay unpredictable
+	do
+	{
+		id = (uint16_t)pfcq_fprng_get_u64(_table->fprng_context);
+		slot = db_request_slot(ids, id);
+	} while (ids->slots[slot]);
+
+	_request->id = id;
+	ids->slots[slot] = _request;
+	ids->used++;
+	ids->outstanding++;
+	__atomic_store_n(&_table->count, _table->count + 1, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+struct db_request* db_eject_request(struct db_request_table* _table, size_t _forwarder_index, uint16_t _id, uint64_t _fingerprint)
+{
+	struct db_request_ids* ids = &_table->forwarders[_forwarder_index];
+
+	if (unlikely(!ids->slots))
+		return NULL;
+
+	struct db_request* ret = ids->slots[db_request_slot(ids, _id)];
+	// ID is never reused while outstanding, but the answer may still be a stale or spoofed one
+	if (unlikely(!ret || ret->fingerprint != _fingerprint))
+		return NULL;
+	db_request_release(_table, ret);
 
 	return ret;
 }
 
-void db_remove_request_unsafe(struct db_request_list* _list, uint16_t _index, struct db_request* _request)
+void db_expire_request(struct db_request_table* _table, struct db_request* _request)
 {
-	TAILQ_REMOVE(&_list->list[_index].requests, _request, tailq);
-	pfcq_free(_request);
-	_list->list[_index].requests_count--;
-	if (unlikely(pthread_spin_lock(&_list->requests_count_lock)))
-		panic("pthread_spin_lock");
-	_list->requests_count--;
-	if (unlikely(pthread_spin_unlock(&_list->requests_count_lock)))
-		panic("pthread_spin_unlock");
+	// Record stays with the caller, which returns it to the pool
+	db_request_release(_table, _request);
 
 	return;
 }
 
+void db_settle_request(struct db_request_table* _table, const struct db_request* _request)
+{
+	// Request may keep its ID for late answer, but it is not in flight any more
+	_table->forwarders[_request->forwarder_index].outstanding--;
+
+	return;
+}
@@ -29,12 +29,31 @@
 
 #include "contrib/pfcq/pfcq.h"
 
-struct db_request_data db_make_request_data(ldns_pkt* _packet, int _forwarder_socket) __attribute__((nonnull(1)));
-int db_compare_request_data(struct db_request_data _data1, struct db_request_data _data2);
-struct db_request* db_make_request(ldns_pkt* _packet, struct db_request_data _data, pfcq_net_address_t _address, size_t _forwarder_index) __attribute__((nonnull(1)));
-uint16_t db_insert_request(struct db_request_list* _list, struct db_request* _request) __attribute__((nonnull(1, 2)));
-struct db_request* db_eject_request(struct db_request_list* _list, uint16_t _index, struct db_request_data _data) __attribute__((nonnull(1)));
-void db_remove_request_unsafe(struct db_request_list* _list, uint16_t _index, struct db_request* _request) __attribute__((nonnull(1, 3)));
+uint64_t db_request_fingerprint(const struct db_query* _query) __attribute__((nonnull(1)));
+uint64_t db_request_clock(void);
+struct db_request* db_make_request(struct db_pool* _pool, const struct db_query* _query, const pfcq_net_address_t* _address, size_t _forwarder_index) __attribute__((nonnull(1, 2, 3)));
+void db_request_client_address(const struct db_request* _request, sa_family_t _layer3, pfcq_net_address_t* _address) __attribute__((nonnull(1, 3)));
+void db_request_table_init(struct db_request_table* _table, size_t _forwarders_count, struct db_pool* _pool, pfcq_fprng_context_t* _fprng_context) __attribute__((nonnull(1, 3, 4)));
+void db_request_table_done(struct db_request_table* _table) __attribute__((nonnull(1)));
+int db_insert_request(struct db_request_table* _table, struct db_request* _request) __attribute__((nonnull(1, 2)));
+struct db_request* db_eject_request(struct db_request_table* _table, size_t _forwarder_index, uint16_t _id, uint64_t _fingerprint) __attribute__((nonnull(1)));
+void db_expire_request(struct db_request_table* _table, struct db_request* _request) __attribute__((nonnull(1, 2)));
+void db_settle_request(struct db_request_table* _table, const struct db_request* _request) __attribute__((nonnull(1, 2)));
+
+static inline size_t db_request_outstanding(const struct db_request_table* _table, size_t _forwarder_index) __attribute__((always_inline, nonnull(1)));
+
+static inline size_t db_request_outstanding(const struct db_request_table* _table, size_t _forwarder_index)
+{
+	return _table->forwarders[_forwarder_index].outstanding;
+}
+
+static inline struct db_request_timeout* db_request_timeout(struct db_request* _request) __attribute__((always_inline, nonnull(1)));
+
+// Timeout state trails the record only if request pool is set up for it
+static inline struct db_request_timeout* db_request_timeout(struct db_request* _request)
+{
+	return (struct db_request_timeout*)(_request + 1);
+}
 
 #endif /* __REQUEST_H__ */
 
@@ -18,141 +18,298 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdlib.h>
+
 #include "types.h"
 #include "utils.h"
 
 #include "stats.h"
 
-void db_stats_frontend_in(struct db_frontend* _frontend, uint64_t _delta_bytes)
+// Counters are written by owning worker only, so relaxed stores are enough to avoid torn reads
+#define DB_STATS_ADD(_counter, _delta)	__atomic_store_n(&(_counter), (_counter) + (_delta), __ATOMIC_RELAXED)
+#define DB_STATS_SUM(_sum, _counter)	(_sum) += __atomic_load_n(&(_counter), __ATOMIC_RELAXED)
+
+static void* db_stats_alloc(size_t _size)
+{
+	void* ret = NULL;
+
+	// Keep every block on its own cache lines, so workers never share them
+	_size = (_size + DB_CACHE_LINE_SIZE - 1) & ~((size_t)DB_CACHE_LINE_SIZE - 1);
+	if (unlikely(posix_memalign(&ret, DB_CACHE_LINE_SIZE, _size ? _size : DB_CACHE_LINE_SIZE)))
+		panic("posix_memalign");
+	pfcq_zero(ret, _size);
+
+	return ret;
+}
+
+void db_stats_worker_init(struct db_worker* _worker)
 {
-	if (unlikely(pthread_spin_lock(&_frontend->stats.in_lock)))
-		panic("pthread_spin_lock");
-	_frontend->stats.in_pkts++;
-	_frontend->stats.in_bytes += _delta_bytes;
-	if (unlikely(pthread_spin_unlock(&_frontend->stats.in_lock)))
-		panic("pthread_spin_unlock");
+	struct db_frontend* frontend = _worker->frontend;
+	struct db_acl_item* current_acl_item = NULL;
+	size_t acl_items = 0;
+
+	TAILQ_FOREACH(current_acl_item, &frontend->acl, tailq)
+		acl_items++;
+
+	_worker->stats = db_stats_alloc(sizeof(struct db_worker_stats));
+	_worker->stats->forwarders = db_stats_alloc(frontend->backend.forwarders_count * sizeof(struct db_forwarder_stats));
+	_worker->stats->acl_hits = db_stats_alloc(acl_items * sizeof(uint64_t));
+
+	return;
+}
+
+void db_stats_worker_done(struct db_worker* _worker)
+{
+	free(_worker->stats->acl_hits);
+	free(_worker->stats->forwarders);
+	free(_worker->stats);
+	_worker->stats = NULL;
 
 	return;
 }
 
-void db_stats_frontend_in_invalid(struct db_frontend* _frontend, uint64_t _delta_bytes)
+void db_stats_frontend_in(struct db_worker* _worker, uint64_t _delta_bytes)
 {
-	if (unlikely(pthread_spin_lock(&_frontend->stats.in_invalid_lock)))
-		panic("pthread_spin_lock");
-	_frontend->stats.in_pkts_invalid++;
-	_frontend->stats.in_bytes_invalid += _delta_bytes;
-	if (unlikely(pthread_spin_unlock(&_frontend->stats.in_invalid_lock)))
-		panic("pthread_spin_unlock");
+	DB_STATS_ADD(_worker->stats->frontend.in_pkts, 1);
+	DB_STATS_ADD(_worker->stats->frontend.in_bytes, _delta_bytes);
 
 	return;
 }
 
-void db_stats_frontend_out(struct db_frontend* _frontend, uint64_t _delta_bytes, ldns_pkt_rcode _rcode)
+void db_stats_frontend_in_invalid(struct db_worker* _worker, uint64_t _delta_bytes)
 {
-	if (unlikely(pthread_spin_lock(&_frontend->stats.out_lock)))
-		panic("pthread_spin_lock");
-	_frontend->stats.out_pkts++;
-	_frontend->stats.out_bytes += _delta_bytes;
+	DB_STATS_ADD(_worker->stats->frontend.in_pkts_invalid, 1);
+	DB_STATS_ADD(_worker->stats->frontend.in_bytes_invalid, _delta_bytes);
+
+	return;
+}
+
+void db_stats_frontend_overflow(struct db_worker* _worker)
+{
+	DB_STATS_ADD(_worker->stats->frontend.overflows, 1);
+
+	return;
+}
+
+void db_stats_frontend_out(struct db_worker* _worker, uint64_t _delta_bytes, ldns_pkt_rcode _rcode)
+{
+	struct db_frontend_stats* stats = &_worker->stats->frontend;
+
+	DB_STATS_ADD(stats->out_pkts, 1);
+	DB_STATS_ADD(stats->out_bytes, _delta_bytes);
 	switch (_rcode)
 	{
 		case LDNS_RCODE_NOERROR:
-			_frontend->stats.out_noerror++;
+			DB_STATS_ADD(stats->out_noerror, 1);
 			break;
 		case LDNS_RCODE_SERVFAIL:
-			_frontend->stats.out_servfail++;
+			DB_STATS_ADD(stats->out_servfail, 1);
 			break;
 		case LDNS_RCODE_NXDOMAIN:
-			_frontend->stats.out_nxdomain++;
+			DB_STATS_ADD(stats->out_nxdomain, 1);
 			break;
 		case LDNS_RCODE_REFUSED:
-			_frontend->stats.out_refused++;
+			DB_STATS_ADD(stats->out_refused, 1);
 			break;
 		default:
-			_frontend->stats.out_other++;
+			DB_STATS_ADD(stats->out_other, 1);
 			break;
 	}
-	if (unlikely(pthread_spin_unlock(&_frontend->stats.out_lock)))
-		panic("pthread_spin_unlock");
 
 	return;
 }
 
-static struct db_frontend_stats db_stats_frontend(struct db_frontend* _frontend)
+void db_stats_batch_rx(struct db_worker* _worker, uint64_t _batches, uint64_t _pkts)
 {
-	if (unlikely(pthread_spin_lock(&_frontend->stats.in_lock)))
-		panic("pthread_spin_lock");
-	if (unlikely(pthread_spin_lock(&_frontend->stats.in_invalid_lock)))
-		panic("pthread_spin_lock");
-	if (unlikely(pthread_spin_lock(&_frontend->stats.out_lock)))
-		panic("pthread_spin_lock");
-
-	struct db_frontend_stats ret = _frontend->stats;
-
-	if (unlikely(pthread_spin_unlock(&_frontend->stats.out_lock)))
-		panic("pthread_spin_unlock");
-	if (unlikely(pthread_spin_unlock(&_frontend->stats.in_invalid_lock)))
-		panic("pthread_spin_unlock");
-	if (unlikely(pthread_spin_unlock(&_frontend->stats.in_lock)))
-		panic("pthread_spin_unlock");
+	DB_STATS_ADD(_worker->stats->batch.rx_batches, _batches);
+	DB_STATS_ADD(_worker->stats->batch.rx_pkts, _pkts);
 
-	return ret;
+	return;
+}
+
+void db_stats_batch_tx(struct db_worker* _worker, uint64_t _batches, uint64_t _pkts)
+{
+	DB_STATS_ADD(_worker->stats->batch.tx_batches, _batches);
+	DB_STATS_ADD(_worker->stats->batch.tx_pkts, _pkts);
+
+	return;
 }
 
-void db_stats_forwarder_in(struct db_forwarder* _forwarder, uint64_t _delta_bytes)
+void db_stats_forwarder_in(struct db_worker* _worker, size_t _forwarder_index, uint64_t _delta_bytes)
 {
-	if (unlikely(pthread_spin_lock(&_forwarder->stats.in_lock)))
-		panic("pthread_spin_lock");
-	_forwarder->stats.in_pkts++;
-	_forwarder->stats.in_bytes += _delta_bytes;
-	if (unlikely(pthread_spin_unlock(&_forwarder->stats.in_lock)))
-		panic("pthread_spin_unlock");
+	DB_STATS_ADD(_worker->stats->forwarders[_forwarder_index].in_pkts, 1);
+	DB_STATS_ADD(_worker->stats->forwarders[_forwarder_index].in_bytes, _delta_bytes);
 
 	return;
 }
 
-void db_stats_forwarder_out(struct db_forwarder* _forwarder, uint64_t _delta_bytes, ldns_pkt_rcode _rcode)
+void db_stats_forwarder_out(struct db_worker* _worker, size_t _forwarder_index, uint64_t _delta_bytes, ldns_pkt_rcode _rcode)
 {
-	if (unlikely(pthread_spin_lock(&_forwarder->stats.out_lock)))
-		panic("pthread_spin_lock");
-	_forwarder->stats.out_pkts++;
-	_forwarder->stats.out_bytes += _delta_bytes;
+	struct db_forwarder_stats* stats = &_worker->stats->forwarders[_forwarder_index];
+
+	DB_STATS_ADD(stats->out_pkts, 1);
+	DB_STATS_ADD(stats->out_bytes, _delta_bytes);
 	switch (_rcode)
 	{
 		case LDNS_RCODE_NOERROR:
-			_forwarder->stats.out_noerror++;
+			DB_STATS_ADD(stats->out_noerror, 1);
 			break;
 		case LDNS_RCODE_SERVFAIL:
-			_forwarder->stats.out_servfail++;
+			DB_STATS_ADD(stats->out_servfail, 1);
 			break;
 		case LDNS_RCODE_NXDOMAIN:
-			_forwarder->stats.out_nxdomain++;
+			DB_STATS_ADD(stats->out_nxdomain, 1);
 			break;
 		case LDNS_RCODE_REFUSED:
-			_forwarder->stats.out_refused++;
+			DB_STATS_ADD(stats->out_refused, 1);
 			break;
 		default:
-			_forwarder->stats.out_other++;
+			DB_STATS_ADD(stats->out_other, 1);
 			break;
 	}
-	if (unlikely(pthread_spin_unlock(&_forwarder->stats.out_lock)))
-		panic("pthread_spin_unlock");
 
 	return;
 }
 
-static struct db_forwarder_stats db_stats_forwarder(struct db_forwarder* _forwarder)
+void db_stats_forwarder_out_invalid(struct db_worker* _worker, size_t _forwarder_index, uint64_t _delta_bytes)
+{
+	DB_STATS_ADD(_worker->stats->forwarders[_forwarder_index].out_pkts_invalid, 1);
+	DB_STATS_ADD(_worker->stats->forwarders[_forwarder_index].out_bytes_invalid, _delta_bytes);
+
+	return;
+}
+
+void db_stats_forwarder_ids_exhausted(struct db_worker* _worker, size_t _forwarder_index)
+{
+	DB_STATS_ADD(_worker->stats->forwarders[_forwarder_index].ids_exhausted, 1);
+
+	return;
+}
+
+void db_stats_forwarder_spill(struct db_worker* _worker, size_t _forwarder_index)
+{
+	DB_STATS_ADD(_worker->stats->forwarders[_forwarder_index].spills, 1);
+
+	return;
+}
+
+void db_stats_forwarder_retry(struct db_worker* _worker, size_t _forwarder_index)
+{
+	DB_STATS_ADD(_worker->stats->forwarders[_forwarder_index].retries, 1);
+
+	return;
+}
+
+void db_stats_forwarder_timeout(struct db_worker* _worker, size_t _forwarder_index)
+{
+	DB_STATS_ADD(_worker->stats->forwarders[_forwarder_index].timeouts, 1);
+
+	return;
+}
+
+void db_stats_acl_hit(struct db_worker* _worker, size_t _acl_index)
+{
+	DB_STATS_ADD(_worker->stats->acl_hits[_acl_index], 1);
+
+	return;
+}
+
+void db_stats_latency_update(struct db_worker* _worker, uint64_t _latency)
+{
+	unsigned bucket = 0;
+
+	bucket = _latency ? DB_LOG2(_latency) : 0;
+	if (bucket >= DB_LATENCY_BUCKETS)
+		bucket = DB_LATENCY_BUCKETS - 1;
+
+	DB_STATS_ADD(_worker->stats->lats[bucket], 1);
+
+	return;
+}
+
+static struct db_frontend_stats db_stats_frontend(struct db_frontend* _frontend)
 {
-	if (unlikely(pthread_spin_lock(&_forwarder->stats.in_lock)))
-		panic("pthread_spin_lock");
-	if (unlikely(pthread_spin_lock(&_forwarder->stats.out_lock)))
-		panic("pthread_spin_lock");
+	struct db_frontend_stats ret;
+
+	pfcq_zero(&ret, sizeof(struct db_frontend_stats));
+	for (int i = 0; i < _frontend->workers_count; i++)
+	{
+		struct db_frontend_stats* stats = &_frontend->workers[i]->stats->frontend;
+		DB_STATS_SUM(ret.in_pkts, stats->in_pkts);
+		DB_STATS_SUM(ret.in_bytes, stats->in_bytes);
+		DB_STATS_SUM(ret.in_pkts_invalid, stats->in_pkts_invalid);
+		DB_STATS_SUM(ret.in_bytes_invalid, stats->in_bytes_invalid);
+		DB_STATS_SUM(ret.out_pkts, stats->out_pkts);
+		DB_STATS_SUM(ret.out_bytes, stats->out_bytes);
+		DB_STATS_SUM(ret.out_noerror, stats->out_noerror);
+		DB_STATS_SUM(ret.out_servfail, stats->out_servfail);
+		DB_STATS_SUM(ret.out_nxdomain, stats->out_nxdomain);
+		DB_STATS_SUM(ret.out_refused, stats->out_refused);
+		DB_STATS_SUM(ret.out_other, stats->out_other);
+		DB_STATS_SUM(ret.overflows, stats->overflows);
+	}
+
+	return ret;
+}
+
+static struct db_batch_stats db_stats_batch(struct db_frontend* _frontend)
+{
+	struct db_batch_stats ret;
+
+	pfcq_zero(&ret, sizeof(struct db_batch_stats));
+	for (int i = 0; i < _frontend->workers_count; i++)
+	{
+		struct db_batch_stats* stats = &_frontend->workers[i]->stats->batch;
+		DB_STATS_SUM(ret.rx_batches, stats->rx_batches);
+		DB_STATS_SUM(ret.rx_pkts, stats->rx_pkts);
+		DB_STATS_SUM(ret.tx_batches, stats->tx_batches);
+		DB_STATS_SUM(ret.tx_pkts, stats->tx_pkts);
+	}
+
+	return ret;
+}
+
+struct db_forwarder_stats db_stats_forwarder(struct db_frontend* _frontend, size_t _forwarder_index)
+{
+	struct db_forwarder_stats ret;
+
+	pfcq_zero(&ret, sizeof(struct db_forwarder_stats));
+	for (int i = 0; i < _frontend->workers_count; i++)
+	{
+		struct db_forwarder_stats* stats = &_frontend->workers[i]->stats->forwarders[_forwarder_index];
+		DB_STATS_SUM(ret.in_pkts, stats->in_pkts);
+		DB_STATS_SUM(ret.in_bytes, stats->in_bytes);
+		DB_STATS_SUM(ret.out_pkts, stats->out_pkts);
+		DB_STATS_SUM(ret.out_bytes, stats->out_bytes);
+		DB_STATS_SUM(ret.out_noerror, stats->out_noerror);
+		DB_STATS_SUM(ret.out_servfail, stats->out_servfail);
+		DB_STATS_SUM(ret.out_nxdomain, stats->out_nxdomain);
+		DB_STATS_SUM(ret.out_refused, stats->out_refused);
+		DB_STATS_SUM(ret.out_other, stats->out_other);
+		DB_STATS_SUM(ret.out_pkts_invalid, stats->out_pkts_invalid);
+		DB_STATS_SUM(ret.out_bytes_invalid, stats->out_bytes_invalid);
+		DB_STATS_SUM(ret.ids_exhausted, stats->ids_exhausted);
+		DB_STATS_SUM(ret.timeouts, stats->timeouts);
+		DB_STATS_SUM(ret.spills, stats->spills);
+		DB_STATS_SUM(ret.retries, stats->retries);
+	}
 
-	struct db_forwarder_stats ret = _forwarder->stats;
+	return ret;
+}
 
-	if (unlikely(pthread_spin_unlock(&_forwarder->stats.out_lock)))
-		panic("pthread_spin_unlock");
-	if (unlikely(pthread_spin_unlock(&_forwarder->stats.in_lock)))
-		panic("pthread_spin_unlock");
+static struct db_pool db_stats_pool(const struct db_pool* _pool)
+{
+	struct db_pool ret;
+
+	// Pool is owned by worker, only its counters are read here
+	pfcq_zero(&ret, sizeof(struct db_pool));
+	ret.object_size = _pool->object_size;
+	ret.slab_objects = _pool->slab_objects;
+	ret.limit = _pool->limit;
+	ret.slabs_count = __atomic_load_n(&_pool->slabs_count, __ATOMIC_RELAXED);
+	ret.used = __atomic_load_n(&_pool->used, __ATOMIC_RELAXED);
+	ret.peak = __atomic_load_n(&_pool->peak, __ATOMIC_RELAXED);
+	ret.exhausted = __atomic_load_n(&_pool->exhausted, __ATOMIC_RELAXED);
 
 	return ret;
 }
@@ -195,30 +352,63 @@ static int db_answer_to_connection(void* _data,
 
 	if (strcmp(_url, "/stats") == 0)
 	{
-		body = pfcq_mstring("%s\n", "# name,FRONTEND,in_pkts,in_bytes,in_invalid_pkts,in_invalid_bytes,out_pkts,out_bytes,noerror,servfail,nxdomain,refused,other");
+		body = pfcq_mstring("%s\n", "# name,FRONTEND,in_pkts,in_bytes,in_invalid_pkts,in_invalid_bytes,out_pkts,out_bytes,noerror,servfail,nxdomain,refused,other,overflows");
 		for (size_t i = 0; i < l_ctx->frontends_count; i++)
 		{
 			struct db_frontend_stats fe_stats = db_stats_frontend(l_ctx->frontends[i]);
-			char* row = pfcq_mstring("%s,FRONTEND,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n",
+			char* row = pfcq_mstring("%s,FRONTEND,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n",
 					l_ctx->frontends[i]->name,
 					fe_stats.in_pkts, fe_stats.in_bytes,
 					fe_stats.in_pkts_invalid, fe_stats.in_bytes_invalid,
 					fe_stats.out_pkts, fe_stats.out_bytes,
-					fe_stats.out_noerror, fe_stats.out_servfail, fe_stats.out_nxdomain, fe_stats.out_refused, fe_stats.out_other);
+					fe_stats.out_noerror, fe_stats.out_servfail, fe_stats.out_nxdomain, fe_stats.out_refused, fe_stats.out_other,
+					fe_stats.overflows);
 			body = pfcq_cstring(body, row);
 			pfcq_free(row);
 		}
-		body = pfcq_cstring(body, "# name,FORWARDER,frontend_name,in_pkts,in_bytes,out_pkts,out_bytes,noerror,servfail,nxdomain,refused,other\n");
+		body = pfcq_cstring(body, "# name,FORWARDER,frontend_name,in_pkts,in_bytes,out_pkts,out_bytes,noerror,servfail,nxdomain,refused,other,out_invalid_pkts,out_invalid_bytes,ids_exhausted,timeouts,spills,retries,ejected,ejections,effective_weight\n");
 		for (size_t i = 0; i < l_ctx->frontends_count; i++)
 			for (size_t j = 0; j < l_ctx->frontends[i]->backend.forwarders_count; j++)
 			{
-				struct db_forwarder_stats frw_stats = db_stats_forwarder(l_ctx->frontends[i]->backend.forwarders[j]);
-				char* row = pfcq_mstring("%s,FORWARDER,%s,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n",
+				struct db_forwarder_stats frw_stats = db_stats_forwarder(l_ctx->frontends[i], j);
+				char* row = pfcq_mstring("%s,FORWARDER,%s,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%hu,%lu,%lu\n",
 						l_ctx->frontends[i]->backend.forwarders[j]->name,
 						l_ctx->frontends[i]->name,
 						frw_stats.in_pkts, frw_stats.in_bytes,
 						frw_stats.out_pkts, frw_stats.out_bytes,
-						frw_stats.out_noerror, frw_stats.out_servfail, frw_stats.out_nxdomain, frw_stats.out_refused, frw_stats.out_other);
+						frw_stats.out_noerror, frw_stats.out_servfail, frw_stats.out_nxdomain, frw_stats.out_refused, frw_stats.out_other,
+						frw_stats.out_pkts_invalid, frw_stats.out_bytes_invalid,
+						frw_stats.ids_exhausted, frw_stats.timeouts, frw_stats.spills, frw_stats.retries,
+						l_ctx->frontends[i]->backend.forwarders[j]->ejected,
+						l_ctx->frontends[i]->backend.forwarders[j]->ejections,
+						__atomic_load_n(&l_ctx->frontends[i]->backend.forwarders[j]->effective_weight, __ATOMIC_RELAXED));
+				body = pfcq_cstring(body, row);
+				pfcq_free(row);
+			}
+		body = pfcq_cstring(body, "# name,BATCH,batch_size,rx_batches,rx_pkts,rx_avg_fill,tx_batches,tx_pkts,tx_avg_fill\n");
+		for (size_t i = 0; i < l_ctx->frontends_count; i++)
+		{
+			struct db_batch_stats batch_stats = db_stats_batch(l_ctx->frontends[i]);
+			char* row = pfcq_mstring("%s,BATCH,%lu,%lu,%lu,%.2f,%lu,%lu,%.2f\n",
+					l_ctx->frontends[i]->name,
+					l_ctx->frontends[i]->batch_size,
+					batch_stats.rx_batches, batch_stats.rx_pkts,
+					batch_stats.rx_batches ? (double)batch_stats.rx_pkts / batch_stats.rx_batches : 0.0,
+					batch_stats.tx_batches, batch_stats.tx_pkts,
+					batch_stats.tx_batches ? (double)batch_stats.tx_pkts / batch_stats.tx_batches : 0.0);
+			body = pfcq_cstring(body, row);
+			pfcq_free(row);
+		}
+		body = pfcq_cstring(body, "# name,POOL,worker,object_size,slabs,bytes,used,peak,limit,exhausted\n");
+		for (size_t i = 0; i < l_ctx->frontends_count; i++)
+			for (int j = 0; j < l_ctx->frontends[i]->workers_count; j++)
+			{
+				struct db_pool pool_stats = db_stats_pool(&l_ctx->frontends[i]->workers[j]->request_pool);
+				char* row = pfcq_mstring("%s,POOL,%d,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n",
+						l_ctx->frontends[i]->name, j,
+						pool_stats.object_size, pool_stats.slabs_count,
+						pool_stats.slabs_count * pool_stats.slab_objects * pool_stats.object_size,
+						pool_stats.used, pool_stats.peak, pool_stats.limit, pool_stats.exhausted);
 				body = pfcq_cstring(body, row);
 				pfcq_free(row);
 			}
@@ -241,11 +431,9 @@ static int db_answer_to_connection(void* _data,
 
 			TAILQ_FOREACH(current_acl_item, &l_ctx->frontends[i]->acl, tailq)
 			{
-				if (unlikely(pthread_spin_lock(&current_acl_item->hits_lock)))
-					panic("pthread_spin_lock");
-				uint64_t hits = current_acl_item->hits;
-				if (unlikely(pthread_spin_unlock(&current_acl_item->hits_lock)))
-					panic("pthread_spin_unlock");
+				uint64_t hits = 0;
+				for (int j = 0; j < l_ctx->frontends[i]->workers_count; j++)
+					DB_STATS_SUM(hits, l_ctx->frontends[i]->workers[j]->stats->acl_hits[current_acl_item->index]);
 				row = pfcq_mstring("%s,%s/%s,%s,%s,%lu\n", current_acl_item->s_layer3,
 						current_acl_item->s_address, current_acl_item->s_netmask,
 						current_acl_item->s_list, current_acl_item->s_action,
@@ -259,34 +447,30 @@ static int db_answer_to_connection(void* _data,
 	}  else if (strcmp(_url, "/lats") == 0)
 	{
 		body = pfcq_mstring("%s\n", "# us, hits");
+		uint64_t lats[DB_LATENCY_BUCKETS];
+		pfcq_zero(lats, DB_LATENCY_BUCKETS * sizeof(uint64_t));
+		for (size_t i = 0; i < l_ctx->frontends_count; i++)
+			for (int j = 0; j < l_ctx->frontends[i]->workers_count; j++)
+				for (size_t k = 0; k < DB_LATENCY_BUCKETS; k++)
+					DB_STATS_SUM(lats[k], l_ctx->frontends[i]->workers[j]->stats->lats[k]);
 		for (size_t i = 0; i < DB_LATENCY_BUCKETS - 1; i++)
 		{
-			char* row = NULL;
-			if (unlikely(pthread_spin_lock(&l_ctx->db_lats.lats_lock[i])))
-				panic("pthread_spin_lock");
-			row = pfcq_mstring("LAT,%lu,%lu\n", 1UL << i, l_ctx->db_lats.lats[i]);
-			if (unlikely(pthread_spin_unlock(&l_ctx->db_lats.lats_lock[i])))
-				panic("pthread_spin_unlock");
+			char* row = pfcq_mstring("LAT,%lu,%lu\n", 1UL << i, lats[i]);
 			body = pfcq_cstring(body, row);
 			pfcq_free(row);
 		}
-		if (unlikely(pthread_spin_lock(&l_ctx->db_lats.lats_lock[DB_LATENCY_BUCKETS - 1])))
-			panic("pthread_spin_lock");
-		char* max_row = pfcq_mstring("LAT,MAX,%lu\n", l_ctx->db_lats.lats[DB_LATENCY_BUCKETS - 1]);
-		if (unlikely(pthread_spin_unlock(&l_ctx->db_lats.lats_lock[DB_LATENCY_BUCKETS - 1])))
-			panic("pthread_spin_unlock");
+		char* max_row = pfcq_mstring("LAT,MAX,%lu\n", lats[DB_LATENCY_BUCKETS - 1]);
 		body = pfcq_cstring(body, max_row);
 		pfcq_free(max_row);
 
 		goto noerror;
 	} else if (strcmp(_url, "/queue") == 0)
 	{
+		// Every worker owns its request table, so sum them up
 		size_t requests_count = 0;
-		if (unlikely(pthread_spin_lock(&l_ctx->global_context->db_requests.requests_count_lock)))
-			panic("pthread_spin_lock");
-		requests_count = l_ctx->global_context->db_requests.requests_count;
-		if (unlikely(pthread_spin_unlock(&l_ctx->global_context->db_requests.requests_count_lock)))
-			panic("pthread_spin_unlock");
+		for (size_t i = 0; i < l_ctx->frontends_count; i++)
+			for (int j = 0; j < l_ctx->frontends[i]->workers_count; j++)
+				requests_count += __atomic_load_n(&l_ctx->frontends[i]->workers[j]->requests.count, __ATOMIC_RELAXED);
 		body = pfcq_mstring("%lu", requests_count);
 
 		goto noerror;
@@ -318,34 +502,8 @@ error:
 	return ret;
 }
 
-void db_stats_latency_update(struct db_local_context* _ctx, struct timespec _ctime)
-{
-	struct timespec time_now;
-	unsigned bucket = 0;
-
-	if (unlikely(clock_gettime(CLOCK_REALTIME, &time_now)))
-		panic("clock_gettime");
-
-	bucket = DB_LOG2(__pfcq_timespec_diff_ns(_ctime, time_now) / 1000);
-	if (bucket >= DB_LATENCY_BUCKETS)
-		bucket = DB_LATENCY_BUCKETS - 1;
-
-	if (unlikely(pthread_spin_lock(&_ctx->db_lats.lats_lock[bucket])))
-		panic("pthread_spin_lock");
-	_ctx->db_lats.lats[bucket]++;
-	if (unlikely(pthread_spin_unlock(&_ctx->db_lats.lats_lock[bucket])))
-		panic("pthread_spin_unlock");
-
-	return;
-}
-
 void db_stats_init(struct db_local_context* _ctx)
 {
-	pfcq_zero(&_ctx->db_lats, sizeof(struct db_latency_stats));
-	for (size_t i = 0; i < DB_LATENCY_BUCKETS; i++)
-		if (unlikely(pthread_spin_init(&_ctx->db_lats.lats_lock[i], PTHREAD_PROCESS_PRIVATE)))
-			panic("pthread_spin_init");
-
 	if (_ctx->stats_enabled)
 	{
 		unsigned int options = MHD_USE_SELECT_INTERNALLY | MHD_USE_EPOLL_LINUX_ONLY;
@@ -384,9 +542,6 @@ void db_stats_done(struct db_local_context* _ctx)
 {
 	if (_ctx->mhd_daemon)
 		MHD_stop_daemon(_ctx->mhd_daemon);
-	for (size_t i = 0; i < DB_LATENCY_BUCKETS; i++)
-		if (unlikely(pthread_spin_destroy(&_ctx->db_lats.lats_lock[i])))
-			panic("pthread_spin_destroy");
 
 	return;
 }
@@ -25,12 +25,24 @@
 
 #include "types.h"
 
-void db_stats_frontend_in(struct db_frontend* _frontend, uint64_t _delta_bytes) __attribute__((nonnull(1)));
-void db_stats_frontend_in_invalid(struct db_frontend* _frontend, uint64_t _delta_bytes) __attribute__((nonnull(1)));
-void db_stats_frontend_out(struct db_frontend* _frontend, uint64_t _delta_bytes, ldns_pkt_rcode _rcode) __attribute__((nonnull(1)));
-void db_stats_forwarder_in(struct db_forwarder* _forwarder, uint64_t _delta_bytes) __attribute__((nonnull(1)));
-void db_stats_forwarder_out(struct db_forwarder* _forwarder, uint64_t _delta_bytes, ldns_pkt_rcode _rcode) __attribute__((nonnull(1)));
-void db_stats_latency_update(struct db_local_context* _ctx, struct timespec _ctime);
+void db_stats_worker_init(struct db_worker* _worker) __attribute__((nonnull(1)));
+void db_stats_worker_done(struct db_worker* _worker) __attribute__((nonnull(1)));
+void db_stats_frontend_in(struct db_worker* _worker, uint64_t _delta_bytes) __attribute__((nonnull(1)));
+void db_stats_frontend_in_invalid(struct db_worker* _worker, uint64_t _delta_bytes) __attribute__((nonnull(1)));
+void db_stats_frontend_overflow(struct db_worker* _worker) __attribute__((nonnull(1)));
+void db_stats_frontend_out(struct db_worker* _worker, uint64_t _delta_bytes, ldns_pkt_rcode _rcode) __attribute__((nonnull(1)));
+void db_stats_batch_rx(struct db_worker* _worker, uint64_t _batches, uint64_t _pkts) __attribute__((nonnull(1)));
+void db_stats_batch_tx(struct db_worker* _worker, uint64_t _batches, uint64_t _pkts) __attribute__((nonnull(1)));
+void db_stats_forwarder_in(struct db_worker* _worker, size_t _forwarder_index, uint64_t _delta_bytes) __attribute__((nonnull(1)));
+void db_stats_forwarder_out(struct db_worker* _worker, size_t _forwarder_index, uint64_t _delta_bytes, ldns_pkt_rcode _rcode) __attribute__((nonnull(1)));
+void db_stats_forwarder_out_invalid(struct db_worker* _worker, size_t _forwarder_index, uint64_t _delta_bytes) __attribute__((nonnull(1)));
+void db_stats_forwarder_ids_exhausted(struct db_worker* _worker, size_t _forwarder_index) __attribute__((nonnull(1)));
+void db_stats_forwarder_spill(struct db_worker* _worker, size_t _forwarder_index) __attribute__((nonnull(1)));
+void db_stats_forwarder_retry(struct db_worker* _worker, size_t _forwarder_index) __attribute__((nonnull(1)));
+void db_stats_forwarder_timeout(struct db_worker* _worker, size_t _forwarder_index) __attribute__((nonnull(1)));
+struct db_forwarder_stats db_stats_forwarder(struct db_frontend* _frontend, size_t _forwarder_index) __attribute__((nonnull(1)));
+void db_stats_acl_hit(struct db_worker* _worker, size_t _acl_index) __attribute__((nonnull(1)));
+void db_stats_latency_update(struct db_worker* _worker, uint64_t _latency) __attribute__((nonnull(1)));
 void db_stats_init(struct db_local_context* _ctx) __attribute__((nonnull(1)));
 void db_stats_done(struct db_local_context* _ctx) __attribute__((nonnull(1)));
 
@@ -0,0 +1,157 @@
+/* vim: set tabstop=4:softtabstop=4:shiftwidth=4:noexpandtab */
+
+/*
+ * dnsbalancer - daemon to balance UDP DNS requests over DNS servers
+ * Copyright (C) 2015-2016 Lanet Network
+ * Programmed by Oleksandr Natalenko <o.natalenko@lanet.ua>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "types.h"
+
+#include "timer.h"
+
+#define DB_TIMER_MASK	((uint64_t)DB_TIMER_SLOTS - 1)
+#define DB_TIMER_RANGE	(1ULL << (DB_TIMER_BITS * DB_TIMER_LEVELS))
+
+static void db_timer_link(struct db_timer_wheel* _wheel, struct db_timer* _timer)
+{
+	// Wheel range is far below 2^32 ticks, so wrapping difference is enough
+	uint32_t delta = _timer->expires - (uint32_t)_wheel->tick;
+	size_t level = 0;
+
+	while (level < DB_TIMER_LEVELS - 1 && delta >= (1ULL << (DB_TIMER_BITS * (level + 1))))
+		level++;
+
+	struct db_timer** head = &_wheel->slots[level][(_timer->expires >> (DB_TIMER_BITS * level)) & DB_TIMER_MASK];
+	_timer->next = *head;
+	if (_timer->next)
+		_timer->next->pprev = &_timer->next;
+	_timer->pprev = head;
+	*head = _timer;
+
+	return;
+}
+
+static void db_timer_cascade(struct db_timer_wheel* _wheel, size_t _level)
+{
+	struct db_timer** head = &_wheel->slots[_level][(_wheel->tick >> (DB_TIMER_BITS * _level)) & DB_TIMER_MASK];
+	struct db_timer* current_timer = *head;
+
+	// Redistribute timers of upper level slot over lower levels
+	*head = NULL;
+	while (current_timer)
+	{
+		struct db_timer* next_timer = current_timer->next;
+		db_timer_link(_wheel, current_timer);
+		current_timer = next_timer;
+	}
+
+	return;
+}
+
+void db_timer_wheel_init(struct db_timer_wheel* _wheel, uint64_t _resolution)
+{
+	pfcq_zero(_wheel, sizeof(struct db_timer_wheel));
+	_wheel->resolution = _resolution;
+	if (unlikely(clock_gettime(CLOCK_MONOTONIC, &_wheel->start) == -1))
+		panic("clock_gettime");
+
+	return;
+}
+
+uint64_t db_timer_ticks(const struct db_timer_wheel* _wheel, uint64_t _ns)
+{
+	return (_ns + _wheel->resolution - 1) / _wheel->resolution;
+}
+
+uint64_t db_timer_now(const struct db_timer_wheel* _wheel)
+{
+	struct timespec current_time;
+
+	if (unlikely(clock_gettime(CLOCK_MONOTONIC, &current_time) == -1))
+		panic("clock_gettime");
+
+	return (uint64_t)__pfcq_timespec_diff_ns(_wheel->start, current_time) / _wheel->resolution;
+}
+
+void db_timer_add(struct db_timer_wheel* _wheel, struct db_timer* _timer, uint64_t _ticks)
+{
+	// Timers beyond the wheel range are fired at its edge
+	if (unlikely(_ticks >= DB_TIMER_RANGE))
+		_ticks = DB_TIMER_RANGE - 1;
+	_timer->expires = (uint32_t)(_wheel->tick + (_ticks ? _ticks : 1));
+	db_timer_link(_wheel, _timer);
+
+	return;
+}
+
+void db_timer_del(struct db_timer* _timer)
+{
+	if (!_timer->pprev)
+		return;
+
+	*_timer->pprev = _timer->next;
+	if (_timer->next)
+		_timer->next->pprev = _timer->pprev;
+	_timer->next = NULL;
+	_timer->pprev = NULL;
+
+	return;
+}
+
+static int db_timer_empty(const struct db_timer_wheel* _wheel)
+{
+	for (size_t level = 0; level < DB_TIMER_LEVELS; level++)
+		for (size_t slot = 0; slot < DB_TIMER_SLOTS; slot++)
+			if (_wheel->slots[level][slot])
+				return 0;
+
+	return 1;
+}
+
+struct db_timer* db_timer_advance(struct db_timer_wheel* _wheel, uint64_t _tick)
+{
+	struct db_timer* ret = NULL;
+
+	// Wheel left idle for a while has nothing to cascade, so it jumps right to current tick
+	if (_tick > _wheel->tick + DB_TIMER_SLOTS && db_timer_empty(_wheel))
+		_wheel->tick = _tick;
+
+	while (_wheel->tick < _tick)
+	{
+		_wheel->tick++;
+
+		// Lower level has wrapped, so pull next slot of upper level down
+		for (size_t level = 1; level < DB_TIMER_LEVELS; level++)
+		{
+			if (_wheel->tick & ((1ULL << (DB_TIMER_BITS * level)) - 1))
+				break;
+			db_timer_cascade(_wheel, level);
+		}
+
+		// Detach expired timers and chain them for the caller
+		struct db_timer** head = &_wheel->slots[0][_wheel->tick & DB_TIMER_MASK];
+		while (*head)
+		{
+			struct db_timer* current_timer = *head;
+			db_timer_del(current_timer);
+			current_timer->next = ret;
+			ret = current_timer;
+		}
+	}
+
+	return ret;
+}
+
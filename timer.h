@@ -0,0 +1,36 @@
+/* vim: set tabstop=4:softtabstop=4:shiftwidth=4:noexpandtab */
+
+/*
+ * dnsbalancer - daemon to balance UDP DNS requests over DNS servers
+ * Copyright (C) 2015-2016 Lanet Network
+ * Programmed by Oleksandr Natalenko <o.natalenko@lanet.ua>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifndef __TIMER_H__
+#define __TIMER_H__
+
+#include "types.h"
+
+void db_timer_wheel_init(struct db_timer_wheel* _wheel, uint64_t _resolution) __attribute__((nonnull(1)));
+uint64_t db_timer_ticks(const struct db_timer_wheel* _wheel, uint64_t _ns) __attribute__((nonnull(1)));
+uint64_t db_timer_now(const struct db_timer_wheel* _wheel) __attribute__((nonnull(1)));
+void db_timer_add(struct db_timer_wheel* _wheel, struct db_timer* _timer, uint64_t _ticks) __attribute__((nonnull(1, 2)));
+void db_timer_del(struct db_timer* _timer) __attribute__((nonnull(1)));
+struct db_timer* db_timer_advance(struct db_timer_wheel* _wheel, uint64_t _tick) __attribute__((nonnull(1)));
+
+#endif /* __TIMER_H__ */
+
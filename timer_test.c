@@ -0,0 +1,207 @@
+/* vim: set tabstop=4:softtabstop=4:shiftwidth=4:noexpandtab */
+
+/*
+ * dnsbalancer - daemon to balance UDP DNS requests over DNS servers
+ * Copyright (C) 2015-2016 Lanet Network
+ * Programmed by Oleksandr Natalenko <o.natalenko@lanet.ua>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "timer.h"
+
+#define DB_TEST_TIMERS		4096
+#define DB_TEST_RANGE		(1ULL << (DB_TIMER_BITS * DB_TIMER_LEVELS))
+
+struct db_test_timer
+{
+	struct db_timer timer;
+	uint64_t due;
+	uint64_t fired;
+};
+
+static uint64_t db_test_random(uint64_t* _state)
+{
+	*_state ^= *_state << 13;
+	*_state ^= *_state >> 7;
+	*_state ^= *_state << 17;
+
+	return *_state;
+}
+
+static size_t db_test_collect(struct db_timer* _expired, uint64_t _tick)
+{
+	size_t ret = 0;
+
+	while (_expired)
+	{
+		struct db_test_timer* current_timer = (struct db_test_timer*)_expired;
+		_expired = _expired->next;
+		assert(!current_timer->timer.pprev);
+		assert(!current_timer->fired);
+		current_timer->fired = _tick;
+		ret++;
+	}
+
+	return ret;
+}
+
+// Timers spread over all levels fire exactly on their tick when the wheel is stepped one tick at a time
+static void db_test_timer_cascade(uint64_t _start)
+{
+	static struct db_test_timer timers[DB_TEST_TIMERS];
+	struct db_timer_wheel wheel;
+	uint64_t state = 0x9e3779b97f4a7c15ULL;
+	uint64_t last = 0;
+	size_t fired = 0;
+
+	db_timer_wheel_init(&wheel, 1);
+	// Empty wheel jumps there at once
+	assert(!db_timer_advance(&wheel, _start));
+	assert(wheel.tick == _start);
+
+	pfcq_zero(timers, sizeof(timers));
+	for (size_t i = 0; i < DB_TEST_TIMERS; i++)
+	{
+		// Every level gets its share, edges of levels included
+		uint64_t level = i % DB_TIMER_LEVELS;
+		uint64_t ticks = db_test_random(&state) % (1ULL << (DB_TIMER_BITS * (level + 1)));
+		if (i % 7 == 0)
+			ticks = (1ULL << (DB_TIMER_BITS * (level + 1))) - 1;
+		else if (i % 11 == 0)
+			ticks = 1ULL << (DB_TIMER_BITS * level);
+		db_timer_add(&wheel, &timers[i].timer, ticks);
+		timers[i].due = _start + (ticks ? ticks : 1);
+		if (timers[i].due > last)
+			last = timers[i].due;
+	}
+
+	// Some timers are cancelled before they fire
+	for (size_t i = 0; i < DB_TEST_TIMERS; i += 13)
+	{
+		db_timer_del(&timers[i].timer);
+		db_timer_del(&timers[i].timer);
+		timers[i].due = 0;
+	}
+
+	for (uint64_t tick = _start + 1; tick <= last; tick++)
+		fired += db_test_collect(db_timer_advance(&wheel, tick), tick);
+
+	for (size_t i = 0; i < DB_TEST_TIMERS; i++)
+	{
+		assert(timers[i].fired == timers[i].due);
+		if (timers[i].due)
+			fired--;
+	}
+	assert(!fired);
+
+	return;
+}
+
+// Wheel that was not advanced for a while expires everything that is due in one call
+static void db_test_timer_catch_up(void)
+{
+	struct db_test_timer timers[3];
+	struct db_timer_wheel wheel;
+
+	db_timer_wheel_init(&wheel, 1);
+	pfcq_zero(timers, sizeof(timers));
+
+	db_timer_add(&wheel, &timers[0].timer, 10);
+	db_timer_add(&wheel, &timers[1].timer, 5000);
+	db_timer_add(&wheel, &timers[2].timer, 300000);
+
+	assert(db_test_collect(db_timer_advance(&wheel, 6000), 6000) == 2);
+	assert(timers[0].fired && timers[1].fired && !timers[2].fired);
+	assert(wheel.tick == 6000);
+
+	assert(db_test_collect(db_timer_advance(&wheel, 299999), 299999) == 0);
+	assert(db_test_collect(db_timer_advance(&wheel, 300000), 300000) == 1);
+	assert(timers[2].fired == 300000);
+
+	return;
+}
+
+// Idle wheel is re-based, so timers added afterwards are relative to current tick, not the stale one
+static void db_test_timer_idle(void)
+{
+	struct db_test_timer timers[2];
+	struct db_timer_wheel wheel;
+
+	db_timer_wheel_init(&wheel, 1);
+	pfcq_zero(timers, sizeof(timers));
+
+	db_timer_add(&wheel, &timers[0].timer, 1);
+	assert(db_test_collect(db_timer_advance(&wheel, 1), 1) == 1);
+
+	// Way beyond the wheel range
+	assert(!db_timer_advance(&wheel, 10 * DB_TEST_RANGE));
+	assert(wheel.tick == 10 * DB_TEST_RANGE);
+
+	db_timer_add(&wheel, &timers[1].timer, 100);
+	assert(!db_timer_advance(&wheel, 10 * DB_TEST_RANGE + 99));
+	assert(db_test_collect(db_timer_advance(&wheel, 10 * DB_TEST_RANGE + 100), 10 * DB_TEST_RANGE + 100) == 1);
+
+	// Short idle is walked through rather than re-based
+	assert(!db_timer_advance(&wheel, wheel.tick + DB_TIMER_SLOTS));
+	assert(wheel.tick == 10 * DB_TEST_RANGE + 100 + DB_TIMER_SLOTS);
+
+	return;
+}
+
+// Timers past the wheel range are clamped to its edge
+static void db_test_timer_clamp(void)
+{
+	struct db_test_timer timer;
+	struct db_timer_wheel wheel;
+
+	db_timer_wheel_init(&wheel, 1);
+	pfcq_zero(&timer, sizeof(timer));
+
+	db_timer_add(&wheel, &timer.timer, 10 * DB_TEST_RANGE);
+	assert(!db_timer_advance(&wheel, DB_TEST_RANGE - 2));
+	assert(db_test_collect(db_timer_advance(&wheel, DB_TEST_RANGE - 1), 1) == 1);
+
+	return;
+}
+
+static void db_test_timer_ticks(void)
+{
+	struct db_timer_wheel wheel;
+
+	db_timer_wheel_init(&wheel, 10000000);
+	assert(db_timer_ticks(&wheel, 0) == 0);
+	assert(db_timer_ticks(&wheel, 1) == 1);
+	assert(db_timer_ticks(&wheel, 10000000) == 1);
+	assert(db_timer_ticks(&wheel, 10000001) == 2);
+
+	return;
+}
+
+int main(void)
+{
+	db_test_timer_cascade(0);
+	// 32-bit expiry wraps while the wheel is running
+	db_test_timer_cascade((1ULL << 32) - DB_TEST_RANGE / 2);
+	db_test_timer_catch_up();
+	db_test_timer_idle();
+	db_test_timer_clamp();
+	db_test_timer_ticks();
+
+	printf("%s\n", "timer: OK");
+
+	return 0;
+}
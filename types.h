@@ -30,6 +30,7 @@
 #include <stdint.h>
 #include <sys/queue.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #include "defines.h"
 
@@ -44,7 +45,38 @@ enum db_backend_mode
 	DB_BE_MODE_LEAST_TRAFFIC,
 	DB_BE_MODE_HASH_L3_L4,
 	DB_BE_MODE_HASH_L3,
-	DB_BE_MODE_HASH_L4
+	DB_BE_MODE_HASH_L4,
+	DB_BE_MODE_LEAST_OUTSTANDING,
+	DB_BE_MODE_PEAK_EWMA,
+	DB_BE_MODE_HASH_QNAME,
+	DB_BE_MODE_HASH_QNAME_QTYPE,
+	DB_BE_MODE_WRR
+};
+
+enum db_overflow_action
+{
+	DB_OVERFLOW_SERVFAIL,
+	DB_OVERFLOW_REFUSED,
+	DB_OVERFLOW_DROP
+};
+
+enum db_slow_start_mode
+{
+	DB_SLOW_START_LINEAR,
+	DB_SLOW_START_EXPONENTIAL
+};
+
+enum db_io_engine
+{
+	DB_IO_ENGINE_EPOLL,
+	DB_IO_ENGINE_URING,
+	DB_IO_ENGINE_XDP
+};
+
+enum db_xdp_mode
+{
+	DB_XDP_MODE_NATIVE,
+	DB_XDP_MODE_SKB
 };
 
 enum db_acl_source
@@ -85,8 +117,12 @@ struct db_forwarder_stats
 	uint64_t out_nxdomain;
 	uint64_t out_refused;
 	uint64_t out_other;
-	pthread_spinlock_t in_lock;
-	pthread_spinlock_t out_lock;
+	uint64_t out_pkts_invalid;
+	uint64_t out_bytes_invalid;
+	uint64_t ids_exhausted;
+	uint64_t timeouts;
+	uint64_t spills;
+	uint64_t retries;
 };
 
 struct db_forwarder
@@ -94,23 +130,68 @@ struct db_forwarder
 	char* name;
 	sa_family_t layer3;
 	unsigned short int alive;
+	unsigned short int active;
+	uint64_t priority;
 	unsigned short int fails;
 	pfcq_net_address_t address;
 	size_t check_attempts;
 	uint64_t check_timeout;
 	char* check_query;
-	struct db_forwarder_stats stats;
 	uint64_t weight;
+	uint64_t effective_weight;
+	uint64_t max_outstanding;
+	uint64_t slow_start;
+	enum db_slow_start_mode slow_start_mode;
+	uint64_t revivals;
+	uint64_t hash;
+	unsigned short int ejected;
+	uint64_t ejections;
+};
+
+struct db_alias
+{
+	uint32_t threshold;
+	uint16_t forwarder;
+	uint16_t alias;
+};
+
+struct db_backend_table
+{
+	uint16_t* maglev;
+	struct db_alias* alias;
+	uint16_t* schedule;
+	size_t schedule_length;
+	uint16_t* members;
+	size_t alive_count;
+};
+
+struct db_outlier_detection
+{
+	unsigned short int enabled;
+	uint64_t consecutive_failures;
+	uint64_t timeout_ratio;
+	uint64_t servfail_ratio;
+	uint64_t min_requests;
+	uint64_t ejection_time;
+	uint64_t max_ejection_time;
 };
 
 struct db_backend
 {
 	enum db_backend_mode mode;
+	struct db_backend_table tables[2];
+	unsigned int active_table;
+	size_t schedule_size;
+	size_t tier_min_alive;
+	uint64_t tier_min_weight;
+	enum db_overflow_action overflow_action;
+	uint64_t retry_timeout;
+	size_t max_retries;
+	struct db_outlier_detection outlier;
 	pthread_spinlock_t queries_lock;
 	struct db_forwarder** forwarders;
 	size_t forwarders_count;
 	uint64_t queries;
-	uint64_t total_weight;
 };
 
 struct db_frontend_stats
@@ -126,15 +207,56 @@ struct db_frontend_stats
 	uint64_t out_refused;
 	uint64_t out_other;
 	uint64_t in_bytes_invalid;
-	pthread_spinlock_t in_lock;
-	pthread_spinlock_t out_lock;
-	pthread_spinlock_t in_invalid_lock;
+	uint64_t overflows;
+};
+
+struct db_batch_stats
+{
+	uint64_t rx_batches;
+	uint64_t rx_pkts;
+	uint64_t tx_batches;
+	uint64_t tx_pkts;
+};
+
+struct db_worker_stats
+{
+	struct db_frontend_stats frontend;
+	struct db_batch_stats batch;
+	uint64_t lats[DB_LATENCY_BUCKETS];
+	struct db_forwarder_stats* forwarders;
+	uint64_t* acl_hits;
+};
+
+struct db_batch
+{
+	struct mmsghdr* headers;
+	struct iovec* iovecs;
+	pfcq_net_address_t* addresses;
+	unsigned short int* accounted;
+	uint8_t* buffer;
+	size_t size;
+	size_t count;
+	size_t packet_size;
+};
+
+struct db_pool
+{
+	void** slabs;
+	size_t slabs_count;
+	void* free_list;
+	size_t object_size;
+	size_t slab_objects;
+	size_t limit;
+	size_t used;
+	size_t peak;
+	uint64_t exhausted;
 };
 
 struct db_set_a
 {
 	unsigned long address4;
 	uint32_t ttl;
+	uint8_t answer[DB_SET_A_ANSWER_LENGTH];
 };
 
 union db_acl_action_parameters
@@ -148,8 +270,9 @@ struct db_list_item
 	char* s_name;
 	enum db_acl_rr_type rr_type;
 	char* s_fqdn;
-	size_t s_fqdn_length;
-	uint64_t s_fqdn_hash;
+	uint8_t s_qname[DB_QNAME_MAX_LENGTH];
+	size_t s_qname_length;
+	uint64_t s_qname_hash;
 	unsigned short int regex_compiled;
 	regex_t regex;
 };
@@ -173,48 +296,113 @@ struct db_acl_item
 	struct db_list list;
 	enum db_acl_action action;
 	union db_acl_action_parameters action_parameters;
-	pthread_spinlock_t hits_lock;
-	uint64_t hits;
+	size_t index;
 };
 
 TAILQ_HEAD(db_acl, db_acl_item);
 
-struct db_request_data
+struct db_query
 {
-	ldns_rr_type rr_type;
-	ldns_rr_class rr_class;
-	char fqdn[HOST_NAME_MAX];
-	int forwarder_socket;
-	uint64_t hash;
+	uint16_t id;
+	uint16_t qtype;
+	uint16_t qclass;
+	unsigned short int response;
+	unsigned short int edns;
+	size_t qname_length;
+	size_t question_end;
+	uint8_t qname[DB_QNAME_MAX_LENGTH];
+};
+
+struct db_timer
+{
+	struct db_timer* next;
+	struct db_timer** pprev;
+	uint32_t expires;
+};
+
+struct db_timer_wheel
+{
+	struct db_timer* slots[DB_TIMER_LEVELS][DB_TIMER_SLOTS];
+	uint64_t tick;
+	uint64_t resolution;
+	struct timespec start;
+};
+
+struct db_outlier
+{
+	uint64_t last_answers;
+	uint64_t last_servfails;
+	uint64_t last_timeouts;
+	uint64_t answers[DB_OUTLIER_WINDOW];
+	uint64_t servfails[DB_OUTLIER_WINDOW];
+	uint64_t timeouts[DB_OUTLIER_WINDOW];
+	size_t bucket;
+	uint64_t consecutive_failures;
+	unsigned int ejection_level;
+	uint64_t ejected_until;
+	uint64_t calm_rounds;
+};
+
+struct db_probe
+{
+	struct db_timer timer;
+	struct db_forwarder* forwarder;
+	size_t frontend_index;
+	size_t forwarder_index;
+	int socket;
+	uint16_t id;
+	unsigned short int pending;
+	uint64_t fingerprint;
+	uint8_t* packet;
+	size_t packet_length;
+	struct db_outlier outlier;
+	unsigned short int checked;
+	unsigned short int ramping;
+	uint64_t ramp_start;
 };
 
 struct db_request
 {
-	TAILQ_ENTRY(db_request) tailq;
+	struct db_timer timer;
+	uint32_t ctime;
+	uint32_t client_scope_id;
+	uint64_t fingerprint;
+	uint8_t client_address[16];
+	uint16_t client_port;
+	uint16_t id;
 	uint16_t original_id;
-	struct db_request_data data;
-	pfcq_net_address_t client_address;
-	struct timespec ctime;
-	size_t forwarder_index;
+	uint16_t forwarder_index;
 };
 
-TAILQ_HEAD(db_requests, db_request);
+struct db_request_timeout
+{
+	struct db_request* next_attempt;
+	uint32_t deadline;
+	uint32_t reclaim;
+	uint16_t question_length;
+	uint16_t query_length;
+	uint16_t retries;
+	unsigned short int expired;
+	unsigned short int answered;
+	unsigned short int superseded;
+	uint8_t query[];
+};
 
-struct db_request_bucket
+struct db_request_ids
 {
-	struct db_requests requests;
-	size_t requests_count;
-	pthread_mutex_t requests_lock;
+	struct db_request** slots;
+	size_t mask;
+	size_t used;
+	size_t outstanding;
 };
 
-struct db_request_list
+struct db_request_table
 {
-	struct db_request_bucket list[UINT16_MAX + 1];
-	uint16_t list_index;
-	pthread_spinlock_t list_index_lock;
-	uint64_t ttl;
-	size_t requests_count;
-	pthread_spinlock_t requests_count_lock;
+	struct db_request_ids* forwarders;
+	size_t forwarders_count;
+	struct db_pool* pool;
+	pfcq_fprng_context_t* fprng_context;
+	size_t count;
 };
 
 struct db_frontend
@@ -230,26 +418,27 @@ struct db_frontend
 	struct db_global_context* g_ctx;
 	struct db_local_context* l_ctx;
 	struct db_backend backend;
-	struct db_frontend_stats stats;
+	enum db_io_engine io_engine;
+	size_t batch_size;
+	size_t request_pool_limit;
+	char* xdp_interface;
+	char* xdp_program;
+	size_t xdp_queue;
+	enum db_xdp_mode xdp_mode;
+	unsigned short int xdp_zerocopy;
+	struct db_frontend_xdp* xdp;
 	struct db_acl acl;
 };
 
 struct db_global_context
 {
-	struct db_request_list db_requests;
-	pfpthq_pool_t* gc_pool;
-	pthread_t gc_id;
-	uint64_t db_gc_interval;
-	int gc_eventfd;
+	uint64_t request_ttl;
+	uint64_t upstream_timeout;
+	unsigned short int servfail_on_timeout;
+	uint64_t timer_resolution;
 	uint64_t reload_retry;
 };
 
-struct db_latency_stats
-{
-	uint64_t lats[DB_LATENCY_BUCKETS];
-	pthread_spinlock_t lats_lock[DB_LATENCY_BUCKETS];
-};
-
 struct db_local_context
 {
 	struct db_global_context* global_context;
@@ -263,14 +452,43 @@ struct db_local_context
 	sa_family_t stats_layer3_family;
 	pfcq_net_address_t stats_address;
 	struct MHD_Daemon* mhd_daemon;
-	struct db_latency_stats db_lats;
+};
+
+struct db_worker_forwarder
+{
+	int socket;
+	struct db_batch tx;
+	uint64_t rtt;
+	uint64_t rtt_time;
+	uint64_t revivals;
+	uint64_t in_pkts_offset;
+	uint64_t in_bytes_offset;
+	size_t max_outstanding;
 };
 
 struct db_worker
 {
 	struct db_frontend* frontend;
 	pthread_t id;
+	size_t index;
 	int eventfd;
+	int server;
+	struct db_worker_forwarder* forwarders;
+	pfcq_fprng_context_t fprng_context;
+	struct db_batch server_rx;
+	struct db_batch server_tx;
+	struct db_batch forwarder_rx;
+	struct db_pool request_pool;
+	struct db_request_table requests;
+	struct db_timer_wheel timers;
+	uint64_t request_ttl;
+	uint64_t upstream_timeout;
+	uint64_t retry_timeout;
+	size_t request_copy_length;
+	size_t schedule_cursor;
+	struct db_worker_uring* uring;
+	struct db_worker_xdp* xdp;
+	struct db_worker_stats* stats;
 };
 
 #endif /* __TYPES_H__ */
@@ -18,8 +18,13 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <math.h>
+
 #include "contrib/xxhash/xxhash.h"
 
+#include "backend.h"
+#include "request.h"
+
 #include "utils.h"
 
 static uint64_t db_netaddr_addr_hash64(sa_family_t _family, pfcq_net_address_t _netaddr)
@@ -88,7 +93,7 @@ __attribute__((always_inline)) static inline ssize_t __db_find_alive_forwarder_b
 	for (size_t tries = 0; tries < _backend->forwarders_count; tries++)
 	{
 		size_t index = (_offset + tries) % _backend->forwarders_count;
-		if (likely(_backend->forwarders[index]->alive))
+		if (likely(_backend->forwarders[index]->active))
 		{
 			ret = index;
 			break;
@@ -98,86 +103,299 @@ __attribute__((always_inline)) static inline ssize_t __db_find_alive_forwarder_b
 	return ret;
 }
 
-ssize_t db_find_alive_forwarder(struct db_frontend* _frontend, pfcq_fprng_context_t* _fprng_context, pfcq_net_address_t _netaddr)
+// Forwarder warming up after revival takes share in proportion to its effective weight
+__attribute__((always_inline)) static inline int __db_forwarder_admitted(struct db_worker* _worker, const struct db_forwarder* _forwarder)
+{
+	uint64_t effective_weight = __atomic_load_n(&_forwarder->effective_weight, __ATOMIC_RELAXED);
+
+	if (likely(effective_weight >= _forwarder->weight))
+		return 1;
+
+	return pfcq_fprng_get_u64(&_worker->fprng_context) % _forwarder->weight < effective_weight;
+}
+
+// Lifetime counters of revived forwarder lag behind, so it is levelled with the least loaded one
+static void db_least_rebase(struct db_worker* _worker, size_t _index)
+{
+	struct db_backend* backend = &_worker->frontend->backend;
+	struct db_worker_forwarder* forwarder = &_worker->forwarders[_index];
+	uint64_t least_pkts = UINT64_MAX;
+	uint64_t least_bytes = UINT64_MAX;
+
+	forwarder->revivals = __atomic_load_n(&backend->forwarders[_index]->revivals, __ATOMIC_RELAXED);
+	for (size_t i = 0; i < backend->forwarders_count; i++)
+	{
+		if (i == _index || !backend->forwarders[i]->active)
+			continue;
+		if (_worker->stats->forwarders[i].in_pkts + _worker->forwarders[i].in_pkts_offset < least_pkts)
+			least_pkts = _worker->stats->forwarders[i].in_pkts + _worker->forwarders[i].in_pkts_offset;
+		if (_worker->stats->forwarders[i].in_bytes + _worker->forwarders[i].in_bytes_offset < least_bytes)
+			least_bytes = _worker->stats->forwarders[i].in_bytes + _worker->forwarders[i].in_bytes_offset;
+	}
+	if (unlikely(least_pkts == UINT64_MAX))
+		return;
+
+	forwarder->in_pkts_offset = least_pkts > _worker->stats->forwarders[_index].in_pkts ?
+		least_pkts - _worker->stats->forwarders[_index].in_pkts : 0;
+	forwarder->in_bytes_offset = least_bytes > _worker->stats->forwarders[_index].in_bytes ?
+		least_bytes - _worker->stats->forwarders[_index].in_bytes : 0;
+
+	return;
+}
+
+__attribute__((always_inline)) static inline ssize_t __db_find_alive_forwarder_maglev(uint64_t _hash, struct db_backend* _backend)
+{
+	ssize_t ret = db_backend_maglev(_backend, _hash);
+
+	// Until watchdog rebuilds the table keys of dead forwarder are spread linearly
+	if (unlikely(ret == -1))
+		ret = __db_find_alive_forwarder_by_offset(_hash, _backend);
+
+	return ret;
+}
+
+__attribute__((always_inline)) static inline ssize_t __db_find_alive_forwarder_p2c(struct db_worker* _worker)
+{
+	struct db_backend* backend = &_worker->frontend->backend;
+	const struct db_backend_table* table = db_backend_table(backend);
+	size_t count = table->alive_count;
+	size_t first_member = 0;
+	size_t second_member = 0;
+	ssize_t first = -1;
+	ssize_t second = -1;
+
+	if (unlikely(!count))
+		return __db_find_alive_forwarder_by_offset(_worker->schedule_cursor++, backend);
+
+	// Two distinct random candidates, both from the tier in rotation
+	first_member = pfcq_fprng_get_u64(&_worker->fprng_context) % count;
+	first = db_backend_member(backend, table, first_member);
+	if (unlikely(count == 1))
+		return first != -1 ? first : __db_find_alive_forwarder_by_offset(_worker->schedule_cursor++, backend);
+	second_member = pfcq_fprng_get_u64(&_worker->fprng_context) % (count - 1);
+	if (second_member >= first_member)
+		second_member++;
+	second = db_backend_member(backend, table, second_member);
+
+	// Table lags behind health checks until watchdog rebuilds it
+	if (unlikely(first == -1 && second == -1))
+		return __db_find_alive_forwarder_by_offset(_worker->schedule_cursor++, backend);
+	else if (unlikely(first == -1))
+		return second;
+	else if (unlikely(second == -1))
+		return first;
+
+	// Less in-flight queries per unit of weight wins
+	uint64_t first_load = (db_request_outstanding(&_worker->requests, first) + 1) *
+		__atomic_load_n(&backend->forwarders[second]->effective_weight, __ATOMIC_RELAXED);
+	uint64_t second_load = (db_request_outstanding(&_worker->requests, second) + 1) *
+		__atomic_load_n(&backend->forwarders[first]->effective_weight, __ATOMIC_RELAXED);
+
+	return first_load <= second_load ? first : second;
+}
+
+// Scales value by 2^(-elapsed / half-life), linear between whole half-lives
+static uint64_t db_peak_ewma_decay(uint64_t _value, uint64_t _elapsed)
+{
+	// Timestamps are 64-bit, so however long forwarder was idle, it is fully decayed rather than wrapped
+	uint64_t half_lives = _elapsed / DB_PEAK_EWMA_HALF_LIFE;
+	uint64_t remainder = _elapsed % DB_PEAK_EWMA_HALF_LIFE;
+
+	if (unlikely(half_lives >= 64))
+		return 0;
+	_value >>= half_lives;
+
+	return _value - _value * remainder / (2 * DB_PEAK_EWMA_HALF_LIFE);
+}
+
+void db_peak_ewma_update(struct db_worker_forwarder* _forwarder, uint64_t _now, uint32_t _rtt)
 {
-	if (unlikely(!_frontend))
-		return -1;
+	// Spikes are taken at once, while improvements are smoothed over time since last sample
+	if (_rtt >= _forwarder->rtt)
+		_forwarder->rtt = _rtt;
+	else
+		_forwarder->rtt = _rtt + db_peak_ewma_decay(_forwarder->rtt - _rtt, _now - _forwarder->rtt_time);
+	_forwarder->rtt_time = _now;
 
+	return;
+}
+
+__attribute__((always_inline)) static inline ssize_t __db_find_alive_forwarder_peak_ewma(struct db_worker* _worker)
+{
+	struct db_backend* backend = &_worker->frontend->backend;
+	uint64_t now = db_request_clock();
+	uint64_t mean = 0;
+	size_t sampled = 0;
+	uint64_t least_score = UINT64_MAX;
 	ssize_t ret = -1;
 
-	size_t queries = 0;
-	if (unlikely(pthread_spin_lock(&_frontend->backend.queries_lock)))
-		panic("pthread_spin_lock");
-	queries = _frontend->backend.queries++;
-	if (unlikely(pthread_spin_unlock(&_frontend->backend.queries_lock)))
-		panic("pthread_spin_unlock");
+	for (size_t i = 0; i < backend->forwarders_count; i++)
+		if (likely(backend->forwarders[i]->active && _worker->forwarders[i].rtt))
+		{
+			mean += _worker->forwarders[i].rtt;
+			sampled++;
+		}
+	if (likely(sampled))
+		mean /= sampled;
+
+	for (size_t i = 0; i < backend->forwarders_count; i++)
+	{
+		if (unlikely(!backend->forwarders[i]->active || !__db_forwarder_admitted(_worker, backend->forwarders[i])))
+			continue;
+
+		// RTT of idle forwarder drifts toward the mean, so it gets probed again
+		uint64_t rtt = _worker->forwarders[i].rtt;
+		uint64_t idle = now - _worker->forwarders[i].rtt_time;
+		if (rtt > mean)
+			rtt = mean + db_peak_ewma_decay(rtt - mean, idle);
+		else
+			rtt = mean - db_peak_ewma_decay(mean - rtt, idle);
+		// Without samples fall back to least outstanding
+		if (unlikely(!rtt))
+			rtt = 1;
+
+		uint64_t score = rtt * (db_request_outstanding(&_worker->requests, i) + 1);
+		if (score < least_score)
+		{
+			least_score = score;
+			ret = i;
+		}
+	}
+
+	// Only warming up forwarders are in rotation and none of them was admitted
+	if (unlikely(ret == -1))
+		ret = __db_find_alive_forwarder_by_offset(now, backend);
+
+	return ret;
+}
+
+// Weighted rendezvous: forwarder with highest weight / -ln(U(key, forwarder)) wins,
+// so dead one hands its keys over to next ranked and nobody else is affected
+__attribute__((always_inline)) static inline ssize_t __db_find_alive_forwarder_rendezvous(uint64_t _hash, struct db_backend* _backend)
+{
+	double best_score = 0;
+	ssize_t ret = -1;
+
+	for (size_t i = 0; i < _backend->forwarders_count; i++)
+	{
+		uint64_t weight = __atomic_load_n(&_backend->forwarders[i]->effective_weight, __ATOMIC_RELAXED);
+
+		if (unlikely(!_backend->forwarders[i]->active || !weight))
+			continue;
 
+		uint64_t hash = XXH64(&_backend->forwarders[i]->hash, sizeof(uint64_t), _hash);
+		// Top 53 bits make uniform value within (0, 1)
+		double uniform = ((double)(hash >> 11) + 0.5) / (double)(1ULL << 53);
+		double score = (double)weight / -log(uniform);
+		if (ret == -1 || score > best_score)
+		{
+			best_score = score;
+			ret = i;
+		}
+	}
+
+	return ret;
+}
+
+ssize_t db_find_alive_forwarder(struct db_worker* _worker, pfcq_net_address_t _netaddr, const struct db_query* _query)
+{
+	struct db_frontend* _frontend = _worker->frontend;
+	ssize_t ret = -1;
+
+	size_t queries = 0;
 	size_t index = 0;
-	unsigned short int random_map[_frontend->backend.forwarders_count];
 	uint64_t least_pkts = UINT64_MAX;
 	uint64_t least_traffic = UINT64_MAX;
 	uint64_t xor = 0;
 	uint64_t hash1 = 0;
 	uint64_t hash2 = 0;
-	double probability = 0;
-	double normalized_weight = 0;
-
-	pfcq_zero(random_map, _frontend->backend.forwarders_count * sizeof(unsigned short int));
 
 	switch (_frontend->backend.mode)
 	{
 		case DB_BE_MODE_RR:
+			// Strict rotation across workers is the only mode that needs shared counter
+			if (unlikely(pthread_spin_lock(&_frontend->backend.queries_lock)))
+				panic("pthread_spin_lock");
+			queries = _frontend->backend.queries++;
+			if (unlikely(pthread_spin_unlock(&_frontend->backend.queries_lock)))
+				panic("pthread_spin_unlock");
 			ret = __db_find_alive_forwarder_by_offset(queries, &_frontend->backend);
+			if (unlikely(ret != -1 && !__db_forwarder_admitted(_worker, _frontend->backend.forwarders[ret])))
+				ret = __db_find_alive_forwarder_by_offset(ret + 1, &_frontend->backend);
+			break;
+		case DB_BE_MODE_WRR:
+			ret = db_backend_schedule(&_frontend->backend, _worker->schedule_cursor++);
+			if (unlikely(ret == -1))
+				ret = __db_find_alive_forwarder_by_offset(_worker->schedule_cursor, &_frontend->backend);
 			break;
 		case DB_BE_MODE_RANDOM:
-			probability = (double)pfcq_fprng_get_u64(_fprng_context) / UINT64_MAX;
-			for (size_t tries = 0; tries < _frontend->backend.forwarders_count; tries++)
-			{
-				for (index = 0; index < _frontend->backend.forwarders_count; index++)
-				{
-					normalized_weight = (double)_frontend->backend.forwarders[index]->weight / _frontend->backend.total_weight;
-					if (_frontend->backend.forwarders[index]->alive && probability < normalized_weight)
-					{
-						ret = index;
-						break;
-					} else
-						probability -= normalized_weight;
-				}
-				if (likely(ret != -1))
-					break;
-			}
+			ret = db_backend_alias(&_frontend->backend, pfcq_fprng_get_u64(&_worker->fprng_context));
+			// Table lags behind health checks, do not lose the query
+			if (unlikely(ret == -1))
+				ret = __db_find_alive_forwarder_by_offset(_worker->schedule_cursor++, &_frontend->backend);
 			break;
 		case DB_BE_MODE_LEAST_PKTS:
+			// Every worker balances its own share of traffic
 			for (index = 0; index < _frontend->backend.forwarders_count; index++)
-				if (likely(_frontend->backend.forwarders[index]->alive))
-					if (_frontend->backend.forwarders[index]->stats.in_pkts <= least_pkts)
+				if (likely(_frontend->backend.forwarders[index]->active))
+				{
+					if (unlikely(_worker->forwarders[index].revivals != __atomic_load_n(&_frontend->backend.forwarders[index]->revivals, __ATOMIC_RELAXED)))
+						db_least_rebase(_worker, index);
+					if (_worker->stats->forwarders[index].in_pkts + _worker->forwarders[index].in_pkts_offset <= least_pkts &&
+						__db_forwarder_admitted(_worker, _frontend->backend.forwarders[index]))
 					{
-						least_pkts = _frontend->backend.forwarders[index]->stats.in_pkts;
+						least_pkts = _worker->stats->forwarders[index].in_pkts + _worker->forwarders[index].in_pkts_offset;
 						ret = index;
 					}
+				}
+			if (unlikely(ret == -1))
+				ret = __db_find_alive_forwarder_by_offset(_worker->schedule_cursor++, &_frontend->backend);
 			break;
 		case DB_BE_MODE_LEAST_TRAFFIC:
 			for (index = 0; index < _frontend->backend.forwarders_count; index++)
-				if (likely(_frontend->backend.forwarders[index]->alive))
-					if (_frontend->backend.forwarders[index]->stats.in_bytes <= least_traffic)
+				if (likely(_frontend->backend.forwarders[index]->active))
+				{
+					if (unlikely(_worker->forwarders[index].revivals != __atomic_load_n(&_frontend->backend.forwarders[index]->revivals, __ATOMIC_RELAXED)))
+						db_least_rebase(_worker, index);
+					if (_worker->stats->forwarders[index].in_bytes + _worker->forwarders[index].in_bytes_offset <= least_traffic &&
+						__db_forwarder_admitted(_worker, _frontend->backend.forwarders[index]))
 					{
-						least_traffic = _frontend->backend.forwarders[index]->stats.in_bytes;
+						least_traffic = _worker->stats->forwarders[index].in_bytes + _worker->forwarders[index].in_bytes_offset;
 						ret = index;
 					}
+				}
+			if (unlikely(ret == -1))
+				ret = __db_find_alive_forwarder_by_offset(_worker->schedule_cursor++, &_frontend->backend);
 			break;
 		case DB_BE_MODE_HASH_L3_L4:
 			hash1 = db_netaddr_addr_hash64(_frontend->layer3, _netaddr);
 			hash2 = db_netaddr_port_hash64(_frontend->layer3, _netaddr);
 			xor = hash1 ^ hash2;
-			ret = __db_find_alive_forwarder_by_offset(xor, &_frontend->backend);
+			ret = __db_find_alive_forwarder_maglev(xor, &_frontend->backend);
 			break;
 		case DB_BE_MODE_HASH_L3:
 			xor = db_netaddr_addr_hash64(_frontend->layer3, _netaddr);
-			ret = __db_find_alive_forwarder_by_offset(xor, &_frontend->backend);
+			ret = __db_find_alive_forwarder_maglev(xor, &_frontend->backend);
 			break;
 		case DB_BE_MODE_HASH_L4:
 			xor = db_netaddr_port_hash64(_frontend->layer3, _netaddr);
-			ret = __db_find_alive_forwarder_by_offset(xor, &_frontend->backend);
+			ret = __db_find_alive_forwarder_maglev(xor, &_frontend->backend);
+			break;
+		case DB_BE_MODE_LEAST_OUTSTANDING:
+			ret = __db_find_alive_forwarder_p2c(_worker);
+			break;
+		case DB_BE_MODE_PEAK_EWMA:
+			ret = __db_find_alive_forwarder_peak_ewma(_worker);
+			break;
+		case DB_BE_MODE_HASH_QNAME:
+			// Qname is lowercased by parser already
+			xor = XXH64(_query->qname, _query->qname_length, DB_HASH_SEED);
+			ret = __db_find_alive_forwarder_rendezvous(xor, &_frontend->backend);
+			break;
+		case DB_BE_MODE_HASH_QNAME_QTYPE:
+			xor = XXH64(_query->qname, _query->qname_length, DB_HASH_SEED);
+			xor = XXH64(&_query->qtype, sizeof(uint16_t), xor);
+			ret = __db_find_alive_forwarder_rendezvous(xor, &_frontend->backend);
 			break;
 		default:
 			ret = 0;
@@ -187,3 +405,26 @@ ssize_t db_find_alive_forwarder(struct db_frontend* _frontend, pfcq_fprng_contex
 	return ret;
 }
 
+// Forwarder at its in-flight cap hands the query over to the next one in rotation
+// that has room, then to standby tiers, and gives up when every forwarder is full
+ssize_t db_spill_forwarder(struct db_worker* _worker, size_t _forwarder_index)
+{
+	struct db_backend* backend = &_worker->frontend->backend;
+
+	if (likely(!_worker->forwarders[_forwarder_index].max_outstanding ||
+		db_request_outstanding(&_worker->requests, _forwarder_index) < _worker->forwarders[_forwarder_index].max_outstanding))
+		return _forwarder_index;
+
+	for (unsigned short int standby = 0; standby < 2; standby++)
+		for (size_t tries = 1; tries < backend->forwarders_count; tries++)
+		{
+			size_t index = (_forwarder_index + tries) % backend->forwarders_count;
+			if (!(standby ? backend->forwarders[index]->alive : backend->forwarders[index]->active))
+				continue;
+			if (!_worker->forwarders[index].max_outstanding ||
+				db_request_outstanding(&_worker->requests, index) < _worker->forwarders[index].max_outstanding)
+				return index;
+		}
+
+	return -1;
+}
@@ -29,7 +29,9 @@
 
 #define DB_LOG2(X) ((unsigned)(CHAR_BIT * sizeof(unsigned long long) - __builtin_clzll((X)) - 1))
 
-ssize_t db_find_alive_forwarder(struct db_frontend* _frontend, pfcq_fprng_context_t* _fprng_context, pfcq_net_address_t _netaddr);
+void db_peak_ewma_update(struct db_worker_forwarder* _forwarder, uint64_t _now, uint32_t _rtt) __attribute__((nonnull(1)));
+ssize_t db_find_alive_forwarder(struct db_worker* _worker, pfcq_net_address_t _netaddr, const struct db_query* _query) __attribute__((nonnull(1, 3)));
+ssize_t db_spill_forwarder(struct db_worker* _worker, size_t _forwarder_index) __attribute__((nonnull(1)));
 
 #endif /* __UTILS_H__ */
 
@@ -0,0 +1,328 @@
+/* vim: set tabstop=4:softtabstop=4:shiftwidth=4:noexpandtab */
+
+/*
+ * dnsbalancer - daemon to balance UDP DNS requests over DNS servers
+ * Copyright (C) 2015-2016 Lanet Network
+ * Programmed by Oleksandr Natalenko <o.natalenko@lanet.ua>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+
+#include "backend.h"
+#include "pool.h"
+#include "request.h"
+
+#include "utils.h"
+
+#define DB_TEST_FORWARDERS		5
+#define DB_TEST_SAMPLES			100000
+
+struct db_test_worker
+{
+	struct db_worker worker;
+	struct db_frontend frontend;
+	struct db_forwarder forwarders[DB_TEST_FORWARDERS];
+	struct db_forwarder* pointers[DB_TEST_FORWARDERS];
+	char names[DB_TEST_FORWARDERS][16];
+	pfcq_net_address_t client;
+};
+
+static void db_test_worker_init(struct db_test_worker* _test, enum db_backend_mode _mode, const uint64_t* _weights)
+{
+	pfcq_zero(_test, sizeof(struct db_test_worker));
+	_test->frontend.layer3 = PF_INET;
+	_test->frontend.backend.mode = _mode;
+	_test->frontend.backend.forwarders = _test->pointers;
+	_test->frontend.backend.forwarders_count = DB_TEST_FORWARDERS;
+	_test->client.address4.sin_family = AF_INET;
+
+	for (size_t i = 0; i < DB_TEST_FORWARDERS; i++)
+	{
+		snprintf(_test->names[i], sizeof(_test->names[i]), "frw_%zu", i);
+		_test->forwarders[i].name = _test->names[i];
+		_test->forwarders[i].weight = _weights[i];
+		_test->forwarders[i].alive = 1;
+		_test->pointers[i] = &_test->forwarders[i];
+	}
+	db_backend_init(&_test->frontend.backend);
+
+	_test->worker.frontend = &_test->frontend;
+	_test->worker.forwarders = pfcq_alloc(DB_TEST_FORWARDERS * sizeof(struct db_worker_forwarder));
+	pfcq_fprng_init(&_test->worker.fprng_context);
+	db_pool_init(&_test->worker.request_pool, sizeof(struct db_request), 0);
+	db_request_table_init(&_test->worker.requests, DB_TEST_FORWARDERS, &_test->worker.request_pool, &_test->worker.fprng_context);
+
+	return;
+}
+
+static void db_test_worker_done(struct db_test_worker* _test)
+{
+	db_request_table_done(&_test->worker.requests);
+	db_pool_done(&_test->worker.request_pool);
+	pfcq_free(_test->worker.forwarders);
+	db_backend_done(&_test->frontend.backend);
+
+	return;
+}
+
+static void db_test_pick(struct db_test_worker* _test, const struct db_query* _query, size_t* _picked)
+{
+	for (size_t i = 0; i < DB_TEST_SAMPLES; i++)
+	{
+		ssize_t index = db_find_alive_forwarder(&_test->worker, _test->client, _query);
+		assert(index >= 0 && index < DB_TEST_FORWARDERS);
+		assert(_test->forwarders[index].active);
+		_picked[index]++;
+	}
+
+	return;
+}
+
+// Within 6 sigma of binomial distribution
+static int db_test_share(size_t _picked, double _probability)
+{
+	double expected = DB_TEST_SAMPLES * _probability;
+	double sigma = sqrt(expected * (1 - _probability));
+
+	return _picked >= expected - 6 * sigma - 1 && _picked <= expected + 6 * sigma + 1;
+}
+
+static struct db_request* db_test_send(struct db_test_worker* _test, const struct db_query* _query, size_t _forwarder_index)
+{
+	struct db_request* ret = db_make_request(&_test->worker.request_pool, _query, &_test->client, _forwarder_index);
+
+	assert(ret);
+	assert(db_insert_request(&_test->worker.requests, ret) == 0);
+
+	return ret;
+}
+
+static void db_test_least_outstanding(void)
+{
+	const uint64_t even[DB_TEST_FORWARDERS] = {1, 1, 1, 1, 1};
+	const uint64_t weights[DB_TEST_FORWARDERS] = {4, 1, 1, 1, 1};
+	struct db_request* requests[8];
+	struct db_test_worker test;
+	struct db_query query;
+
+	pfcq_zero(&query, sizeof(struct db_query));
+	query.qname_length = 1;
+
+	db_test_worker_init(&test, DB_BE_MODE_LEAST_OUTSTANDING, even);
+
+	// Idle forwarders are picked evenly
+	{
+		size_t picked[DB_TEST_FORWARDERS] = {0};
+		db_test_pick(&test, &query, picked);
+		for (size_t i = 0; i < DB_TEST_FORWARDERS; i++)
+			assert(db_test_share(picked[i], 1.0 / DB_TEST_FORWARDERS));
+	}
+
+	// Busy forwarder always loses to the other candidate, whoever it is
+	for (size_t i = 0; i < 8; i++)
+		requests[i] = db_test_send(&test, &query, 0);
+	db_test_send(&test, &query, 1);
+	assert(db_request_outstanding(&test.worker.requests, 0) == 8);
+	{
+		size_t picked[DB_TEST_FORWARDERS] = {0};
+		db_test_pick(&test, &query, picked);
+		assert(!picked[0]);
+		// Forwarder 1 wins against 0 only
+		assert(db_test_share(picked[1], 2.0 / (DB_TEST_FORWARDERS * (DB_TEST_FORWARDERS - 1))));
+	}
+
+	// Settled requests are not in flight even though they still hold their IDs
+	for (size_t i = 0; i < 8; i++)
+		db_settle_request(&test.worker.requests, requests[i]);
+	assert(db_request_outstanding(&test.worker.requests, 0) == 0);
+	assert(test.worker.requests.forwarders[0].used == 8);
+	for (size_t i = 0; i < 8; i++)
+	{
+		assert(db_eject_request(&test.worker.requests, 0, requests[i]->id, requests[i]->fingerprint) == requests[i]);
+		db_pool_free(&test.worker.request_pool, requests[i]);
+	}
+	assert(!test.worker.requests.forwarders[0].used);
+
+	// Dead forwarder is never picked even if it is idle
+	test.forwarders[2].alive = 0;
+	db_backend_rebuild(&test.frontend.backend);
+	{
+		size_t picked[DB_TEST_FORWARDERS] = {0};
+		db_test_pick(&test, &query, picked);
+		assert(!picked[2]);
+	}
+
+	// Candidates are drawn among alive forwarders only, so busy one still loses
+	// to the other candidate instead of winning against a dead peer
+	test.forwarders[3].alive = 0;
+	db_backend_rebuild(&test.frontend.backend);
+	for (size_t i = 0; i < 8; i++)
+		requests[i] = db_test_send(&test, &query, 4);
+	{
+		size_t picked[DB_TEST_FORWARDERS] = {0};
+		db_test_pick(&test, &query, picked);
+		assert(!picked[2] && !picked[3] && !picked[4]);
+		// 0 is idle and wins against both 1 and 4
+		assert(db_test_share(picked[0], 2.0 / 3));
+	}
+
+	db_test_worker_done(&test);
+
+	// Load is compared per unit of weight: heavy forwarder with a query in flight
+	// still wins against idle light one, so it is picked whenever it is a candidate
+	db_test_worker_init(&test, DB_BE_MODE_LEAST_OUTSTANDING, weights);
+	db_test_send(&test, &query, 0);
+	{
+		size_t picked[DB_TEST_FORWARDERS] = {0};
+		db_test_pick(&test, &query, picked);
+		assert(db_test_share(picked[0], 2.0 / DB_TEST_FORWARDERS));
+	}
+	db_test_worker_done(&test);
+
+	return;
+}
+
+static void db_test_query(struct db_query* _query, size_t _key, uint16_t _qtype)
+{
+	pfcq_zero(_query, sizeof(struct db_query));
+	_query->qname_length = (size_t)snprintf((char*)_query->qname + 1, DB_QNAME_MAX_LENGTH - 1, "q%zu", _key);
+	_query->qname[0] = (uint8_t)_query->qname_length;
+	_query->qname_length += 2;
+	_query->qtype = _qtype;
+
+	return;
+}
+
+static void db_test_hash_qname(void)
+{
+	const uint64_t weights[DB_TEST_FORWARDERS] = {1, 2, 3, 4, 10};
+	static uint8_t before[DB_TEST_SAMPLES];
+	size_t picked[DB_TEST_FORWARDERS] = {0};
+	struct db_test_worker test;
+	struct db_query query;
+	size_t moved = 0;
+
+	db_test_worker_init(&test, DB_BE_MODE_HASH_QNAME, weights);
+
+	// Keys are spread by weight, and the same name always goes to the same forwarder
+	for (size_t i = 0; i < DB_TEST_SAMPLES; i++)
+	{
+		db_test_query(&query, i, LDNS_RR_TYPE_A);
+		ssize_t index = db_find_alive_forwarder(&test.worker, test.client, &query);
+		assert(index >= 0 && index < DB_TEST_FORWARDERS);
+		query.qtype = LDNS_RR_TYPE_SOA;
+		assert(db_find_alive_forwarder(&test.worker, test.client, &query) == index);
+		before[i] = (uint8_t)index;
+		picked[index]++;
+	}
+	for (size_t i = 0; i < DB_TEST_FORWARDERS; i++)
+		assert(db_test_share(picked[i], weights[i] / 20.0));
+
+	// Only names of dead forwarder move
+	test.forwarders[3].alive = 0;
+	db_backend_rebuild(&test.frontend.backend);
+	for (size_t i = 0; i < DB_TEST_SAMPLES; i++)
+	{
+		db_test_query(&query, i, LDNS_RR_TYPE_A);
+		ssize_t index = db_find_alive_forwarder(&test.worker, test.client, &query);
+		assert(index != 3);
+		if (before[i] == 3)
+			moved++;
+		else
+			assert(index == before[i]);
+	}
+	assert(moved == picked[3]);
+
+	// And they come back once it is revived
+	test.forwarders[3].alive = 1;
+	db_backend_rebuild(&test.frontend.backend);
+	for (size_t i = 0; i < DB_TEST_SAMPLES; i++)
+	{
+		db_test_query(&query, i, LDNS_RR_TYPE_A);
+		assert(db_find_alive_forwarder(&test.worker, test.client, &query) == before[i]);
+	}
+
+	db_test_worker_done(&test);
+
+	// With query type hashed too, types of one name are spread as well
+	db_test_worker_init(&test, DB_BE_MODE_HASH_QNAME_QTYPE, weights);
+	moved = 0;
+	for (size_t i = 0; i < DB_TEST_SAMPLES; i++)
+	{
+		db_test_query(&query, i, LDNS_RR_TYPE_A);
+		ssize_t index = db_find_alive_forwarder(&test.worker, test.client, &query);
+		assert(db_find_alive_forwarder(&test.worker, test.client, &query) == index);
+		query.qtype = LDNS_RR_TYPE_SOA;
+		if (db_find_alive_forwarder(&test.worker, test.client, &query) != index)
+			moved++;
+	}
+	assert(moved > DB_TEST_SAMPLES / 2);
+	db_test_worker_done(&test);
+
+	return;
+}
+
+// Backup tier is out of rotation, so primaries are always compared against each other
+static void db_test_least_outstanding_tiers(void)
+{
+	const uint64_t even[DB_TEST_FORWARDERS] = {1, 1, 1, 1, 1};
+	struct db_test_worker test;
+	struct db_query query;
+
+	pfcq_zero(&query, sizeof(struct db_query));
+	query.qname_length = 1;
+
+	db_test_worker_init(&test, DB_BE_MODE_LEAST_OUTSTANDING, even);
+	for (size_t i = 2; i < DB_TEST_FORWARDERS; i++)
+		test.forwarders[i].priority = 1;
+	db_backend_rebuild(&test.frontend.backend);
+	assert(db_backend_table(&test.frontend.backend)->alive_count == 2);
+
+	db_test_send(&test, &query, 0);
+	{
+		size_t picked[DB_TEST_FORWARDERS] = {0};
+		db_test_pick(&test, &query, picked);
+		assert(picked[1] == DB_TEST_SAMPLES);
+	}
+
+	// Primary tier gone, backups take over
+	test.forwarders[0].alive = 0;
+	test.forwarders[1].alive = 0;
+	db_backend_rebuild(&test.frontend.backend);
+	{
+		size_t picked[DB_TEST_FORWARDERS] = {0};
+		db_test_pick(&test, &query, picked);
+		assert(!picked[0] && !picked[1]);
+		for (size_t i = 2; i < DB_TEST_FORWARDERS; i++)
+			assert(db_test_share(picked[i], 1.0 / 3));
+	}
+
+	db_test_worker_done(&test);
+
+	return;
+}
+
+int main(void)
+{
+	db_test_least_outstanding();
+	db_test_least_outstanding_tiers();
+	db_test_hash_qname();
+
+	printf("%s\n", "utils: OK");
+
+	return 0;
+}
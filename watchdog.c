@@ -17,41 +17,74 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
-
+#include <math.h>
 #include <signal.h>
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
 
+#include "backend.h"
+#include "query.h"
 #include "request.h"
+#include "stats.h"
+#include "timer.h"
 
 #include "watchdog.h"
 
-int db_ping_forwarder(struct db_forwarder* _forwarder)
+static void db_probe_init(struct db_probe* _probe)
 {
-	int ret = 0;
-	size_t db_ping_packet_buffer_size = 0;
-	uint8_t* db_ping_packet_buffer = NULL;
-	uint8_t db_echo_packet_buffer[DB_DEFAULT_DNS_PACKET_SIZE];
-	struct timeval timeout = __pfcq_us_to_timeval(_forwarder->check_timeout);
-
-	pfcq_zero(db_echo_packet_buffer, DB_DEFAULT_DNS_PACKET_SIZE);
+	ldns_pkt* probe_packet = NULL;
+	ldns_rr* probe_packet_rr = NULL;
+	struct db_query probe_query;
 
-	int db_ping_socket = socket(_forwarder->layer3, SOCK_DGRAM, IPPROTO_UDP);
-	if (unlikely(db_ping_socket == -1))
-		goto out;
-	if (unlikely(setsockopt(db_ping_socket, SOL_SOCKET, SO_RCVTIMEO, (const void*)&timeout, sizeof(timeout)) == -1))
-		goto out;
-	if (unlikely(setsockopt(db_ping_socket, SOL_SOCKET, SO_SNDTIMEO, (const void*)&timeout, sizeof(timeout)) == -1))
+	// Probe is built once, only its ID changes between rounds
+	probe_packet = ldns_pkt_new();
+	if (unlikely(!probe_packet))
 		goto out;
+	ldns_pkt_set_qr(probe_packet, 0);
+	ldns_pkt_set_opcode(probe_packet, LDNS_PACKET_QUERY);
+	ldns_pkt_set_tc(probe_packet, 0);
+	ldns_pkt_set_rd(probe_packet, 1);
+	if (unlikely(ldns_rr_new_question_frm_str(&probe_packet_rr, _probe->forwarder->check_query, NULL, NULL) != LDNS_STATUS_OK))
+		goto packet_free;
+	int probe_push_res = ldns_pkt_push_rr(probe_packet, LDNS_SECTION_QUESTION, probe_packet_rr);
+	if (unlikely(probe_push_res != LDNS_STATUS_OK && probe_push_res != LDNS_STATUS_EMPTY_LABEL))
+		goto packet_free;
+	if (unlikely(ldns_pkt2wire(&_probe->packet, probe_packet, &_probe->packet_length) != LDNS_STATUS_OK))
+		goto packet_free;
+	if (unlikely(db_query_parse(_probe->packet, _probe->packet_length, &probe_query) == -1))
+	{
+		free(_probe->packet);
+		_probe->packet = NULL;
+		goto packet_free;
+	}
+	_probe->fingerprint = db_request_fingerprint(&probe_query);
+
+packet_free:
+	ldns_pkt_free(probe_packet);
+out:
+	// Forwarder with broken check query is never found alive
+	if (unlikely(!_probe->packet))
+		verbose("%s forwarder check query is invalid\n", _probe->forwarder->name);
+
+	return;
+}
 
+static int db_probe_connect(struct db_probe* _probe, int _epoll_fd)
+{
+	struct epoll_event epoll_event;
 	int connect_res = -1;
-	switch (_forwarder->layer3)
+
+	_probe->socket = socket(_probe->forwarder->layer3, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP);
+	if (unlikely(_probe->socket == -1))
+		return -1;
+
+	switch (_probe->forwarder->layer3)
 	{
 		case PF_INET:
-			connect_res = connect(db_ping_socket, (const struct sockaddr*)&_forwarder->address.address4, (socklen_t)sizeof(struct sockaddr_in));
+			connect_res = connect(_probe->socket, (const struct sockaddr*)&_probe->forwarder->address.address4, (socklen_t)sizeof(struct sockaddr_in));
 			break;
 		case PF_INET6:
-			connect_res = connect(db_ping_socket, (const struct sockaddr*)&_forwarder->address.address6, (socklen_t)sizeof(struct sockaddr_in6));
+			connect_res = connect(_probe->socket, (const struct sockaddr*)&_probe->forwarder->address.address6, (socklen_t)sizeof(struct sockaddr_in6));
 			break;
 		default:
 			panic("socket domain");
@@ -60,72 +93,256 @@ int db_ping_forwarder(struct db_forwarder* _forwarder)
 	if (unlikely(connect_res == -1))
 		goto socket_close;
 
-	// Ping request
-	ldns_pkt* db_ping_packet = ldns_pkt_new();
-	if (unlikely(!db_ping_packet))
-		goto packet_free;
-	ldns_pkt_set_random_id(db_ping_packet);
-	ldns_pkt_set_qr(db_ping_packet, 0);
-	ldns_pkt_set_opcode(db_ping_packet, LDNS_PACKET_QUERY);
-	ldns_pkt_set_tc(db_ping_packet, 0);
-	ldns_pkt_set_rd(db_ping_packet, 1);
-	ldns_rr* db_ping_packet_rr = NULL;
-	if (unlikely(ldns_rr_new_question_frm_str(&db_ping_packet_rr, _forwarder->check_query, NULL, NULL) != LDNS_STATUS_OK))
-		goto packet_free;
-	int db_ping_push_res = ldns_pkt_push_rr(db_ping_packet, LDNS_SECTION_QUESTION, db_ping_packet_rr);
-	if (unlikely(db_ping_push_res != LDNS_STATUS_OK && db_ping_push_res != LDNS_STATUS_EMPTY_LABEL))
-		goto packet_free;
-	if (unlikely(ldns_pkt2wire(&db_ping_packet_buffer, db_ping_packet, &db_ping_packet_buffer_size) != LDNS_STATUS_OK))
-		goto packet_free;
-	if (unlikely(send(db_ping_socket, db_ping_packet_buffer, db_ping_packet_buffer_size, 0) == -1))
-		goto ping_buffer_free;
-	struct db_request_data request_data = db_make_request_data(db_ping_packet, db_ping_socket);
+	pfcq_zero(&epoll_event, sizeof(struct epoll_event));
+	epoll_event.data.ptr = _probe;
+	epoll_event.events = EPOLLIN;
+	if (unlikely(epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _probe->socket, &epoll_event) == -1))
+		goto socket_close;
+
+	return 0;
+
+socket_close:
+	close(_probe->socket);
+	_probe->socket = -1;
 
-	// Ping reply
-	ssize_t db_echo_packet_buffer_size = recv(db_ping_socket, db_echo_packet_buffer, DB_DEFAULT_DNS_PACKET_SIZE, 0);
-	if (unlikely(db_echo_packet_buffer_size == -1))
-		goto ping_buffer_free;
+	return -1;
+}
 
-	ldns_pkt* db_echo_packet = NULL;
-	if (unlikely(ldns_wire2pkt(&db_echo_packet, db_echo_packet_buffer, db_echo_packet_buffer_size) != LDNS_STATUS_OK))
-		goto ping_buffer_free;
+static int db_probe_send(struct db_probe* _probe, int _epoll_fd, pfcq_fprng_context_t* _fprng_context)
+{
+	if (unlikely(!_probe->packet))
+		return -1;
+	// Socket is kept across rounds and reopened only if it could not be set up
+	if (unlikely(_probe->socket == -1 && db_probe_connect(_probe, _epoll_fd) == -1))
+		return -1;
 
-	if (unlikely(ldns_pkt_qdcount(db_echo_packet) != 1))
-		goto pkt_free;
+	_probe->id = (uint16_t)pfcq_fprng_get_u64(_fprng_context);
+	uint16_t id_nbo = htons(_probe->id);
+	memcpy(_probe->packet, &id_nbo, sizeof(uint16_t));
+	if (unlikely(send(_probe->socket, _probe->packet, _probe->packet_length, 0) == -1))
+		return -1;
 
-	ldns_rr_list* db_echo_queries = ldns_pkt_question(db_echo_packet);
-	size_t db_echo_queries_count = ldns_rr_list_rr_count(db_echo_queries);
-	for (size_t i = 0; i < db_echo_queries_count; i++)
+	return 0;
+}
+
+static int db_probe_receive(struct db_probe* _probe)
+{
+	int ret = 0;
+	ssize_t echo_length = 0;
+	uint8_t echo_buffer[DB_DEFAULT_DNS_PACKET_SIZE];
+	struct db_query echo_query;
+
+	// Drain socket skipping late replies to previous rounds
+	while ((echo_length = recv(_probe->socket, echo_buffer, DB_DEFAULT_DNS_PACKET_SIZE, 0)) != -1)
+	{
+		if (unlikely(db_query_parse(echo_buffer, (size_t)echo_length, &echo_query) == -1))
+			continue;
+		if (likely(_probe->pending && echo_query.response && echo_query.id == _probe->id &&
+			db_request_fingerprint(&echo_query) == _probe->fingerprint))
+			ret = 1;
+	}
+
+	return ret;
+}
+
+static uint64_t db_slow_start_weight(const struct db_forwarder* _forwarder, uint64_t _elapsed)
+{
+	uint64_t floor = _forwarder->weight * DB_SLOW_START_FLOOR / 100;
+
+	if (!floor)
+		floor = 1;
+	if (floor >= _forwarder->weight)
+		return _forwarder->weight;
+
+	switch (_forwarder->slow_start_mode)
+	{
+		case DB_SLOW_START_LINEAR:
+			return floor + (_forwarder->weight - floor) * _elapsed / _forwarder->slow_start;
+		case DB_SLOW_START_EXPONENTIAL:
+			return (uint64_t)(floor * pow((double)_forwarder->weight / floor, (double)_elapsed / _forwarder->slow_start));
+		default:
+			panic("Unknown slow start mode");
+			break;
+	}
+
+	return _forwarder->weight;
+}
+
+static int db_slow_start_update(struct db_probe* _probe, uint64_t _now, uint64_t _timer_resolution)
+{
+	struct db_forwarder* forwarder = _probe->forwarder;
+	uint64_t elapsed = (_now - _probe->ramp_start) * _timer_resolution;
+	uint64_t weight = forwarder->weight;
+
+	if (likely(!_probe->ramping))
+		return 0;
+
+	if (elapsed >= forwarder->slow_start || !forwarder->alive)
+		_probe->ramping = 0;
+	else
+		weight = db_slow_start_weight(forwarder, elapsed);
+	if (weight == forwarder->effective_weight)
+		return 0;
+	__atomic_store_n(&forwarder->effective_weight, weight, __ATOMIC_RELAXED);
+
+	return 1;
+}
+
+static int db_probe_verdict(struct db_local_context* _ctx, struct db_probe* _probe, int _answered, uint64_t _now)
+{
+	struct db_frontend* frontend = _ctx->frontends[_probe->frontend_index];
+	struct db_forwarder* forwarder = _probe->forwarder;
+	int ret = 0;
+
+	if (unlikely(!_answered))
 	{
-		ldns_rr* db_echo_query = ldns_rr_list_rr(db_echo_queries, i);
-		if (likely(ldns_rr_is_question(db_echo_query)))
+		forwarder->fails++;
+		if (unlikely(forwarder->fails >= forwarder->check_attempts))
 		{
-			struct db_request_data reply_data = db_make_request_data(db_echo_packet, db_ping_socket);
-			if (likely(db_compare_request_data(request_data, reply_data)))
+			if (likely(forwarder->alive))
+			{
+				verbose("%s:%s forwarder is dead\n", frontend->name, forwarder->name);
 				ret = 1;
-			break;
+			}
+			forwarder->fails = 0;
+			forwarder->alive = 0;
 		}
+	} else
+	{
+		// Ejected forwarder stays out of rotation until its period is over
+		if (unlikely(forwarder->ejected))
+		{
+			forwarder->fails = 0;
+			return 0;
+		}
+		if (unlikely(!forwarder->alive))
+		{
+			verbose("%s:%s forwarder is alive\n", frontend->name, forwarder->name);
+			__atomic_store_n(&forwarder->revivals, forwarder->revivals + 1, __ATOMIC_RELAXED);
+			// Forwarder coming back (not just found at start) gets its share gradually
+			if (_probe->checked && forwarder->slow_start)
+			{
+				_probe->ramping = 1;
+				_probe->ramp_start = _now;
+				__atomic_store_n(&forwarder->effective_weight, db_slow_start_weight(forwarder, 0), __ATOMIC_RELAXED);
+			}
+			ret = 1;
+		}
+		forwarder->fails = 0;
+		forwarder->alive = 1;
 	}
+	_probe->checked = 1;
 
-pkt_free:
-	ldns_pkt_free(db_echo_packet);
-ping_buffer_free:
-	free(db_ping_packet_buffer);
-packet_free:
-	ldns_pkt_free(db_ping_packet);
-socket_close:
-	close(db_ping_socket);
-out:
 	return ret;
 }
 
+// Passive checks: outcomes of live traffic are summed over workers once
+// per round into sliding window of DB_OUTLIER_WINDOW rounds
+static int db_outlier_update(struct db_local_context* _ctx, struct db_probe* _probe, struct db_timer_wheel* _timers, uint64_t _now)
+{
+	struct db_frontend* frontend = _ctx->frontends[_probe->frontend_index];
+	const struct db_outlier_detection* detection = &frontend->backend.outlier;
+	struct db_outlier* outlier = &_probe->outlier;
+	struct db_forwarder* forwarder = _probe->forwarder;
+	uint64_t answers = 0;
+	uint64_t servfails = 0;
+	uint64_t timeouts = 0;
+	size_t in_rotation = 0;
+
+	if (!detection->enabled)
+		return 0;
+
+	struct db_forwarder_stats stats = db_stats_forwarder(frontend, _probe->forwarder_index);
+	outlier->bucket = (outlier->bucket + 1) % DB_OUTLIER_WINDOW;
+	outlier->answers[outlier->bucket] = stats.out_pkts - outlier->last_answers;
+	outlier->servfails[outlier->bucket] = stats.out_servfail - outlier->last_servfails;
+	outlier->timeouts[outlier->bucket] = stats.timeouts - outlier->last_timeouts;
+	outlier->last_answers = stats.out_pkts;
+	outlier->last_servfails = stats.out_servfail;
+	outlier->last_timeouts = stats.timeouts;
+
+	// Failures in a row are counted per round: any good answer breaks the series
+	if (outlier->answers[outlier->bucket] > outlier->servfails[outlier->bucket])
+		outlier->consecutive_failures = 0;
+	else
+		outlier->consecutive_failures += outlier->servfails[outlier->bucket] + outlier->timeouts[outlier->bucket];
+
+	if (unlikely(forwarder->ejected))
+	{
+		if (_now < outlier->ejected_until)
+			return 0;
+		// Next successful active check returns forwarder into rotation
+		verbose("%s:%s forwarder ejection is over\n", frontend->name, forwarder->name);
+		forwarder->ejected = 0;
+		outlier->calm_rounds = 0;
+		return 0;
+	}
+
+	for (size_t i = 0; i < DB_OUTLIER_WINDOW; i++)
+	{
+		answers += outlier->answers[i];
+		servfails += outlier->servfails[i];
+		timeouts += outlier->timeouts[i];
+	}
+
+	if (!((detection->consecutive_failures && outlier->consecutive_failures >= detection->consecutive_failures) ||
+		(answers + timeouts >= detection->min_requests &&
+			((detection->timeout_ratio && timeouts * 100 >= detection->timeout_ratio * (answers + timeouts)) ||
+			(detection->servfail_ratio && answers && servfails * 100 >= detection->servfail_ratio * answers)))))
+	{
+		// Ejection period shrinks back after whole window without trouble
+		if (outlier->ejection_level && ++outlier->calm_rounds >= DB_OUTLIER_WINDOW)
+		{
+			outlier->ejection_level--;
+			outlier->calm_rounds = 0;
+		}
+		return 0;
+	}
+
+	// Never eject the last forwarder in rotation
+	for (size_t i = 0; i < frontend->backend.forwarders_count; i++)
+		if (frontend->backend.forwarders[i]->alive)
+			in_rotation++;
+	if (!forwarder->alive || in_rotation <= 1)
+		return 0;
+
+	// Every ejection in a row lasts twice as long as previous one
+	uint64_t ejection_time = detection->ejection_time << outlier->ejection_level;
+	if (ejection_time > detection->max_ejection_time)
+		ejection_time = detection->max_ejection_time;
+	if (outlier->ejection_level < DB_OUTLIER_MAX_LEVEL)
+		outlier->ejection_level++;
+	outlier->ejected_until = _now + db_timer_ticks(_timers, ejection_time * 1000000ULL);
+	outlier->calm_rounds = 0;
+	outlier->consecutive_failures = 0;
+	pfcq_zero(outlier->answers, sizeof(outlier->answers));
+	pfcq_zero(outlier->servfails, sizeof(outlier->servfails));
+	pfcq_zero(outlier->timeouts, sizeof(outlier->timeouts));
+
+	verbose("%s:%s forwarder is ejected for %lu ms\n", frontend->name, forwarder->name, ejection_time);
+	forwarder->ejected = 1;
+	forwarder->ejections++;
+	forwarder->fails = 0;
+	forwarder->alive = 0;
+
+	return 1;
+}
+
 void* db_watchdog(void* _data)
 {
 	int epoll_fd = -1;
 	struct epoll_event epoll_event;
 	struct epoll_event epoll_events[EPOLL_MAXEVENTS];
+	struct db_timer_wheel timers;
+	pfcq_fprng_context_t fprng_context;
+	struct db_probe* probes = NULL;
+	size_t probes_count = 0;
+	size_t pending = 0;
+	unsigned short int* changed = NULL;
+	uint64_t next_round = 0;
 
 	struct db_local_context* ctx = _data;
+	uint64_t timer_resolution = ctx->global_context->timer_resolution;
 
 	pfcq_zero(&epoll_event, sizeof(struct epoll_event));
 	pfcq_zero(&epoll_events, EPOLL_MAXEVENTS * sizeof(struct epoll_event));
@@ -133,38 +350,81 @@ void* db_watchdog(void* _data)
 	epoll_fd = epoll_create1(0);
 	if (unlikely(epoll_fd == -1))
 		panic("epoll_create");
-	epoll_event.data.fd = ctx->watchdog_eventfd;
+	// Probes are registered with their own pointers, so eventfd goes with none
+	epoll_event.data.ptr = NULL;
 	epoll_event.events = EPOLLIN;
 	if (unlikely(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ctx->watchdog_eventfd, &epoll_event) == -1))
 		panic("epoll_ctl");
 
+	pfcq_fprng_init(&fprng_context);
+	db_timer_wheel_init(&timers, timer_resolution * 1000000ULL);
+
+	// One probe per forwarder of every frontend
+	for (size_t i = 0; i < ctx->frontends_count; i++)
+		probes_count += ctx->frontends[i]->backend.forwarders_count;
+	probes = pfcq_alloc(probes_count * sizeof(struct db_probe));
+	changed = pfcq_alloc(ctx->frontends_count * sizeof(unsigned short int));
+	for (size_t i = 0, k = 0; i < ctx->frontends_count; i++)
+		for (size_t j = 0; j < ctx->frontends[i]->backend.forwarders_count; j++, k++)
+		{
+			probes[k].forwarder = ctx->frontends[i]->backend.forwarders[j];
+			probes[k].frontend_index = i;
+			probes[k].forwarder_index = j;
+			probes[k].socket = -1;
+			db_probe_init(&probes[k]);
+		}
+
 	for (;;)
 	{
-		// Watchdog
-		for (size_t i = 0; i < ctx->frontends_count; i++)
-			for (size_t j = 0; j < ctx->frontends[i]->backend.forwarders_count; j++)
+		uint64_t now = db_timer_now(&timers);
+
+		// Probes left without reply within check timeout
+		struct db_timer* expired = db_timer_advance(&timers, now);
+		while (expired)
+		{
+			struct db_timer* next_timer = expired->next;
+			// Timer is the first member of probe
+			struct db_probe* current_probe = (struct db_probe*)expired;
+			current_probe->pending = 0;
+			pending--;
+			changed[current_probe->frontend_index] |= db_probe_verdict(ctx, current_probe, 0, now);
+			expired = next_timer;
+		}
+
+		// Fire all probes at once, so pass takes as long as the slowest check
+		if (now >= next_round)
+		{
+			for (size_t i = 0; i < probes_count; i++)
 			{
-				int db_ping_result = db_ping_forwarder(ctx->frontends[i]->backend.forwarders[j]);
-				if (unlikely(!db_ping_result))
-				{
-					ctx->frontends[i]->backend.forwarders[j]->fails++;
-					if (unlikely(ctx->frontends[i]->backend.forwarders[j]->fails >= ctx->frontends[i]->backend.forwarders[j]->check_attempts))
-					{
-						if (likely(ctx->frontends[i]->backend.forwarders[j]->alive))
-							verbose("%s:%s forwarder is dead\n", ctx->frontends[i]->name, ctx->frontends[i]->backend.forwarders[j]->name);
-						ctx->frontends[i]->backend.forwarders[j]->fails = 0;
-						ctx->frontends[i]->backend.forwarders[j]->alive = 0;
-					}
-				} else
+				changed[probes[i].frontend_index] |= db_outlier_update(ctx, &probes[i], &timers, now);
+				changed[probes[i].frontend_index] |= db_slow_start_update(&probes[i], now, timer_resolution);
+				if (unlikely(probes[i].pending))
+					continue;
+				if (unlikely(db_probe_send(&probes[i], epoll_fd, &fprng_context) == -1))
 				{
-					if (unlikely(!ctx->frontends[i]->backend.forwarders[j]->alive))
-						verbose("%s:%s forwarder is alive\n", ctx->frontends[i]->name, ctx->frontends[i]->backend.forwarders[j]->name);
-					ctx->frontends[i]->backend.forwarders[j]->fails = 0;
-					ctx->frontends[i]->backend.forwarders[j]->alive = 1;
+					changed[probes[i].frontend_index] |= db_probe_verdict(ctx, &probes[i], 0, now);
+					continue;
 				}
+				probes[i].pending = 1;
+				pending++;
+				db_timer_add(&timers, &probes[i].timer, db_timer_ticks(&timers, probes[i].forwarder->check_timeout * 1000ULL));
+			}
+			next_round = now + db_timer_ticks(&timers, ctx->db_watchdog_interval * 1000000ULL);
+		}
+
+		for (size_t i = 0; i < ctx->frontends_count; i++)
+			if (unlikely(changed[i]))
+			{
+				db_backend_rebuild(&ctx->frontends[i]->backend);
+				changed[i] = 0;
 			}
 
-		int epoll_count = epoll_wait(epoll_fd, epoll_events, EPOLL_MAXEVENTS, ctx->db_watchdog_interval);
+		// Wake up on every tick while some probe is in flight
+		int timeout = (int)((next_round - now) * timer_resolution);
+		if (pending && timeout > (int)timer_resolution)
+			timeout = (int)timer_resolution;
+
+		int epoll_count = epoll_wait(epoll_fd, epoll_events, EPOLL_MAXEVENTS, timeout);
 		if (unlikely(epoll_count == -1))
 		{
 			// Ignore errors
@@ -173,13 +433,24 @@ void* db_watchdog(void* _data)
 		{
 			for (int i = 0; i < epoll_count; i++)
 			{
-				if (unlikely((epoll_events[i].events & EPOLLERR) ||
+				struct db_probe* current_probe = epoll_events[i].data.ptr;
+				if (likely(current_probe))
+				{
+					// Receiving clears pending socket error too
+					if (db_probe_receive(current_probe))
+					{
+						db_timer_del(&current_probe->timer);
+						current_probe->pending = 0;
+						pending--;
+						changed[current_probe->frontend_index] |= db_probe_verdict(ctx, current_probe, 1, db_timer_now(&timers));
+					}
+				} else if (unlikely((epoll_events[i].events & EPOLLERR) ||
 							(epoll_events[i].events & EPOLLHUP) ||
 							!(epoll_events[i].events & EPOLLIN)))
 				{
 					// Ignore hangup
 					continue;
-				} else if (likely(epoll_events[i].data.fd == ctx->watchdog_eventfd))
+				} else
 				{
 					// Shutdown
 					goto lfree;
@@ -189,13 +460,28 @@ void* db_watchdog(void* _data)
 	}
 
 lfree:
+	for (size_t i = 0; i < probes_count; i++)
+	{
+		if (probes[i].socket != -1)
+		{
+			if (unlikely(epoll_ctl(epoll_fd, EPOLL_CTL_DEL, probes[i].socket, NULL) == -1))
+				panic("epoll_ctl");
+			close(probes[i].socket);
+		}
+		if (probes[i].packet)
+			free(probes[i].packet);
+	}
+	pfcq_free(probes);
+	pfcq_free(changed);
+
 	if (unlikely(epoll_ctl(epoll_fd, EPOLL_CTL_DEL, ctx->watchdog_eventfd, NULL) == -1))
 		panic("epoll_ctl");
 	if (unlikely(close(ctx->watchdog_eventfd) == -1))
 		panic("close");
+	if (unlikely(close(epoll_fd) == -1))
+		panic("close");
 
 	pfpthq_dec(ctx->watchdog_pool);
 
 	return NULL;
 }
-
@@ -22,450 +22,833 @@
 #include <sys/eventfd.h>
 
 #include "acl.h"
+#include "batch.h"
+#include "pool.h"
+#include "query.h"
 #include "request.h"
 #include "stats.h"
+#include "timer.h"
 #include "types.h"
 #include "utils.h"
+#include "worker_uring.h"
+#include "worker_xdp.h"
 
 #include "worker.h"
 
-void* db_worker(void* _data)
+#define DB_EPOLL_KIND_EVENTFD		1ULL
+#define DB_EPOLL_KIND_SERVER		2ULL
+#define DB_EPOLL_KIND_XDP			3ULL
+#define DB_EPOLL_KIND_FORWARDER		4ULL
+#define DB_EPOLL_KIND_SHIFT			56
+#define DB_EPOLL_DATA(KIND, INDEX)	(((KIND) << DB_EPOLL_KIND_SHIFT) | (uint64_t)(INDEX))
+#define DB_EPOLL_KIND(DATA)			((DATA) >> DB_EPOLL_KIND_SHIFT)
+#define DB_EPOLL_INDEX(DATA)		((DATA) & ((1ULL << DB_EPOLL_KIND_SHIFT) - 1))
+
+static socklen_t db_worker_address_length(sa_family_t _layer3)
 {
-	struct db_worker* data = _data;
-	struct db_frontend* frontend = data->frontend;
-	int option = 1;
-	int epoll_fd = -1;
-	int epoll_count = -1;
-	int server = -1;
-	int forwarders[frontend->backend.forwarders_count];
-	pfcq_fprng_context_t fprng_context;
-	struct epoll_event epoll_event;
-	struct epoll_event epoll_events[EPOLL_MAXEVENTS];
+	switch (_layer3)
+	{
+		case PF_INET:
+			return (socklen_t)sizeof(struct sockaddr_in);
+		case PF_INET6:
+			return (socklen_t)sizeof(struct sockaddr_in6);
+		default:
+			panic("socket domain");
+			break;
+	}
+}
 
-	pfcq_zero(forwarders, frontend->backend.forwarders_count * sizeof(int));
-	pfcq_fprng_init(&fprng_context);
-	pfcq_zero(&epoll_event, sizeof(struct epoll_event));
-	pfcq_zero(&epoll_events, EPOLL_MAXEVENTS * sizeof(struct epoll_event));
+// Accounts sent batch and empties it; target 0 is the client batch, forwarders follow
+size_t db_worker_sent(struct db_worker* _worker, size_t _target, struct db_batch* _batch)
+{
+	size_t ret = _batch->count;
 
-	server = socket(frontend->layer3, SOCK_DGRAM, IPPROTO_UDP);
-	if (unlikely(server == -1))
+	if (_target)
 	{
-		fail("socket");
-		stop("Unable to create listener socket");
+		// Forwarder-bound packets
+		for (size_t j = 0; j < _batch->count; j++)
+			if (likely(_batch->headers[j].msg_len))
+				db_stats_forwarder_in(_worker, _target - 1, _batch->headers[j].msg_len);
+	} else
+	{
+		// Client-bound packets
+		for (size_t j = 0; j < _batch->count; j++)
+			if (likely(_batch->headers[j].msg_len && _batch->accounted[j]))
+				db_stats_frontend_out(_worker, _batch->headers[j].msg_len, db_query_rcode(db_batch_packet(_batch, j)));
 	}
-	if (unlikely(setsockopt(server, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, (const void*)&option, sizeof(option)) == -1))
-		panic("setsockopt");
-	switch (frontend->layer3)
+	_batch->count = 0;
+
+	return ret;
+}
+
+void db_worker_flush(struct db_worker* _worker)
+{
+	struct db_frontend* frontend = _worker->frontend;
+	size_t batches = 0;
+	size_t pkts = 0;
+
+	switch (frontend->io_engine)
 	{
-		case PF_INET:
+		case DB_IO_ENGINE_EPOLL:
+			for (size_t i = 0; i < frontend->backend.forwarders_count; i++)
+				if (_worker->forwarders[i].tx.count)
+					batches += db_batch_send(&_worker->forwarders[i].tx, _worker->forwarders[i].socket);
+			if (_worker->server_tx.count)
+				batches += db_batch_send(&_worker->server_tx, _worker->server);
 			break;
-		case PF_INET6:
-			if (unlikely(setsockopt(server, IPPROTO_IPV6, IPV6_V6ONLY, (const void*)&option, sizeof(option)) == -1))
-				panic("setsockopt");
+#ifdef DB_HAVE_LIBURING
+		case DB_IO_ENGINE_URING:
+			batches = db_worker_uring_send(_worker);
 			break;
+#endif /* DB_HAVE_LIBURING */
+#ifdef DB_HAVE_XDP
+		case DB_IO_ENGINE_XDP:
+			for (size_t i = 0; i < frontend->backend.forwarders_count; i++)
+				if (_worker->forwarders[i].tx.count)
+					batches += db_batch_send(&_worker->forwarders[i].tx, _worker->forwarders[i].socket);
+			if (_worker->server_tx.count)
+				batches += db_worker_xdp_send(_worker);
+			break;
+#endif /* DB_HAVE_XDP */
 		default:
-			panic("socket domain");
+			panic("Unknown I/O engine");
 			break;
 	}
-	int bind_res = -1;
-	switch (frontend->layer3)
+
+	for (size_t i = 0; i < frontend->backend.forwarders_count; i++)
+		pkts += db_worker_sent(_worker, i + 1, &_worker->forwarders[i].tx);
+	pkts += db_worker_sent(_worker, 0, &_worker->server_tx);
+
+	if (batches)
+		db_stats_batch_tx(_worker, batches, pkts);
+
+	return;
+}
+
+static uint8_t* db_worker_push_client(struct db_worker* _worker, const uint8_t* _data, size_t _length,
+	const pfcq_net_address_t* _address, unsigned short int _accounted)
+{
+	if (unlikely(db_batch_full(&_worker->server_tx)))
+		db_worker_flush(_worker);
+
+	return db_batch_push(&_worker->server_tx, _data, _length, _address,
+		db_worker_address_length(_worker->frontend->layer3), _accounted);
+}
+
+static uint8_t* db_worker_push_forwarder(struct db_worker* _worker, size_t _forwarder_index, const uint8_t* _data, size_t _length)
+{
+	if (unlikely(db_batch_full(&_worker->forwarders[_forwarder_index].tx)))
+		db_worker_flush(_worker);
+
+	return db_batch_push(&_worker->forwarders[_forwarder_index].tx, _data, _length, NULL, 0, 1);
+}
+
+// Records carry timeout state if client is answered on timeout, request outlives upstream timeout or may be retried
+static int db_worker_tracks_timeouts(const struct db_worker* _worker)
+{
+	return _worker->frontend->g_ctx->servfail_on_timeout || _worker->upstream_timeout < _worker->request_ttl ||
+		_worker->frontend->backend.max_retries;
+}
+
+// Attempt waits for retry deadline while it may be retried, then for upstream timeout
+static uint64_t db_worker_attempt_ticks(const struct db_worker* _worker, const struct db_request_timeout* _timeout)
+{
+	uint32_t remaining = _timeout->deadline - (uint32_t)_worker->timers.tick;
+
+	if (_timeout->retries < _worker->frontend->backend.max_retries && _timeout->query_length && _worker->retry_timeout < remaining)
+		return _worker->retry_timeout;
+
+	return remaining;
+}
+
+// Attempt stops counting against forwarder load once it is answered, handed over or timed out,
+// even though its ID is held till TTL
+static void db_worker_settle_attempt(struct db_worker* _worker, struct db_request* _request)
+{
+	struct db_request_timeout* timeout = db_request_timeout(_request);
+
+	if (!timeout->expired && !timeout->answered && !timeout->superseded)
+		db_settle_request(&_worker->requests, _request);
+
+	return;
+}
+
+// Attempts of the same client query are linked into a ring
+static void db_worker_unlink_attempt(struct db_request* _request)
+{
+	struct db_request* current_request = _request;
+
+	while (db_request_timeout(current_request)->next_attempt != _request)
+		current_request = db_request_timeout(current_request)->next_attempt;
+	db_request_timeout(current_request)->next_attempt = db_request_timeout(_request)->next_attempt;
+
+	return;
+}
+
+static void db_worker_answer_local(struct db_worker* _worker, const uint8_t* _buffer, size_t _question_end,
+	const pfcq_net_address_t* _address, ldns_pkt_rcode _rcode, const uint8_t* _answer, size_t _answer_length)
+{
+	// Build response right in the client batch slot
+	uint8_t* response = db_worker_push_client(_worker, NULL, _question_end + _answer_length, _address, 0);
+	if (unlikely(!response))
+		return;
+
+	// Header and question are taken from the query, then QR/RA and rcode are set, opcode and RD are kept
+	memcpy(response, _buffer, _question_end);
+	response[2] = (uint8_t)(0x80 | (_buffer[2] & 0x79));
+	response[3] = (uint8_t)(0x80 | _rcode);
+	response[6] = 0;
+	response[7] = (uint8_t)(_answer_length ? 1 : 0);
+	pfcq_zero(response + 8, 4);
+	if (_answer_length)
+		memcpy(response + _question_end, _answer, _answer_length);
+
+	return;
+}
+
+static void db_worker_overflow(struct db_worker* _worker, const uint8_t* _buffer, const struct db_query* _query, const pfcq_net_address_t* _address)
+{
+	db_stats_frontend_overflow(_worker);
+
+	switch (_worker->frontend->backend.overflow_action)
 	{
-		case PF_INET:
-			bind_res = bind(server, (struct sockaddr*)&frontend->address.address4, sizeof(struct sockaddr_in));
+		case DB_OVERFLOW_SERVFAIL:
+			db_worker_answer_local(_worker, _buffer, _query->question_end, _address, LDNS_RCODE_SERVFAIL, NULL, 0);
 			break;
-		case PF_INET6:
-			bind_res = bind(server, (struct sockaddr*)&frontend->address.address6, sizeof(struct sockaddr_in6));
+		case DB_OVERFLOW_REFUSED:
+			db_worker_answer_local(_worker, _buffer, _query->question_end, _address, LDNS_RCODE_REFUSED, NULL, 0);
+			break;
+		case DB_OVERFLOW_DROP:
 			break;
 		default:
+			panic("Unknown overflow action");
 			break;
 	}
-	if (unlikely(bind_res == -1))
+
+	return;
+}
+
+void db_worker_handle_query(struct db_worker* _worker, uint8_t* _buffer, size_t _length, pfcq_net_address_t _address)
+{
+	struct db_frontend* frontend = _worker->frontend;
+	struct db_query query;
+
+	db_stats_frontend_in(_worker, _length);
+
+	// Validate header and question in place
+	if (unlikely(db_query_parse(_buffer, _length, &query) == -1 || query.response))
 	{
-		fail("bind");
-		stop("Unable to bind to listener socket.");
+		db_stats_frontend_in_invalid(_worker, _length);
+		return;
 	}
 
-	// Will query forwarders from fixed UDP sockets (not to pollute Linux conntrack table)
-	for (size_t i = 0; i < frontend->backend.forwarders_count; i++)
+	// Find alive forwarder, question is needed for qname hashing
+	ssize_t forwarder_index = db_find_alive_forwarder(_worker, _address, &query);
+	if (unlikely(forwarder_index == -1))
+		return;
+
+	// Check query against ACL
+	void* acl_data = NULL;
+	size_t acl_data_length = 0;
+	ssize_t acl_index = -1;
+	enum db_acl_action acl_action = db_check_query_acl(frontend->layer3, &_address, &query, &frontend->acl, &acl_data, &acl_data_length, &acl_index);
+	if (acl_index != -1)
+		db_stats_acl_hit(_worker, (size_t)acl_index);
+	switch (acl_action)
 	{
-		forwarders[i] = socket(frontend->backend.forwarders[i]->layer3, SOCK_DGRAM, IPPROTO_UDP);
-		if (unlikely(forwarders[i] == -1))
-			panic("socket");
-		int connect_res = -1;
-		switch (frontend->backend.forwarders[i]->layer3)
+		case DB_ACL_ACTION_ALLOW:
 		{
-			case PF_INET:
-				connect_res = connect(forwarders[i], (const struct sockaddr*)&frontend->backend.forwarders[i]->address.address4, (socklen_t)sizeof(struct sockaddr_in));
-				break;
-			case PF_INET6:
-				connect_res = connect(forwarders[i], (const struct sockaddr*)&frontend->backend.forwarders[i]->address.address6, (socklen_t)sizeof(struct sockaddr_in6));
+			// Respect per-worker in-flight caps of forwarders
+			ssize_t spill_index = db_spill_forwarder(_worker, (size_t)forwarder_index);
+			if (unlikely(spill_index != forwarder_index))
+			{
+				db_stats_forwarder_spill(_worker, (size_t)forwarder_index);
+				if (unlikely(spill_index == -1))
+				{
+					db_worker_overflow(_worker, _buffer, &query, &_address);
+					break;
+				}
+				forwarder_index = spill_index;
+			}
+
+			// Put all info about new request into request table
+			struct db_request* new_request = db_make_request(&_worker->request_pool, &query, &_address, forwarder_index);
+			// Request pool is at its limit, drop the query (counted by pool)
+			if (unlikely(!new_request))
 				break;
-			default:
-				panic("socket domain");
+			// Get new request ID unique for forwarder socket
+			if (unlikely(db_insert_request(&_worker->requests, new_request) == -1))
+			{
+				db_stats_forwarder_ids_exhausted(_worker, forwarder_index);
+				db_pool_free(&_worker->request_pool, new_request);
 				break;
+			}
+			if (db_worker_tracks_timeouts(_worker))
+			{
+				// Keep the query to answer the client by ourselves or to resend it if forwarder is late
+				struct db_request_timeout* timeout = db_request_timeout(new_request);
+				pfcq_zero(timeout, sizeof(struct db_request_timeout));
+				timeout->next_attempt = new_request;
+				timeout->deadline = (uint32_t)(_worker->timers.tick + _worker->upstream_timeout);
+				timeout->reclaim = (uint32_t)(_worker->timers.tick + _worker->request_ttl);
+				if (_length <= _worker->request_copy_length)
+				{
+					memcpy(timeout->query, _buffer, _length);
+					timeout->question_length = (uint16_t)query.question_end;
+					timeout->query_length = (uint16_t)_length;
+				} else if (query.question_end <= _worker->request_copy_length)
+				{
+					memcpy(timeout->query, _buffer, query.question_end);
+					timeout->question_length = (uint16_t)query.question_end;
+				}
+				db_timer_add(&_worker->timers, &new_request->timer, db_worker_attempt_ticks(_worker, timeout));
+			} else
+				db_timer_add(&_worker->timers, &new_request->timer, _worker->upstream_timeout);
+
+			// Substitute new ID to client DNS query
+			uint16_t id_nbo = htons(new_request->id);
+			memcpy(_buffer, &id_nbo, sizeof(uint16_t));
+
+			// Queue new request to forwarder
+			db_worker_push_forwarder(_worker, forwarder_index, _buffer, _length);
+			break;
 		}
-		if (unlikely(connect_res == -1))
-			panic("connect");
+		case DB_ACL_ACTION_DENY:
+			// Silently drop request, do nothing
+			break;
+		case DB_ACL_ACTION_NXDOMAIN:
+			db_worker_answer_local(_worker, _buffer, query.question_end, &_address, LDNS_RCODE_NXDOMAIN, NULL, 0);
+			break;
+		case DB_ACL_ACTION_SET_A:
+		{
+			const struct db_set_a* set_a = acl_data;
+			db_worker_answer_local(_worker, _buffer, query.question_end, &_address, LDNS_RCODE_NOERROR, set_a->answer, DB_SET_A_ANSWER_LENGTH);
+			break;
+		}
+		default:
+			panic("Unknown ACL action occurred");
+			break;
+	}
+
+	return;
+}
+
+void db_worker_handle_answer(struct db_worker* _worker, size_t _forwarder_index, uint8_t* _buffer, size_t _length)
+{
+	struct db_frontend* frontend = _worker->frontend;
+	struct db_query answer;
+
+	// Only header and question are checked, the rest of answer is relayed as is
+	if (unlikely(db_query_parse(_buffer, _length, &answer) == -1 || !answer.response))
+	{
+		db_stats_forwarder_out_invalid(_worker, _forwarder_index, _length);
+		return;
+	}
+
+	// Select request from request table, question is matched against fingerprint of stored query
+	struct db_request* found_request = db_eject_request(&_worker->requests, _forwarder_index, answer.id, db_request_fingerprint(&answer));
+	if (unlikely(!found_request))
+	{
+		db_stats_forwarder_out_invalid(_worker, _forwarder_index, _length);
+		return;
+	}
+
+	if (db_worker_tracks_timeouts(_worker))
+	{
+		struct db_request_timeout* timeout = db_request_timeout(found_request);
+		db_worker_settle_attempt(_worker, found_request);
+		db_worker_unlink_attempt(found_request);
+
+		// Client has got an answer or SERVFAIL already, late one only frees request ID
+		if (unlikely(timeout->answered || (timeout->expired && frontend->g_ctx->servfail_on_timeout)))
+		{
+			db_stats_forwarder_out(_worker, _forwarder_index, _length, db_query_rcode(_buffer));
+			db_pool_free(&_worker->request_pool, found_request);
+			return;
+		}
+
+		// The first answer wins, other attempts wait for theirs to be discarded
+		for (struct db_request* attempt = timeout->next_attempt; attempt != found_request; attempt = db_request_timeout(attempt)->next_attempt)
+		{
+			db_worker_settle_attempt(_worker, attempt);
+			db_request_timeout(attempt)->answered = 1;
+		}
+	} else
+		db_settle_request(&_worker->requests, found_request);
+
+	// Substitute original request ID to response
+	uint16_t id_nbo = htons(found_request->original_id);
+	memcpy(_buffer, &id_nbo, sizeof(uint16_t));
+
+	db_stats_forwarder_out(_worker, _forwarder_index, _length, db_query_rcode(_buffer));
+	// Queue answer to client
+	pfcq_net_address_t client_address;
+	db_request_client_address(found_request, frontend->layer3, &client_address);
+	db_worker_push_client(_worker, _buffer, _length, &client_address, 1);
+	uint64_t now = db_request_clock();
+	uint32_t rtt = (uint32_t)now - found_request->ctime;
+	db_stats_latency_update(_worker, rtt);
+	db_peak_ewma_update(&_worker->forwarders[_forwarder_index], now, rtt);
+	db_pool_free(&_worker->request_pool, found_request);
+
+	return;
+}
+
+static int db_worker_retry(struct db_worker* _worker, struct db_request* _request)
+{
+	struct db_backend* backend = &_worker->frontend->backend;
+	struct db_request_timeout* timeout = db_request_timeout(_request);
+	struct db_query query;
+	pfcq_net_address_t client_address;
+
+	if (unlikely(db_query_parse(timeout->query, timeout->query_length, &query) == -1))
+		return -1;
+
+	// Backend mode chooses the forwarder, but it must differ from the silent one
+	db_request_client_address(_request, _worker->frontend->layer3, &client_address);
+	ssize_t forwarder_index = db_find_alive_forwarder(_worker, client_address, &query);
+	if (unlikely(forwarder_index == -1))
+		return -1;
+	for (size_t tries = 1; forwarder_index == _request->forwarder_index && tries < backend->forwarders_count; tries++)
+	{
+		size_t index = (_request->forwarder_index + tries) % backend->forwarders_count;
+		if (backend->forwarders[index]->active)
+			forwarder_index = (ssize_t)index;
+	}
+	if (forwarder_index != _request->forwarder_index)
+		forwarder_index = db_spill_forwarder(_worker, (size_t)forwarder_index);
+	if (unlikely(forwarder_index == -1 || forwarder_index == _request->forwarder_index))
+		return -1;
+
+	// New attempt is a copy of the record that gets fresh ID from another forwarder
+	struct db_request* new_request = db_pool_alloc(&_worker->request_pool);
+	if (unlikely(!new_request))
+		return -1;
+	memcpy(new_request, _request, sizeof(struct db_request) + sizeof(struct db_request_timeout) + timeout->query_length);
+	new_request->forwarder_index = (uint16_t)forwarder_index;
+	new_request->ctime = (uint32_t)db_request_clock();
+	if (unlikely(db_insert_request(&_worker->requests, new_request) == -1))
+	{
+		db_stats_forwarder_ids_exhausted(_worker, (size_t)forwarder_index);
+		db_pool_free(&_worker->request_pool, new_request);
+		return -1;
+	}
+	struct db_request_timeout* new_timeout = db_request_timeout(new_request);
+	new_timeout->retries++;
+	timeout->next_attempt = new_request;
+	db_timer_add(&_worker->timers, &new_request->timer, db_worker_attempt_ticks(_worker, new_timeout));
+
+	db_stats_forwarder_retry(_worker, _request->forwarder_index);
+
+	// Queue the original query with new ID to another forwarder
+	uint8_t* packet = db_worker_push_forwarder(_worker, (size_t)forwarder_index, timeout->query, timeout->query_length);
+	if (likely(packet))
+	{
+		uint16_t id_nbo = htons(new_request->id);
+		memcpy(packet, &id_nbo, sizeof(uint16_t));
+	}
+
+	return 0;
+}
+
+static void db_worker_expire(struct db_worker* _worker, struct db_timer* _expired)
+{
+	while (_expired)
+	{
+		struct db_timer* next_timer = _expired->next;
+		// Timer is the first member of request
+		struct db_request* expired_request = (struct db_request*)_expired;
+		_expired = next_timer;
+
+		if (!db_worker_tracks_timeouts(_worker))
+		{
+			db_stats_forwarder_timeout(_worker, expired_request->forwarder_index);
+			db_settle_request(&_worker->requests, expired_request);
+			db_expire_request(&_worker->requests, expired_request);
+			db_pool_free(&_worker->request_pool, expired_request);
+			continue;
+		}
+
+		struct db_request_timeout* timeout = db_request_timeout(expired_request);
+		uint32_t now = (uint32_t)_worker->timers.tick;
+
+		// Client query is settled or handed over to newer attempt, so request ID is only held till TTL
+		// not to take late answer for a newer query
+		if (timeout->expired || timeout->answered || timeout->superseded)
+		{
+			if ((int32_t)(timeout->reclaim - now) > 0)
+			{
+				db_timer_add(&_worker->timers, &expired_request->timer, timeout->reclaim - now);
+				continue;
+			}
+			db_worker_unlink_attempt(expired_request);
+			db_expire_request(&_worker->requests, expired_request);
+			db_pool_free(&_worker->request_pool, expired_request);
+			continue;
+		}
+
+		// No answer by retry deadline, resend the query elsewhere
+		if ((int32_t)(timeout->deadline - now) > 0)
+		{
+			if (likely(db_worker_retry(_worker, expired_request) == 0))
+			{
+				db_worker_settle_attempt(_worker, expired_request);
+				timeout->superseded = 1;
+			} else
+				timeout->retries = (uint16_t)_worker->frontend->backend.max_retries;
+			db_timer_add(&_worker->timers, &expired_request->timer,
+				timeout->superseded ? timeout->reclaim - now : db_worker_attempt_ticks(_worker, timeout));
+			continue;
+		}
+
+		db_stats_forwarder_timeout(_worker, expired_request->forwarder_index);
+		for (struct db_request* attempt = timeout->next_attempt; attempt != expired_request; attempt = db_request_timeout(attempt)->next_attempt)
+		{
+			db_worker_settle_attempt(_worker, attempt);
+			db_request_timeout(attempt)->expired = 1;
+		}
+		db_worker_settle_attempt(_worker, expired_request);
+		timeout->expired = 1;
+
+		// Answer the client right away instead of letting it retry on its own timer
+		if (_worker->frontend->g_ctx->servfail_on_timeout && timeout->question_length)
+		{
+			pfcq_net_address_t client_address;
+			db_request_client_address(expired_request, _worker->frontend->layer3, &client_address);
+			db_worker_answer_local(_worker, timeout->query, timeout->question_length, &client_address, LDNS_RCODE_SERVFAIL, NULL, 0);
+		}
+
+		if ((int32_t)(timeout->reclaim - now) > 0)
+		{
+			db_timer_add(&_worker->timers, &expired_request->timer, timeout->reclaim - now);
+			continue;
+		}
+
+		db_worker_unlink_attempt(expired_request);
+		db_expire_request(&_worker->requests, expired_request);
+		db_pool_free(&_worker->request_pool, expired_request);
 	}
 
+	return;
+}
+
+void db_worker_tick(struct db_worker* _worker)
+{
+	// Expire requests that were not answered within TTL, and bring the wheel up to date,
+	// so that deadlines of new requests do not count from before the worker went idle
+	db_worker_expire(_worker, db_timer_advance(&_worker->timers, db_timer_now(&_worker->timers)));
+
+	return;
+}
+
+int db_worker_timers(struct db_worker* _worker)
+{
+	struct db_global_context* g_ctx = _worker->frontend->g_ctx;
+
+	db_worker_tick(_worker);
+
+	// Nothing to wait for
+	if (!_worker->requests.count)
+		return _worker->server == -1 ? 0 : -1;
+
+	// Time to sleep until next tick
+	if (unlikely(_worker->server == -1 && g_ctx->reload_retry < g_ctx->timer_resolution))
+		return (int)g_ctx->reload_retry;
+
+	return (int)g_ctx->timer_resolution;
+}
+
+int db_worker_drained(struct db_worker* _worker)
+{
+	return _worker->requests.count == 0;
+}
+
+static void db_worker_epoll(struct db_worker* _worker)
+{
+	struct db_frontend* frontend = _worker->frontend;
+	int epoll_fd = -1;
+	int epoll_count = -1;
+#ifdef DB_HAVE_XDP
+	int xdp_fd = -1;
+#endif /* DB_HAVE_XDP */
+	struct epoll_event epoll_event;
+	struct epoll_event epoll_events[EPOLL_MAXEVENTS];
+
+	pfcq_zero(&epoll_event, sizeof(struct epoll_event));
+	pfcq_zero(&epoll_events, EPOLL_MAXEVENTS * sizeof(struct epoll_event));
+
 	epoll_fd = epoll_create1(0);
 	if (unlikely(epoll_fd == -1))
 		panic("epoll_create");
-	epoll_event.data.fd = data->eventfd;
+	// Event carries its kind and forwarder index, so no lookup by fd is needed
+	epoll_event.data.u64 = DB_EPOLL_DATA(DB_EPOLL_KIND_EVENTFD, 0);
 	epoll_event.events = EPOLLIN;
-	if (unlikely(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, data->eventfd, &epoll_event) == -1))
+	if (unlikely(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, _worker->eventfd, &epoll_event) == -1))
 		panic("epoll_ctl");
-	epoll_event.data.fd = server;
+	epoll_event.data.u64 = DB_EPOLL_DATA(DB_EPOLL_KIND_SERVER, 0);
 	epoll_event.events = EPOLLIN;
-	if (unlikely(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server, &epoll_event) == -1))
+	if (unlikely(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, _worker->server, &epoll_event) == -1))
 		panic("epoll_ctl");
+#ifdef DB_HAVE_XDP
+	if (_worker->xdp)
+	{
+		xdp_fd = db_worker_xdp_fd(_worker);
+		epoll_event.data.u64 = DB_EPOLL_DATA(DB_EPOLL_KIND_XDP, 0);
+		epoll_event.events = EPOLLIN;
+		if (unlikely(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, xdp_fd, &epoll_event) == -1))
+			panic("epoll_ctl");
+	}
+#endif /* DB_HAVE_XDP */
 	for (size_t i = 0; i < frontend->backend.forwarders_count; i++)
 	{
-		epoll_event.data.fd = forwarders[i];
+		epoll_event.data.u64 = DB_EPOLL_DATA(DB_EPOLL_KIND_FORWARDER, i);
 		epoll_event.events = EPOLLIN;
-		if (unlikely(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, forwarders[i], &epoll_event) == -1))
+		if (unlikely(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, _worker->forwarders[i].socket, &epoll_event) == -1))
 			panic("epoll_ctl");
 	}
 
-	int epoll_timeout = -1;
 	for (;;)
 	{
-		epoll_count = epoll_wait(epoll_fd, epoll_events, EPOLL_MAXEVENTS, epoll_timeout);
+		// Shutdown
+		if (unlikely(_worker->server == -1 && db_worker_drained(_worker)))
+			break;
+
+		epoll_count = epoll_wait(epoll_fd, epoll_events, EPOLL_MAXEVENTS, db_worker_timers(_worker));
 		if (unlikely(epoll_count == -1))
 		{
 			// Ignore errors
 			continue;
-		} else if (unlikely(epoll_count == 0))
-		{
-			// Shutdown
-			size_t requests_count = 0;
-			if (unlikely(pthread_spin_lock(&frontend->g_ctx->db_requests.requests_count_lock)))
-				panic("pthread_spin_lock");
-			requests_count = frontend->g_ctx->db_requests.requests_count;
-			if (unlikely(pthread_spin_unlock(&frontend->g_ctx->db_requests.requests_count_lock)))
-				panic("pthread_spin_unlock");
-
-			if (likely(requests_count > 0))
-			{
-				continue;
-			} else
-				goto lfree;
 		} else
 		{
+			// Wait might have been unbounded
+			db_worker_tick(_worker);
+
 			for (int i = 0; i < epoll_count; i++)
 			{
+				uint64_t kind = DB_EPOLL_KIND(epoll_events[i].data.u64);
+
 				if (unlikely((epoll_events[i].events & EPOLLERR) ||
 							(epoll_events[i].events & EPOLLHUP) ||
 							!(epoll_events[i].events & EPOLLIN)))
 				{
 					// Ignore hangup
 					continue;
-				} else if (unlikely(epoll_events[i].data.fd == data->eventfd))
+				} else if (unlikely(kind == DB_EPOLL_KIND_EVENTFD))
 				{
 					// Consume sent value
 					__attribute__((unused)) eventfd_t value;
-					eventfd_read(data->eventfd, &value);
+					eventfd_read(_worker->eventfd, &value);
 
-					if (unlikely(epoll_ctl(epoll_fd, EPOLL_CTL_DEL, data->eventfd, NULL) == -1))
+					if (unlikely(epoll_ctl(epoll_fd, EPOLL_CTL_DEL, _worker->eventfd, NULL) == -1))
 						panic("epoll_ctl");
-					if (unlikely(close(data->eventfd) == -1))
+					if (unlikely(close(_worker->eventfd) == -1))
 						panic("close");
 
 					// Stop receiving new requests
-					if (unlikely(epoll_ctl(epoll_fd, EPOLL_CTL_DEL, server, NULL) == -1))
+					if (unlikely(epoll_ctl(epoll_fd, EPOLL_CTL_DEL, _worker->server, NULL) == -1))
 						panic("epoll_ctl");
-					if (unlikely(close(server) == -1))
+					if (unlikely(close(_worker->server) == -1))
 						panic("close");
+					_worker->server = -1;
+#ifdef DB_HAVE_XDP
+					if (xdp_fd != -1)
+					{
+						if (unlikely(epoll_ctl(epoll_fd, EPOLL_CTL_DEL, xdp_fd, NULL) == -1))
+							panic("epoll_ctl");
+						db_worker_xdp_stop(_worker);
+						xdp_fd = -1;
+					}
+#endif /* DB_HAVE_XDP */
 
 					// But serve remaining requests
-					epoll_timeout = frontend->g_ctx->reload_retry;
-
 					continue;
-				} else if (likely(epoll_events[i].data.fd == server))
+				} else if (likely(kind == DB_EPOLL_KIND_SERVER))
 				{
-					// Accept request from client
-					uint8_t server_buffer[frontend->dns_max_packet_length];
-					pfcq_net_address_t address;
-					socklen_t client_address_length;
-					ssize_t query_size = -1;
-					switch (frontend->layer3)
-					{
-						case PF_INET:
-							client_address_length = (socklen_t)sizeof(struct sockaddr_in);
-							query_size = recvfrom(server, server_buffer, frontend->dns_max_packet_length, 0,
-									(struct sockaddr*)&address.address4, &client_address_length);
-							break;
-						case PF_INET6:
-							client_address_length = (socklen_t)sizeof(struct sockaddr_in6);
-							query_size = recvfrom(server, server_buffer, frontend->dns_max_packet_length, 0,
-									(struct sockaddr*)&address.address6, &client_address_length);
-							break;
-						default:
-							panic("socket domain");
-							break;
-					}
-					if (unlikely(query_size == -1))
+					// Listener might have been closed by shutdown event of the same batch
+					if (unlikely(_worker->server == -1))
 						continue;
-
-					db_stats_frontend_in(frontend, query_size);
-
-					// Find alive forwarder
-					ssize_t forwarder_index = db_find_alive_forwarder(frontend, &fprng_context, address);
-					if (unlikely(forwarder_index == -1))
+					// Accept requests from clients
+					if (unlikely(db_batch_recv(&_worker->server_rx, _worker->server) == -1))
 						continue;
+					db_stats_batch_rx(_worker, 1, _worker->server_rx.count);
 
-					// Parse request into LDNS structure
-					ldns_pkt* client_query_packet = NULL;
-					if (unlikely(ldns_wire2pkt(&client_query_packet, server_buffer, query_size) != LDNS_STATUS_OK))
-					{
-						db_stats_frontend_in_invalid(frontend, query_size);
-						continue;
-					}
-					if (unlikely(ldns_pkt_qdcount(client_query_packet) != 1))
-					{
-						db_stats_frontend_in_invalid(frontend, query_size);
-						ldns_pkt_free(client_query_packet);
+					for (size_t j = 0; j < _worker->server_rx.count; j++)
+						db_worker_handle_query(_worker, db_batch_packet(&_worker->server_rx, j),
+							_worker->server_rx.headers[j].msg_len, _worker->server_rx.addresses[j]);
+#ifdef DB_HAVE_XDP
+				} else if (kind == DB_EPOLL_KIND_XDP)
+				{
+					if (unlikely(xdp_fd == -1))
 						continue;
-					}
-					ldns_rr_list* client_queries = ldns_pkt_question(client_query_packet);
-					size_t client_queries_count = ldns_rr_list_rr_count(client_queries);
-					for (size_t j = 0; j < client_queries_count; j++)
-					{
-						ldns_rr* client_query = ldns_rr_list_rr(client_queries, j);
-						if (likely(ldns_rr_is_question(client_query)))
-						{
-							// Extract query info
-							struct db_request_data request_data = db_make_request_data(client_query_packet, forwarders[forwarder_index]);
-
-							// Check query against ACL
-							void* acl_data = NULL;
-							size_t acl_data_length = 0;
-							switch (db_check_query_acl(frontend->layer3, &address, &request_data, &frontend->acl, &acl_data, &acl_data_length))
-							{
-								case DB_ACL_ACTION_ALLOW:
-								{
-									// Put all info about new request into request table
-									struct db_request* new_request = db_make_request(client_query_packet, request_data, address, forwarder_index);
-									// Get new request ID
-									uint16_t new_id = db_insert_request(&frontend->g_ctx->db_requests, new_request);
-
-									// Substitute new ID to client DNS query
-									uint16_t id_nbo = htons(new_id);
-									memcpy(server_buffer, &id_nbo, sizeof(uint16_t));
-
-									// Forward new request to forwarder
-									ssize_t send_res = send(forwarders[forwarder_index], server_buffer, query_size, 0);
-									if (likely(send_res != -1))
-										db_stats_forwarder_in(frontend->backend.forwarders[forwarder_index], send_res);
-									break;
-								}
-								case DB_ACL_ACTION_DENY:
-									// Silently drop request, do nothing
-									break;
-								case DB_ACL_ACTION_NXDOMAIN:
-								{
-									// Create NXDOMAIN response packet
-									ldns_pkt* nxdomain_packet = ldns_pkt_new();
-
-									ldns_pkt_set_id(nxdomain_packet, ldns_pkt_id(client_query_packet));
-									ldns_pkt_set_qr(nxdomain_packet, 1);
-									ldns_pkt_set_rd(nxdomain_packet, 1);
-									ldns_pkt_set_ra(nxdomain_packet, 1);
-									ldns_pkt_set_opcode(nxdomain_packet, LDNS_PACKET_QUERY);
-									ldns_pkt_set_rcode(nxdomain_packet, LDNS_RCODE_NXDOMAIN);
-
-									// Dup queries into NXDOMAIN response
-									ldns_rr_list* nxdomain_rr_list = ldns_rr_list_clone(client_queries);
-									ldns_pkt_push_rr_list(nxdomain_packet, LDNS_SECTION_QUESTION, nxdomain_rr_list);
-
-									// Send NXDOMAIN to client
-									uint8_t* nxdomain_buffer = NULL;
-									size_t nxdomain_buffer_size;
-									ldns_pkt2wire(&nxdomain_buffer, nxdomain_packet, &nxdomain_buffer_size);
-									switch (frontend->layer3)
-									{
-										case PF_INET:
-											sendto(server, nxdomain_buffer, nxdomain_buffer_size, 0,
-													(const struct sockaddr*)&address.address4, (socklen_t)sizeof(struct sockaddr_in));
-											break;
-										case PF_INET6:
-											sendto(server, nxdomain_buffer, nxdomain_buffer_size, 0,
-													(const struct sockaddr*)&address.address6, (socklen_t)sizeof(struct sockaddr_in6));
-											break;
-										default:
-											panic("socket domain");
-											break;
-									}
-
-									ldns_rr_list_free(nxdomain_rr_list);
-									ldns_pkt_free(nxdomain_packet);
-									pfcq_zero(nxdomain_buffer, nxdomain_buffer_size);
-									free(nxdomain_buffer);
-									nxdomain_buffer = NULL;
-									break;
-								}
-								case DB_ACL_ACTION_SET_A:
-								{
-									// Create A response packet
-									ldns_pkt* a_packet = ldns_pkt_new();
-
-									ldns_pkt_set_id(a_packet, ldns_pkt_id(client_query_packet));
-									ldns_pkt_set_qr(a_packet, 1);
-									ldns_pkt_set_rd(a_packet, 1);
-									ldns_pkt_set_ra(a_packet, 1);
-									ldns_pkt_set_opcode(a_packet, LDNS_PACKET_QUERY);
-									ldns_pkt_set_rcode(a_packet, LDNS_RCODE_NOERROR);
-
-									// Dup queries into A response
-									ldns_rr_list* q_rr_list = ldns_rr_list_clone(client_queries);
-									ldns_pkt_push_rr_list(a_packet, LDNS_SECTION_QUESTION, q_rr_list);
-
-									// Put answer into A response
-									ldns_rr_list* a_rr_list = ldns_rr_list_new();
-									ldns_rr* a_rr = NULL;
-
-									// Get request FQDN
-									ldns_rdf* a_fqdn_rdf = ldns_rr_owner(ldns_rr_list_rr(ldns_pkt_question(client_query_packet), 0));
-									ldns_dname2canonical(a_fqdn_rdf);
-									char* a_fqdn = ldns_rdf2str(a_fqdn_rdf);
-
-									// Get substitution IP from ACL
-									struct db_set_a* set_a_params = acl_data;
-
-									char a_str[INET_ADDRSTRLEN];
-									pfcq_zero(a_str, INET_ADDRSTRLEN);
-									inet_ntop(AF_INET, &set_a_params->address4, a_str, INET_ADDRSTRLEN);
-
-									// Create response resource record
-									char* response_string = pfcq_mstring("%s %u IN A %s", a_fqdn, set_a_params->ttl, a_str);
-									ldns_rr_new_frm_str(&a_rr, response_string, 0, NULL, NULL);
-									pfcq_free(response_string);
-									free(a_fqdn);
-
-									// Put A RR to answer packet
-									ldns_rr_list_push_rr(a_rr_list, a_rr);
-									ldns_pkt_push_rr_list(a_packet, LDNS_SECTION_ANSWER, a_rr_list);
-
-									// Send A to client
-									uint8_t* a_buffer = NULL;
-									size_t a_buffer_size;
-									ldns_pkt2wire(&a_buffer, a_packet, &a_buffer_size);
-									switch (frontend->layer3)
-									{
-										case PF_INET:
-											sendto(server, a_buffer, a_buffer_size, 0,
-													(const struct sockaddr*)&address.address4, (socklen_t)sizeof(struct sockaddr_in));
-											break;
-										case PF_INET6:
-											sendto(server, a_buffer, a_buffer_size, 0,
-													(const struct sockaddr*)&address.address6, (socklen_t)sizeof(struct sockaddr_in6));
-											break;
-										default:
-											panic("socket domain");
-											break;
-									}
-
-									ldns_rr_list_free(a_rr_list);
-									ldns_rr_list_free(q_rr_list);
-									ldns_pkt_free(a_packet);
-									pfcq_zero(a_buffer, a_buffer_size);
-									free(a_buffer);
-									a_buffer = NULL;
-									pfcq_free(acl_data);
-									break;
-								}
-								default:
-									panic("Unknown ACL action occurred");
-									break;
-							}
-
-							// Only 1 query is processed within 1 DNS packet
-							break;
-						}
-					}
-
-					ldns_pkt_free(client_query_packet);
-				} else
+					// Take requests from AF_XDP RX ring
+					db_worker_xdp_recv(_worker);
+#endif /* DB_HAVE_XDP */
+				} else if (likely(kind == DB_EPOLL_KIND_FORWARDER))
 				{
-					// Accept answer from forwarder
-					uint8_t backend_buffer[frontend->dns_max_packet_length];
-					ssize_t answer_size = recv(epoll_events[i].data.fd, backend_buffer, frontend->dns_max_packet_length, 0);
-					if (unlikely(answer_size == -1))
+					// Accept answers from forwarder
+					size_t forwarder_index = DB_EPOLL_INDEX(epoll_events[i].data.u64);
+					if (unlikely(db_batch_recv(&_worker->forwarder_rx, _worker->forwarders[forwarder_index].socket) == -1))
 						continue;
+					db_stats_batch_rx(_worker, 1, _worker->forwarder_rx.count);
 
-					// Parse answer to LDNS structure
-					ldns_pkt* backend_answer_packet = NULL;
-					if (unlikely(ldns_wire2pkt(&backend_answer_packet, backend_buffer, answer_size) != LDNS_STATUS_OK))
-						continue;
-					if (unlikely(ldns_pkt_qdcount(backend_answer_packet) != 1))
-					{
-						ldns_pkt_free(backend_answer_packet);
-						continue;
-					}
-					ldns_rr_list* backend_queries = ldns_pkt_question(backend_answer_packet);
-					size_t backend_queries_count = ldns_rr_list_rr_count(backend_queries);
-					for (size_t j = 0; j < backend_queries_count; j++)
-					{
-						ldns_rr* backend_query = ldns_rr_list_rr(backend_queries, j);
-						if (likely(ldns_rr_is_question(backend_query)))
-						{
-							// Get DNS response data
-							struct db_request_data request_data = db_make_request_data(backend_answer_packet, epoll_events[i].data.fd);
-							// Select request from request table
-							struct db_request* found_request = db_eject_request(&frontend->g_ctx->db_requests, ldns_pkt_id(backend_answer_packet), request_data);
-							if (likely(found_request))
-							{
-								// Substitute original request ID to response
-								uint16_t id_nbo = htons(found_request->original_id);
-								memcpy(backend_buffer, &id_nbo, sizeof(uint16_t));
-
-								ldns_pkt_rcode backend_answer_packet_rcode = ldns_pkt_get_rcode(backend_answer_packet);
-								db_stats_forwarder_out(frontend->backend.forwarders[found_request->forwarder_index], answer_size, backend_answer_packet_rcode);
-								// Send answer to client
-								ssize_t sendto_res = -1;
-								switch (frontend->layer3)
-								{
-									case PF_INET:
-										sendto_res = sendto(server, backend_buffer, answer_size, 0,
-												(const struct sockaddr*)&found_request->client_address.address4, (socklen_t)sizeof(struct sockaddr_in));
-										break;
-									case PF_INET6:
-										sendto_res = sendto(server, backend_buffer, answer_size, 0,
-												(const struct sockaddr*)&found_request->client_address.address6, (socklen_t)sizeof(struct sockaddr_in6));
-										break;
-									default:
-										panic("socket domain");
-										break;
-								}
-								db_stats_latency_update(frontend->l_ctx, found_request->ctime);
-								pfcq_free(found_request);
-								if (likely(sendto_res != -1))
-									db_stats_frontend_out(frontend, sendto_res, backend_answer_packet_rcode);
-								break;
-							}
-						}
-					}
-					ldns_pkt_free(backend_answer_packet);
+					for (size_t j = 0; j < _worker->forwarder_rx.count; j++)
+						db_worker_handle_answer(_worker, forwarder_index, db_batch_packet(&_worker->forwarder_rx, j),
+							_worker->forwarder_rx.headers[j].msg_len);
 				}
 			}
+
+			// Send everything queued within this iteration
+			db_worker_flush(_worker);
+		}
+	}
+
+	for (size_t i = 0; i < frontend->backend.forwarders_count; i++)
+		if (unlikely(epoll_ctl(epoll_fd, EPOLL_CTL_DEL, _worker->forwarders[i].socket, NULL) == -1))
+			panic("epoll_ctl");
+	if (unlikely(close(epoll_fd) == -1))
+		panic("close");
+
+	return;
+}
+
+void* db_worker(void* _data)
+{
+	struct db_worker* data = _data;
+	struct db_frontend* frontend = data->frontend;
+	int option = 1;
+
+	data->forwarders = pfcq_alloc(frontend->backend.forwarders_count * sizeof(struct db_worker_forwarder));
+	pfcq_fprng_init(&data->fprng_context);
+
+	db_batch_init(&data->server_rx, frontend->batch_size, frontend->dns_max_packet_length);
+	db_batch_init(&data->server_tx, frontend->batch_size, frontend->dns_max_packet_length);
+	db_batch_init(&data->forwarder_rx, frontend->batch_size, frontend->dns_max_packet_length);
+
+	data->server = socket(frontend->layer3, SOCK_DGRAM, IPPROTO_UDP);
+	if (unlikely(data->server == -1))
+	{
+		fail("socket");
+		stop("Unable to create listener socket");
+	}
+	if (unlikely(setsockopt(data->server, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, (const void*)&option, sizeof(option)) == -1))
+		panic("setsockopt");
+	switch (frontend->layer3)
+	{
+		case PF_INET:
+			break;
+		case PF_INET6:
+			if (unlikely(setsockopt(data->server, IPPROTO_IPV6, IPV6_V6ONLY, (const void*)&option, sizeof(option)) == -1))
+				panic("setsockopt");
+			break;
+		default:
+			panic("socket domain");
+			break;
+	}
+	int bind_res = -1;
+	switch (frontend->layer3)
+	{
+		case PF_INET:
+			bind_res = bind(data->server, (struct sockaddr*)&frontend->address.address4, sizeof(struct sockaddr_in));
+			break;
+		case PF_INET6:
+			bind_res = bind(data->server, (struct sockaddr*)&frontend->address.address6, sizeof(struct sockaddr_in6));
+			break;
+		default:
+			break;
+	}
+	if (unlikely(bind_res == -1))
+	{
+		fail("bind");
+		stop("Unable to bind to listener socket.");
+	}
+
+	// Will query forwarders from fixed UDP sockets (not to pollute Linux conntrack table)
+	for (size_t i = 0; i < frontend->backend.forwarders_count; i++)
+	{
+		// In-flight cap is split evenly between workers, so it is kept without locks; share is rounded down
+		// not to exceed the cap in total, but every worker may have at least one query in flight
+		data->forwarders[i].max_outstanding = (size_t)(frontend->backend.forwarders[i]->max_outstanding / (uint64_t)frontend->workers_count);
+		if (unlikely(frontend->backend.forwarders[i]->max_outstanding && !data->forwarders[i].max_outstanding))
+			data->forwarders[i].max_outstanding = 1;
+		data->forwarders[i].socket = socket(frontend->backend.forwarders[i]->layer3, SOCK_DGRAM, IPPROTO_UDP);
+		if (unlikely(data->forwarders[i].socket == -1))
+			panic("socket");
+		int connect_res = -1;
+		switch (frontend->backend.forwarders[i]->layer3)
+		{
+			case PF_INET:
+				connect_res = connect(data->forwarders[i].socket, (const struct sockaddr*)&frontend->backend.forwarders[i]->address.address4, (socklen_t)sizeof(struct sockaddr_in));
+				break;
+			case PF_INET6:
+				connect_res = connect(data->forwarders[i].socket, (const struct sockaddr*)&frontend->backend.forwarders[i]->address.address6, (socklen_t)sizeof(struct sockaddr_in6));
+				break;
+			default:
+				panic("socket domain");
+				break;
 		}
+		if (unlikely(connect_res == -1))
+			panic("connect");
+		db_batch_init(&data->forwarders[i].tx, frontend->batch_size, frontend->dns_max_packet_length);
+	}
+
+	// Forwarder sockets belong to this worker, so do requests sent through them
+	db_timer_wheel_init(&data->timers, frontend->g_ctx->timer_resolution * 1000000ULL);
+	data->request_ttl = db_timer_ticks(&data->timers, frontend->g_ctx->request_ttl);
+	data->upstream_timeout = frontend->g_ctx->upstream_timeout ?
+		db_timer_ticks(&data->timers, frontend->g_ctx->upstream_timeout) : data->request_ttl;
+	data->retry_timeout = db_timer_ticks(&data->timers, frontend->backend.retry_timeout * 1000000ULL);
+	// Retries need the whole query, SERVFAIL only needs header and question
+	if (frontend->backend.max_retries)
+		data->request_copy_length = DB_RETRY_QUERY_MAX_LENGTH;
+	else if (frontend->g_ctx->servfail_on_timeout)
+		data->request_copy_length = DB_QUESTION_MAX_LENGTH;
+	db_pool_init(&data->request_pool,
+		sizeof(struct db_request) + (db_worker_tracks_timeouts(data) ? sizeof(struct db_request_timeout) + data->request_copy_length : 0),
+		frontend->request_pool_limit);
+	db_request_table_init(&data->requests, frontend->backend.forwarders_count, &data->request_pool, &data->fprng_context);
+	// Workers walk the same schedule from different points
+	data->schedule_cursor = data->index;
+
+	switch (frontend->io_engine)
+	{
+		case DB_IO_ENGINE_EPOLL:
+			db_worker_epoll(data);
+			break;
+#ifdef DB_HAVE_LIBURING
+		case DB_IO_ENGINE_URING:
+			db_worker_uring(data);
+			break;
+#endif /* DB_HAVE_LIBURING */
+#ifdef DB_HAVE_XDP
+		case DB_IO_ENGINE_XDP:
+			// Listener socket stays as a fallback for queues without AF_XDP socket
+			db_worker_xdp_init(data);
+			db_worker_epoll(data);
+			db_worker_xdp_done(data);
+			break;
+#endif /* DB_HAVE_XDP */
+		default:
+			panic("Unknown I/O engine");
+			break;
 	}
 
-lfree:
 	verbose("Exiting worker %#lx...\n", data->id);
 
 	for (size_t i = 0; i < frontend->backend.forwarders_count; i++)
 	{
-		epoll_event.data.fd = forwarders[i];
-		epoll_event.events = EPOLLIN;
-		if (unlikely(epoll_ctl(epoll_fd, EPOLL_CTL_DEL, forwarders[i], NULL) == -1))
-			panic("epoll_ctl");
-		if (unlikely(close(forwarders[i]) == -1))
+		if (unlikely(close(data->forwarders[i].socket) == -1))
 			panic("close");
+		db_batch_done(&data->forwarders[i].tx);
 	}
 
+	db_request_table_done(&data->requests);
+	db_pool_done(&data->request_pool);
+	db_batch_done(&data->forwarder_rx);
+	db_batch_done(&data->server_tx);
+	db_batch_done(&data->server_rx);
+	pfcq_free(data->forwarders);
+
 	pfpthq_dec(frontend->workers_pool);
 
 	return NULL;
 }
-
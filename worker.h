@@ -23,6 +23,15 @@
 #ifndef __WORKER_H__
 #define __WORKER_H__
 
+#include "types.h"
+
+size_t db_worker_sent(struct db_worker* _worker, size_t _target, struct db_batch* _batch) __attribute__((nonnull(1, 3)));
+void db_worker_flush(struct db_worker* _worker) __attribute__((nonnull(1)));
+void db_worker_handle_query(struct db_worker* _worker, uint8_t* _buffer, size_t _length, pfcq_net_address_t _address) __attribute__((nonnull(1, 2)));
+void db_worker_handle_answer(struct db_worker* _worker, size_t _forwarder_index, uint8_t* _buffer, size_t _length) __attribute__((nonnull(1, 3)));
+void db_worker_tick(struct db_worker* _worker) __attribute__((nonnull(1)));
+int db_worker_timers(struct db_worker* _worker) __attribute__((nonnull(1)));
+int db_worker_drained(struct db_worker* _worker) __attribute__((nonnull(1)));
 void* db_worker(void* _data) __attribute__((nonnull(1)));
 
 #endif /* __WORKER_H__ */
@@ -0,0 +1,372 @@
+/* vim: set tabstop=4:softtabstop=4:shiftwidth=4:noexpandtab */
+
+/*
+ * dnsbalancer - daemon to balance UDP DNS requests over DNS servers
+ * Copyright (C) 2015-2016 Lanet Network
+ * Programmed by Oleksandr Natalenko <o.natalenko@lanet.ua>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/eventfd.h>
+
+#ifdef DB_HAVE_LIBURING
+#include <liburing.h>
+#endif /* DB_HAVE_LIBURING */
+
+#include "batch.h"
+#include "stats.h"
+#include "worker.h"
+
+#include "worker_uring.h"
+
+#ifdef DB_HAVE_LIBURING
+
+#define DB_URING_OP_EVENTFD			1ULL
+#define DB_URING_OP_SERVER			2ULL
+#define DB_URING_OP_FORWARDER		3ULL
+#define DB_URING_OP_SEND			4ULL
+#define DB_URING_OP_CANCEL			5ULL
+#define DB_URING_OP_SHIFT			56
+#define DB_URING_DATA(OP, INDEX)	(((OP) << DB_URING_OP_SHIFT) | (uint64_t)(INDEX))
+#define DB_URING_OP(DATA)			((DATA) >> DB_URING_OP_SHIFT)
+#define DB_URING_INDEX(DATA)		((DATA) & ((1ULL << DB_URING_OP_SHIFT) - 1))
+#define DB_URING_BUFFER_GROUP		0
+#define DB_URING_BUFFER_ALIGN		64
+
+struct db_uring_cqe
+{
+	uint64_t user_data;
+	int32_t res;
+	uint32_t flags;
+};
+
+// Batch handed over to the kernel, kept intact until all its sends complete
+struct db_uring_flight
+{
+	struct db_batch batch;
+	size_t pending;
+};
+
+struct db_worker_uring
+{
+	struct io_uring ring;
+	struct io_uring_buf_ring* buffer_ring;
+	uint8_t* buffers;
+	size_t buffer_size;
+	struct msghdr recv_msg;
+	eventfd_t eventfd_value;
+	struct db_uring_flight* flights;
+	size_t flights_count;
+	size_t pending_sends;
+	size_t received;
+	unsigned short int draining;
+};
+
+static struct io_uring_sqe* db_worker_uring_sqe(struct db_worker_uring* _uring)
+{
+	struct io_uring_sqe* ret = io_uring_get_sqe(&_uring->ring);
+
+	if (unlikely(!ret))
+	{
+		// Submission queue is full, push it to the kernel and retry
+		io_uring_submit(&_uring->ring);
+		ret = io_uring_get_sqe(&_uring->ring);
+		if (unlikely(!ret))
+			panic("io_uring_get_sqe");
+	}
+
+	return ret;
+}
+
+static void db_worker_uring_recv(struct db_worker_uring* _uring, int _fd, uint64_t _op, size_t _index)
+{
+	struct io_uring_sqe* sqe = db_worker_uring_sqe(_uring);
+
+	io_uring_prep_recvmsg_multishot(sqe, _fd, &_uring->recv_msg, 0);
+	sqe->flags |= IOSQE_BUFFER_SELECT;
+	sqe->buf_group = DB_URING_BUFFER_GROUP;
+	io_uring_sqe_set_data64(sqe, DB_URING_DATA(_op, _index));
+
+	return;
+}
+
+static void db_worker_uring_recycle(struct db_worker_uring* _uring, unsigned int _bid)
+{
+	io_uring_buf_ring_add(_uring->buffer_ring, _uring->buffers + _bid * _uring->buffer_size, _uring->buffer_size,
+		_bid, io_uring_buf_ring_mask(DB_URING_BUFFERS), 0);
+	io_uring_buf_ring_advance(_uring->buffer_ring, 1);
+
+	return;
+}
+
+static struct db_batch* db_worker_uring_send_batch(struct db_worker* _worker, size_t _batch_index)
+{
+	return _batch_index ? &_worker->forwarders[_batch_index - 1].tx : &_worker->server_tx;
+}
+
+static void db_worker_uring_complete(struct db_worker* _worker, struct db_uring_cqe _cqe)
+{
+	struct db_worker_uring* uring = _worker->uring;
+	uint64_t op = DB_URING_OP(_cqe.user_data);
+	size_t index = DB_URING_INDEX(_cqe.user_data);
+
+	switch (op)
+	{
+		case DB_URING_OP_EVENTFD:
+		{
+			if (unlikely(close(_worker->eventfd) == -1))
+				panic("close");
+
+			// Stop receiving new requests
+			struct io_uring_sqe* sqe = db_worker_uring_sqe(uring);
+			io_uring_prep_cancel64(sqe, DB_URING_DATA(DB_URING_OP_SERVER, 0), 0);
+			io_uring_sqe_set_data64(sqe, DB_URING_DATA(DB_URING_OP_CANCEL, 0));
+			if (unlikely(close(_worker->server) == -1))
+				panic("close");
+			_worker->server = -1;
+
+			// But serve remaining requests
+			uring->draining = 1;
+			break;
+		}
+		case DB_URING_OP_SERVER:
+		case DB_URING_OP_FORWARDER:
+		{
+			if (likely(_cqe.res > 0 && (_cqe.flags & IORING_CQE_F_BUFFER)))
+			{
+				unsigned int bid = _cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+				uint8_t* buffer = uring->buffers + bid * uring->buffer_size;
+				struct io_uring_recvmsg_out* out = io_uring_recvmsg_validate(buffer, _cqe.res, &uring->recv_msg);
+				if (likely(out && !(out->flags & MSG_TRUNC)))
+				{
+					uint8_t* payload = io_uring_recvmsg_payload(out, &uring->recv_msg);
+					size_t payload_length = io_uring_recvmsg_payload_length(out, _cqe.res, &uring->recv_msg);
+					if (op == DB_URING_OP_SERVER)
+					{
+						pfcq_net_address_t address;
+						pfcq_zero(&address, sizeof(pfcq_net_address_t));
+						memcpy(&address, io_uring_recvmsg_name(out),
+							out->namelen < sizeof(pfcq_net_address_t) ? out->namelen : sizeof(pfcq_net_address_t));
+						db_worker_handle_query(_worker, payload, payload_length, address);
+					} else
+						db_worker_handle_answer(_worker, index, payload, payload_length);
+					uring->received++;
+				}
+				db_worker_uring_recycle(uring, bid);
+			}
+
+			// Multishot receive has been terminated (e.g., buffers were exhausted), re-arm it
+			if (unlikely(!(_cqe.flags & IORING_CQE_F_MORE)))
+			{
+				if (op == DB_URING_OP_SERVER && likely(!uring->draining))
+					db_worker_uring_recv(uring, _worker->server, DB_URING_OP_SERVER, 0);
+				else if (op == DB_URING_OP_FORWARDER)
+					db_worker_uring_recv(uring, _worker->forwarders[index].socket, DB_URING_OP_FORWARDER, index);
+			}
+			break;
+		}
+		case DB_URING_OP_SEND:
+		{
+			struct db_uring_flight* flight = &uring->flights[index >> 32];
+			flight->batch.headers[index & UINT32_MAX].msg_len = _cqe.res > 0 ? (unsigned int)_cqe.res : 0;
+			uring->pending_sends--;
+			// The whole batch is done, so it may take next packets
+			if (!--flight->pending)
+				db_stats_batch_tx(_worker, 1, db_worker_sent(_worker, index >> 32, &flight->batch));
+			break;
+		}
+		case DB_URING_OP_CANCEL:
+			break;
+		default:
+			panic("Unknown io_uring operation");
+			break;
+	}
+
+	return;
+}
+
+size_t db_worker_uring_send(struct db_worker* _worker)
+{
+	struct db_worker_uring* uring = _worker->uring;
+	size_t ret = 0;
+	size_t queued = 0;
+
+	for (size_t i = 0; i < uring->flights_count; i++)
+	{
+		struct db_batch* batch = db_worker_uring_send_batch(_worker, i);
+		struct db_uring_flight* flight = &uring->flights[i];
+		int fd = i ? _worker->forwarders[i - 1].socket : _worker->server;
+
+		if (!batch->count)
+			continue;
+
+		// Previous batch to the same socket is still in the kernel, so this one goes synchronously
+		// instead of waiting for completions; it is accounted by the caller
+		if (unlikely(flight->pending))
+		{
+			ret += db_batch_send(batch, fd);
+			continue;
+		}
+
+		// Swap the batches, so handlers fill the spare one while this one is in flight
+		struct db_batch spare = flight->batch;
+		flight->batch = *batch;
+		*batch = spare;
+
+		for (size_t j = 0; j < flight->batch.count; j++)
+		{
+			struct io_uring_sqe* sqe = db_worker_uring_sqe(uring);
+			io_uring_prep_sendmsg(sqe, fd, &flight->batch.headers[j].msg_hdr, 0);
+			io_uring_sqe_set_data64(sqe, DB_URING_DATA(DB_URING_OP_SEND, ((uint64_t)i << 32) | j));
+		}
+		flight->pending = flight->batch.count;
+		uring->pending_sends += flight->batch.count;
+		queued = 1;
+	}
+
+	// One syscall for all queued packets, completions are reaped by the event loop along with receives
+	if (queued)
+		io_uring_submit(&uring->ring);
+
+	return ret;
+}
+
+void db_worker_uring(struct db_worker* _worker)
+{
+	struct db_frontend* frontend = _worker->frontend;
+	struct io_uring_params params;
+	struct io_uring_cqe* cqes[DB_MAX_BATCH_SIZE];
+	struct db_uring_cqe completions[DB_MAX_BATCH_SIZE];
+	int err = 0;
+
+	struct db_worker_uring* uring = pfcq_alloc(sizeof(struct db_worker_uring));
+	_worker->uring = uring;
+
+	pfcq_zero(&params, sizeof(struct io_uring_params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = DB_URING_ENTRIES * 4;
+	err = io_uring_queue_init_params(DB_URING_ENTRIES, &uring->ring, &params);
+	if (unlikely(err < 0))
+	{
+		errno = -err;
+		panic("io_uring_queue_init_params");
+	}
+
+	// Provided buffer ring holds received packets along with sender address
+	uring->buffer_size = sizeof(struct io_uring_recvmsg_out) + sizeof(pfcq_net_address_t) + frontend->dns_max_packet_length;
+	uring->buffer_size = (uring->buffer_size + DB_URING_BUFFER_ALIGN - 1) & ~((size_t)DB_URING_BUFFER_ALIGN - 1);
+	uring->buffers = pfcq_alloc(DB_URING_BUFFERS * uring->buffer_size);
+	uring->buffer_ring = io_uring_setup_buf_ring(&uring->ring, DB_URING_BUFFERS, DB_URING_BUFFER_GROUP, 0, &err);
+	if (unlikely(!uring->buffer_ring))
+	{
+		errno = -err;
+		panic("io_uring_setup_buf_ring");
+	}
+	for (unsigned int i = 0; i < DB_URING_BUFFERS; i++)
+		io_uring_buf_ring_add(uring->buffer_ring, uring->buffers + i * uring->buffer_size, uring->buffer_size,
+			i, io_uring_buf_ring_mask(DB_URING_BUFFERS), i);
+	io_uring_buf_ring_advance(uring->buffer_ring, DB_URING_BUFFERS);
+
+	uring->recv_msg.msg_namelen = sizeof(pfcq_net_address_t);
+
+	// Spare batch for client and every forwarder
+	uring->flights_count = frontend->backend.forwarders_count + 1;
+	uring->flights = pfcq_alloc(uring->flights_count * sizeof(struct db_uring_flight));
+	for (size_t i = 0; i < uring->flights_count; i++)
+	{
+		struct db_batch* batch = db_worker_uring_send_batch(_worker, i);
+		db_batch_init(&uring->flights[i].batch, batch->size, batch->packet_size);
+	}
+
+	// Shutdown notification
+	struct io_uring_sqe* sqe = db_worker_uring_sqe(uring);
+	io_uring_prep_read(sqe, _worker->eventfd, &uring->eventfd_value, sizeof(eventfd_t), 0);
+	io_uring_sqe_set_data64(sqe, DB_URING_DATA(DB_URING_OP_EVENTFD, 0));
+
+	// Keep multishot receives posted on listener and all forwarders
+	db_worker_uring_recv(uring, _worker->server, DB_URING_OP_SERVER, 0);
+	for (size_t i = 0; i < frontend->backend.forwarders_count; i++)
+		db_worker_uring_recv(uring, _worker->forwarders[i].socket, DB_URING_OP_FORWARDER, i);
+
+	for (;;)
+	{
+		uring->received = 0;
+
+		// Send everything queued within this iteration
+		db_worker_flush(_worker);
+
+		// Shutdown
+		if (unlikely(uring->draining && db_worker_drained(_worker)))
+			break;
+
+		// Wake up on timer tick even if there is no traffic
+		int timeout_ms = db_worker_timers(_worker);
+		if (timeout_ms < 0)
+			io_uring_submit_and_wait(&uring->ring, 1);
+		else
+		{
+			struct __kernel_timespec timeout;
+			timeout.tv_sec = timeout_ms / 1000;
+			timeout.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+			if (io_uring_submit_and_wait_timeout(&uring->ring, &cqes[0], 1, &timeout, NULL) == -ETIME)
+				continue;
+		}
+
+		// Wait might have been unbounded
+		db_worker_tick(_worker);
+
+		unsigned int count = io_uring_peek_batch_cqe(&uring->ring, cqes, DB_MAX_BATCH_SIZE);
+		for (unsigned int i = 0; i < count; i++)
+		{
+			completions[i].user_data = cqes[i]->user_data;
+			completions[i].res = cqes[i]->res;
+			completions[i].flags = cqes[i]->flags;
+		}
+		io_uring_cq_advance(&uring->ring, count);
+
+		for (unsigned int i = 0; i < count; i++)
+			db_worker_uring_complete(_worker, completions[i]);
+		if (uring->received)
+			db_stats_batch_rx(_worker, 1, uring->received);
+	}
+
+	// Batches may not be freed while the kernel still reads them
+	while (uring->pending_sends)
+	{
+		io_uring_submit_and_wait(&uring->ring, 1);
+		unsigned int count = io_uring_peek_batch_cqe(&uring->ring, cqes, DB_MAX_BATCH_SIZE);
+		for (unsigned int i = 0; i < count; i++)
+			if (DB_URING_OP(cqes[i]->user_data) == DB_URING_OP_SEND)
+			{
+				completions[i].user_data = cqes[i]->user_data;
+				completions[i].res = cqes[i]->res;
+				completions[i].flags = cqes[i]->flags;
+				db_worker_uring_complete(_worker, completions[i]);
+			}
+		io_uring_cq_advance(&uring->ring, count);
+	}
+	for (size_t i = 0; i < uring->flights_count; i++)
+		db_batch_done(&uring->flights[i].batch);
+	pfcq_free(uring->flights);
+
+	io_uring_free_buf_ring(&uring->ring, uring->buffer_ring, DB_URING_BUFFERS, DB_URING_BUFFER_GROUP);
+	io_uring_queue_exit(&uring->ring);
+	pfcq_free(uring->buffers);
+	pfcq_free(uring);
+	_worker->uring = NULL;
+
+	return;
+}
+
+#endif /* DB_HAVE_LIBURING */
@@ -0,0 +1,568 @@
+/* vim: set tabstop=4:softtabstop=4:shiftwidth=4:noexpandtab */
+
+/*
+ * dnsbalancer - daemon to balance UDP DNS requests over DNS servers
+ * Copyright (C) 2015-2016 Lanet Network
+ * Programmed by Oleksandr Natalenko <o.natalenko@lanet.ua>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/udp.h>
+#include <net/if.h>
+#include <sys/mman.h>
+
+#ifdef DB_HAVE_XDP
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include <xdp/libxdp.h>
+#include <xdp/xsk.h>
+#endif /* DB_HAVE_XDP */
+
+#include "batch.h"
+#include "stats.h"
+#include "worker.h"
+
+#include "contrib/xxhash/xxhash.h"
+
+#include "worker_xdp.h"
+
+#ifdef DB_HAVE_XDP
+
+#define DB_XDP_FRAME_SIZE		XSK_UMEM__DEFAULT_FRAME_SIZE
+#define DB_XDP_RING_SIZE		XSK_RING_CONS__DEFAULT_NUM_DESCS
+#define DB_XDP_IP_DF			0x4000
+#define DB_XDP_HEADERS4			(sizeof(struct ethhdr) + sizeof(struct iphdr) + sizeof(struct udphdr))
+#define DB_XDP_HEADERS6			(sizeof(struct ethhdr) + sizeof(struct ipv6hdr) + sizeof(struct udphdr))
+
+struct db_frontend_xdp
+{
+	struct xdp_program* program;
+	enum xdp_attach_mode mode;
+	int ifindex;
+	int xsks_map_fd;
+};
+
+// Where the query came from on the wire, so that the answer may be put back there
+struct db_xdp_neighbour
+{
+	unsigned short int valid;
+	pfcq_net_address_t client;
+	pfcq_in_address_t local;
+	uint8_t client_mac[ETH_ALEN];
+	uint8_t local_mac[ETH_ALEN];
+};
+
+struct db_worker_xdp
+{
+	struct xsk_umem* umem;
+	struct xsk_socket* xsk;
+	struct xsk_ring_prod fill;
+	struct xsk_ring_cons completion;
+	struct xsk_ring_cons rx;
+	struct xsk_ring_prod tx;
+	uint8_t* area;
+	uint64_t* frames;
+	size_t frames_count;
+	struct db_xdp_neighbour* neighbours;
+	uint32_t queue;
+	int fd;
+	unsigned short int registered;
+};
+
+static uint32_t db_xdp_checksum(const void* _data, size_t _length, uint32_t _sum)
+{
+	const uint8_t* data = _data;
+
+	for (size_t i = 0; i + 1 < _length; i += 2)
+		_sum += (uint32_t)((data[i] << 8) | data[i + 1]);
+	if (_length & 1)
+		_sum += (uint32_t)(data[_length - 1] << 8);
+
+	return _sum;
+}
+
+static uint16_t db_xdp_checksum_fold(uint32_t _sum)
+{
+	while (_sum >> 16)
+		_sum = (_sum & 0xffff) + (_sum >> 16);
+
+	return htons((uint16_t)~_sum);
+}
+
+static size_t db_xdp_neighbour_index(sa_family_t _layer3, const pfcq_net_address_t* _client)
+{
+	uint64_t hash = 0;
+
+	switch (_layer3)
+	{
+		case PF_INET:
+			hash = XXH64((const uint8_t*)&_client->address4.sin_addr, sizeof(struct in_addr), DB_HASH_SEED);
+			hash = XXH64((const uint8_t*)&_client->address4.sin_port, sizeof(in_port_t), hash);
+			break;
+		case PF_INET6:
+			hash = XXH64((const uint8_t*)&_client->address6.sin6_addr, sizeof(struct in6_addr), DB_HASH_SEED);
+			hash = XXH64((const uint8_t*)&_client->address6.sin6_port, sizeof(in_port_t), hash);
+			break;
+		default:
+			panic("socket domain");
+			break;
+	}
+
+	return hash % DB_XDP_NEIGHBOURS;
+}
+
+static int db_xdp_neighbour_match(sa_family_t _layer3, const struct db_xdp_neighbour* _neighbour, const pfcq_net_address_t* _client)
+{
+	if (unlikely(!_neighbour->valid))
+		return 0;
+
+	switch (_layer3)
+	{
+		case PF_INET:
+			return _neighbour->client.address4.sin_addr.s_addr == _client->address4.sin_addr.s_addr &&
+				_neighbour->client.address4.sin_port == _client->address4.sin_port;
+		case PF_INET6:
+			return memcmp(&_neighbour->client.address6.sin6_addr, &_client->address6.sin6_addr, sizeof(struct in6_addr)) == 0 &&
+				_neighbour->client.address6.sin6_port == _client->address6.sin6_port;
+		default:
+			panic("socket domain");
+			break;
+	}
+}
+
+void db_frontend_xdp_load(struct db_frontend* _frontend)
+{
+	struct db_frontend_xdp* xdp = pfcq_alloc(sizeof(struct db_frontend_xdp));
+	struct db_xdp_bind bind;
+	uint32_t key = 0;
+
+	xdp->ifindex = (int)if_nametoindex(_frontend->xdp_interface);
+	if (unlikely(!xdp->ifindex))
+	{
+		inform("Frontend: %s\n", _frontend->name);
+		stop("Unable to find XDP interface");
+	}
+
+	switch (_frontend->xdp_mode)
+	{
+		case DB_XDP_MODE_NATIVE:
+			xdp->mode = XDP_MODE_NATIVE;
+			break;
+		case DB_XDP_MODE_SKB:
+			xdp->mode = XDP_MODE_SKB;
+			break;
+		default:
+			panic("Unknown XDP mode");
+			break;
+	}
+
+	xdp->program = xdp_program__open_file(_frontend->xdp_program, DB_XDP_PROGRAM_SECTION, NULL);
+	if (unlikely(libxdp_get_error(xdp->program)))
+	{
+		inform("Frontend: %s\n", _frontend->name);
+		stop("Unable to open XDP program");
+	}
+
+	// libxdp dispatcher chains programs, so reloading the config may attach the new program beside the old one
+	if (unlikely(xdp_program__attach(xdp->program, xdp->ifindex, xdp->mode, 0)))
+	{
+		inform("Frontend: %s\n", _frontend->name);
+		stop("Unable to attach XDP program");
+	}
+
+	struct bpf_object* object = xdp_program__bpf_obj(xdp->program);
+	struct bpf_map* xsks_map = bpf_object__find_map_by_name(object, DB_XDP_XSKS_MAP);
+	struct bpf_map* bind_map = bpf_object__find_map_by_name(object, DB_XDP_BIND_MAP);
+	if (unlikely(!xsks_map || !bind_map))
+	{
+		inform("Frontend: %s\n", _frontend->name);
+		stop("XDP program lacks required maps");
+	}
+	xdp->xsks_map_fd = bpf_map__fd(xsks_map);
+
+	pfcq_zero(&bind, sizeof(struct db_xdp_bind));
+	switch (_frontend->layer3)
+	{
+		case PF_INET:
+			bind.family = AF_INET;
+			bind.port = _frontend->address.address4.sin_port;
+			bind.any_address = _frontend->address.address4.sin_addr.s_addr == htonl(INADDR_ANY);
+			memcpy(bind.address, &_frontend->address.address4.sin_addr, sizeof(struct in_addr));
+			break;
+		case PF_INET6:
+			bind.family = AF_INET6;
+			bind.port = _frontend->address.address6.sin6_port;
+			bind.any_address = IN6_IS_ADDR_UNSPECIFIED(&_frontend->address.address6.sin6_addr);
+			memcpy(bind.address, &_frontend->address.address6.sin6_addr, sizeof(struct in6_addr));
+			break;
+		default:
+			panic("socket domain");
+			break;
+	}
+	if (unlikely(bpf_map_update_elem(bpf_map__fd(bind_map), &key, &bind, BPF_ANY)))
+		panic("bpf_map_update_elem");
+
+	_frontend->xdp = xdp;
+
+	return;
+}
+
+void db_frontend_xdp_unload(struct db_frontend* _frontend)
+{
+	struct db_frontend_xdp* xdp = _frontend->xdp;
+
+	if (unlikely(xdp_program__detach(xdp->program, xdp->ifindex, xdp->mode, 0)))
+		warning("Unable to detach XDP program");
+	xdp_program__close(xdp->program);
+	pfcq_free(_frontend->xdp);
+
+	return;
+}
+
+void db_worker_xdp_init(struct db_worker* _worker)
+{
+	struct db_frontend* frontend = _worker->frontend;
+	struct db_worker_xdp* xdp = pfcq_alloc(sizeof(struct db_worker_xdp));
+	struct xsk_umem_config umem_config;
+	struct xsk_socket_config socket_config;
+	uint32_t fill_index = 0;
+
+	xdp->queue = (uint32_t)(frontend->xdp_queue + _worker->index);
+
+	xdp->area = mmap(NULL, DB_XDP_FRAMES * DB_XDP_FRAME_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (unlikely(xdp->area == MAP_FAILED))
+		panic("mmap");
+
+	pfcq_zero(&umem_config, sizeof(struct xsk_umem_config));
+	umem_config.fill_size = DB_XDP_RING_SIZE;
+	umem_config.comp_size = DB_XDP_RING_SIZE;
+	umem_config.frame_size = DB_XDP_FRAME_SIZE;
+	umem_config.frame_headroom = XSK_UMEM__DEFAULT_FRAME_HEADROOM;
+	if (unlikely(xsk_umem__create(&xdp->umem, xdp->area, DB_XDP_FRAMES * DB_XDP_FRAME_SIZE, &xdp->fill, &xdp->completion, &umem_config)))
+	{
+		inform("Frontend: %s\n", frontend->name);
+		stop("Unable to create XDP UMEM");
+	}
+
+	// The program is loaded by the frontend, sockets only bind to their queues
+	pfcq_zero(&socket_config, sizeof(struct xsk_socket_config));
+	socket_config.rx_size = DB_XDP_RING_SIZE;
+	socket_config.tx_size = DB_XDP_RING_SIZE;
+	socket_config.libxdp_flags = XSK_LIBXDP_FLAGS__INHIBIT_PROG_LOAD;
+	socket_config.bind_flags = XDP_USE_NEED_WAKEUP | (frontend->xdp_zerocopy ? XDP_ZEROCOPY : XDP_COPY);
+	if (unlikely(xsk_socket__create(&xdp->xsk, frontend->xdp_interface, xdp->queue, xdp->umem, &xdp->rx, &xdp->tx, &socket_config)))
+	{
+		inform("Frontend: %s, queue: %u\n", frontend->name, xdp->queue);
+		stop("Unable to create AF_XDP socket");
+	}
+	xdp->fd = xsk_socket__fd(xdp->xsk);
+
+	// First half of UMEM frames is handed to the kernel for RX...
+	if (unlikely(xsk_ring_prod__reserve(&xdp->fill, DB_XDP_RING_SIZE, &fill_index) != DB_XDP_RING_SIZE))
+		panic("xsk_ring_prod__reserve");
+	for (size_t i = 0; i < DB_XDP_RING_SIZE; i++)
+		*xsk_ring_prod__fill_addr(&xdp->fill, fill_index + (uint32_t)i) = i * DB_XDP_FRAME_SIZE;
+	xsk_ring_prod__submit(&xdp->fill, DB_XDP_RING_SIZE);
+
+	// ...and the rest is kept for TX
+	xdp->frames = pfcq_alloc((DB_XDP_FRAMES - DB_XDP_RING_SIZE) * sizeof(uint64_t));
+	for (size_t i = DB_XDP_RING_SIZE; i < DB_XDP_FRAMES; i++)
+		xdp->frames[xdp->frames_count++] = i * DB_XDP_FRAME_SIZE;
+
+	xdp->neighbours = pfcq_alloc(DB_XDP_NEIGHBOURS * sizeof(struct db_xdp_neighbour));
+
+	if (unlikely(xsk_socket__update_xskmap(xdp->xsk, frontend->xdp->xsks_map_fd)))
+		panic("xsk_socket__update_xskmap");
+	xdp->registered = 1;
+
+	_worker->xdp = xdp;
+
+	return;
+}
+
+void db_worker_xdp_stop(struct db_worker* _worker)
+{
+	struct db_worker_xdp* xdp = _worker->xdp;
+	uint32_t key = xdp->queue;
+
+	// The program passes packets for unregistered queues to the stack
+	if (likely(xdp->registered))
+	{
+		if (unlikely(bpf_map_delete_elem(_worker->frontend->xdp->xsks_map_fd, &key)))
+			warning("Unable to unregister AF_XDP socket");
+		xdp->registered = 0;
+	}
+
+	return;
+}
+
+void db_worker_xdp_done(struct db_worker* _worker)
+{
+	struct db_worker_xdp* xdp = _worker->xdp;
+
+	db_worker_xdp_stop(_worker);
+	xsk_socket__delete(xdp->xsk);
+	if (unlikely(xsk_umem__delete(xdp->umem)))
+		panic("xsk_umem__delete");
+	if (unlikely(munmap(xdp->area, DB_XDP_FRAMES * DB_XDP_FRAME_SIZE) == -1))
+		panic("munmap");
+	pfcq_free(xdp->neighbours);
+	pfcq_free(xdp->frames);
+	pfcq_free(_worker->xdp);
+
+	return;
+}
+
+int db_worker_xdp_fd(struct db_worker* _worker)
+{
+	return _worker->xdp->fd;
+}
+
+static void db_worker_xdp_handle_frame(struct db_worker* _worker, uint8_t* _frame, size_t _length)
+{
+	struct db_frontend* frontend = _worker->frontend;
+	struct db_worker_xdp* xdp = _worker->xdp;
+	struct ethhdr* eth = (struct ethhdr*)_frame;
+	struct udphdr* udp = NULL;
+	pfcq_net_address_t client;
+	pfcq_in_address_t local;
+	size_t udp_length = 0;
+
+	pfcq_zero(&client, sizeof(pfcq_net_address_t));
+	pfcq_zero(&local, sizeof(pfcq_in_address_t));
+
+	if (unlikely(_length < sizeof(struct ethhdr)))
+		return;
+
+	switch (ntohs(eth->h_proto))
+	{
+		case ETH_P_IP:
+		{
+			struct iphdr* ip = (struct iphdr*)(eth + 1);
+			if (unlikely(frontend->layer3 != PF_INET || _length < DB_XDP_HEADERS4 || ip->ihl != 5 || ip->protocol != IPPROTO_UDP))
+				return;
+			udp = (struct udphdr*)(ip + 1);
+			udp_length = _length - (DB_XDP_HEADERS4 - sizeof(struct udphdr));
+			client.address4.sin_family = AF_INET;
+			client.address4.sin_addr.s_addr = ip->saddr;
+			client.address4.sin_port = udp->source;
+			local.address4.s_addr = ip->daddr;
+			break;
+		}
+		case ETH_P_IPV6:
+		{
+			struct ipv6hdr* ip6 = (struct ipv6hdr*)(eth + 1);
+			if (unlikely(frontend->layer3 != PF_INET6 || _length < DB_XDP_HEADERS6 || ip6->nexthdr != IPPROTO_UDP))
+				return;
+			udp = (struct udphdr*)(ip6 + 1);
+			udp_length = _length - (DB_XDP_HEADERS6 - sizeof(struct udphdr));
+			client.address6.sin6_family = AF_INET6;
+			memcpy(&client.address6.sin6_addr, &ip6->saddr, sizeof(struct in6_addr));
+			client.address6.sin6_port = udp->source;
+			memcpy(&local.address6, &ip6->daddr, sizeof(struct in6_addr));
+			break;
+		}
+		default:
+			return;
+	}
+
+	// Ethernet padding may make the frame longer than the datagram, but never shorter
+	if (unlikely(ntohs(udp->len) < sizeof(struct udphdr) || ntohs(udp->len) > udp_length))
+	{
+		db_stats_frontend_in_invalid(_worker, _length);
+		return;
+	}
+
+	struct db_xdp_neighbour* neighbour = &xdp->neighbours[db_xdp_neighbour_index(frontend->layer3, &client)];
+	neighbour->valid = 1;
+	neighbour->client = client;
+	neighbour->local = local;
+	memcpy(neighbour->client_mac, eth->h_source, ETH_ALEN);
+	memcpy(neighbour->local_mac, eth->h_dest, ETH_ALEN);
+
+	db_worker_handle_query(_worker, (uint8_t*)(udp + 1), ntohs(udp->len) - sizeof(struct udphdr), client);
+
+	return;
+}
+
+void db_worker_xdp_recv(struct db_worker* _worker)
+{
+	struct db_worker_xdp* xdp = _worker->xdp;
+	uint32_t rx_index = 0;
+	uint32_t fill_index = 0;
+
+	uint32_t received = xsk_ring_cons__peek(&xdp->rx, (uint32_t)_worker->frontend->batch_size, &rx_index);
+	if (unlikely(!received))
+	{
+		if (xsk_ring_prod__needs_wakeup(&xdp->fill))
+			recvfrom(xdp->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+		return;
+	}
+
+	// RX frames go straight back to the fill ring, so there is always room for them
+	if (unlikely(xsk_ring_prod__reserve(&xdp->fill, received, &fill_index) != received))
+		panic("xsk_ring_prod__reserve");
+
+	for (uint32_t i = 0; i < received; i++)
+	{
+		const struct xdp_desc* desc = xsk_ring_cons__rx_desc(&xdp->rx, rx_index + i);
+		db_worker_xdp_handle_frame(_worker, xsk_umem__get_data(xdp->area, xsk_umem__add_offset_to_addr(desc->addr)), desc->len);
+		*xsk_ring_prod__fill_addr(&xdp->fill, fill_index + i) = xsk_umem__extract_addr(desc->addr);
+	}
+
+	xsk_ring_prod__submit(&xdp->fill, received);
+	xsk_ring_cons__release(&xdp->rx, received);
+
+	db_stats_batch_rx(_worker, 1, received);
+
+	return;
+}
+
+static void db_worker_xdp_complete(struct db_worker_xdp* _xdp)
+{
+	uint32_t index = 0;
+
+	uint32_t completed = xsk_ring_cons__peek(&_xdp->completion, DB_XDP_RING_SIZE, &index);
+	for (uint32_t i = 0; i < completed; i++)
+		_xdp->frames[_xdp->frames_count++] = xsk_umem__extract_addr(*xsk_ring_cons__comp_addr(&_xdp->completion, index + i));
+	if (completed)
+		xsk_ring_cons__release(&_xdp->completion, completed);
+
+	return;
+}
+
+static size_t db_worker_xdp_build(struct db_worker* _worker, uint8_t* _frame, const struct db_xdp_neighbour* _neighbour,
+	const uint8_t* _payload, size_t _length)
+{
+	struct db_frontend* frontend = _worker->frontend;
+	struct ethhdr* eth = (struct ethhdr*)_frame;
+	struct udphdr* udp = NULL;
+	uint16_t udp_length = (uint16_t)(sizeof(struct udphdr) + _length);
+	uint32_t pseudo = 0;
+	size_t ret = 0;
+
+	memcpy(eth->h_dest, _neighbour->client_mac, ETH_ALEN);
+	memcpy(eth->h_source, _neighbour->local_mac, ETH_ALEN);
+
+	switch (frontend->layer3)
+	{
+		case PF_INET:
+		{
+			struct iphdr* ip = (struct iphdr*)(eth + 1);
+			eth->h_proto = htons(ETH_P_IP);
+			pfcq_zero(ip, sizeof(struct iphdr));
+			ip->version = 4;
+			ip->ihl = 5;
+			ip->tot_len = htons((uint16_t)(sizeof(struct iphdr) + udp_length));
+			ip->frag_off = htons(DB_XDP_IP_DF);
+			ip->ttl = DB_XDP_TTL;
+			ip->protocol = IPPROTO_UDP;
+			ip->saddr = _neighbour->local.address4.s_addr;
+			ip->daddr = _neighbour->client.address4.sin_addr.s_addr;
+			ip->check = db_xdp_checksum_fold(db_xdp_checksum(ip, sizeof(struct iphdr), 0));
+			udp = (struct udphdr*)(ip + 1);
+			udp->source = frontend->address.address4.sin_port;
+			udp->dest = _neighbour->client.address4.sin_port;
+			pseudo = db_xdp_checksum(&ip->saddr, 2 * sizeof(struct in_addr), 0);
+			ret = DB_XDP_HEADERS4 + _length;
+			break;
+		}
+		case PF_INET6:
+		{
+			struct ipv6hdr* ip6 = (struct ipv6hdr*)(eth + 1);
+			eth->h_proto = htons(ETH_P_IPV6);
+			pfcq_zero(ip6, sizeof(struct ipv6hdr));
+			ip6->version = 6;
+			ip6->payload_len = htons(udp_length);
+			ip6->nexthdr = IPPROTO_UDP;
+			ip6->hop_limit = DB_XDP_TTL;
+			memcpy(&ip6->saddr, &_neighbour->local.address6, sizeof(struct in6_addr));
+			memcpy(&ip6->daddr, &_neighbour->client.address6.sin6_addr, sizeof(struct in6_addr));
+			udp = (struct udphdr*)(ip6 + 1);
+			udp->source = frontend->address.address6.sin6_port;
+			udp->dest = _neighbour->client.address6.sin6_port;
+			pseudo = db_xdp_checksum(&ip6->saddr, 2 * sizeof(struct in6_addr), 0);
+			ret = DB_XDP_HEADERS6 + _length;
+			break;
+		}
+		default:
+			panic("socket domain");
+			break;
+	}
+
+	udp->len = htons(udp_length);
+	udp->check = 0;
+	memcpy(udp + 1, _payload, _length);
+	pseudo += IPPROTO_UDP + udp_length;
+	udp->check = db_xdp_checksum_fold(db_xdp_checksum(udp, udp_length, pseudo));
+	if (unlikely(!udp->check))
+		udp->check = 0xffff;
+
+	return ret;
+}
+
+size_t db_worker_xdp_send(struct db_worker* _worker)
+{
+	struct db_frontend* frontend = _worker->frontend;
+	struct db_worker_xdp* xdp = _worker->xdp;
+	struct db_batch* tx = &_worker->server_tx;
+	size_t headers = frontend->layer3 == PF_INET ? DB_XDP_HEADERS4 : DB_XDP_HEADERS6;
+	uint32_t queued = 0;
+	size_t ret = 0;
+
+	db_worker_xdp_complete(xdp);
+
+	for (size_t i = 0; i < tx->count; i++)
+	{
+		size_t length = tx->iovecs[i].iov_len;
+		struct db_xdp_neighbour* neighbour = &xdp->neighbours[db_xdp_neighbour_index(frontend->layer3, &tx->addresses[i])];
+		uint32_t tx_index = 0;
+
+		if (likely(db_xdp_neighbour_match(frontend->layer3, neighbour, &tx->addresses[i]) &&
+			headers + length <= DB_XDP_FRAME_SIZE && xdp->frames_count &&
+			xsk_ring_prod__reserve(&xdp->tx, 1, &tx_index) == 1))
+		{
+			uint64_t frame = xdp->frames[--xdp->frames_count];
+			struct xdp_desc* desc = xsk_ring_prod__tx_desc(&xdp->tx, tx_index);
+			desc->addr = frame;
+			desc->len = (uint32_t)db_worker_xdp_build(_worker, xsk_umem__get_data(xdp->area, frame), neighbour, db_batch_packet(tx, i), length);
+			tx->headers[i].msg_len = (unsigned int)length;
+			queued++;
+		} else if (likely(_worker->server != -1))
+		{
+			// Client came in via the stack, or the ring is exhausted, so answer via the listener socket
+			ssize_t sendmsg_res = sendmsg(_worker->server, &tx->headers[i].msg_hdr, MSG_DONTWAIT);
+			tx->headers[i].msg_len = sendmsg_res == -1 ? 0 : (unsigned int)sendmsg_res;
+			ret++;
+		} else
+			tx->headers[i].msg_len = 0;
+	}
+
+	if (likely(queued))
+	{
+		xsk_ring_prod__submit(&xdp->tx, queued);
+		if (xsk_ring_prod__needs_wakeup(&xdp->tx))
+			sendto(xdp->fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+		ret++;
+	}
+
+	return ret;
+}
+
+#endif /* DB_HAVE_XDP */
+
@@ -0,0 +1,41 @@
+/* vim: set tabstop=4:softtabstop=4:shiftwidth=4:noexpandtab */
+
+/*
+ * dnsbalancer - daemon to balance UDP DNS requests over DNS servers
+ * Copyright (C) 2015-2016 Lanet Network
+ * Programmed by Oleksandr Natalenko <o.natalenko@lanet.ua>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifndef __WORKER_XDP_H__
+#define __WORKER_XDP_H__
+
+#include "types.h"
+#include "xdp/dnsbalancer_xdp.h"
+
+#ifdef DB_HAVE_XDP
+void db_frontend_xdp_load(struct db_frontend* _frontend) __attribute__((nonnull(1)));
+void db_frontend_xdp_unload(struct db_frontend* _frontend) __attribute__((nonnull(1)));
+void db_worker_xdp_init(struct db_worker* _worker) __attribute__((nonnull(1)));
+void db_worker_xdp_stop(struct db_worker* _worker) __attribute__((nonnull(1)));
+void db_worker_xdp_done(struct db_worker* _worker) __attribute__((nonnull(1)));
+int db_worker_xdp_fd(struct db_worker* _worker) __attribute__((nonnull(1)));
+void db_worker_xdp_recv(struct db_worker* _worker) __attribute__((nonnull(1)));
+size_t db_worker_xdp_send(struct db_worker* _worker) __attribute__((nonnull(1)));
+#endif /* DB_HAVE_XDP */
+
+#endif /* __WORKER_XDP_H__ */
+
@@ -0,0 +1,128 @@
+/* vim: set tabstop=4:softtabstop=4:shiftwidth=4:noexpandtab */
+
+/*
+ * dnsbalancer - daemon to balance UDP DNS requests over DNS servers
+ * Copyright (C) 2015-2016 Lanet Network
+ * Programmed by Oleksandr Natalenko <o.natalenko@lanet.ua>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/udp.h>
+
+#include <bpf/bpf_endian.h>
+#include <bpf/bpf_helpers.h>
+
+#include "dnsbalancer_xdp.h"
+
+// libc headers are not available to BPF programs
+#ifndef AF_INET
+#define AF_INET		2
+#endif
+#ifndef AF_INET6
+#define AF_INET6	10
+#endif
+
+struct
+{
+	__uint(type, BPF_MAP_TYPE_XSKMAP);
+	__uint(max_entries, DB_XDP_MAX_QUEUES);
+	__type(key, __u32);
+	__type(value, __u32);
+} xsks_map SEC(".maps");
+
+struct
+{
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, __u32);
+	__type(value, struct db_xdp_bind);
+} bind_map SEC(".maps");
+
+static __always_inline int db_xdp_match_address(const __u8* _address, const struct db_xdp_bind* _bind, __u32 _length)
+{
+	if (_bind->any_address)
+		return 1;
+
+	for (__u32 i = 0; i < _length; i++)
+		if (_address[i] != _bind->address[i])
+			return 0;
+
+	return 1;
+}
+
+SEC(DB_XDP_PROGRAM_SECTION)
+int dnsbalancer_xdp(struct xdp_md* _ctx)
+{
+	void* data = (void*)(long)_ctx->data;
+	void* data_end = (void*)(long)_ctx->data_end;
+	__u32 key = 0;
+	struct udphdr* udp = 0;
+
+	struct db_xdp_bind* bind = bpf_map_lookup_elem(&bind_map, &key);
+	if (!bind)
+		return XDP_PASS;
+
+	struct ethhdr* eth = data;
+	if ((void*)(eth + 1) > data_end)
+		return XDP_PASS;
+
+	switch (bpf_ntohs(eth->h_proto))
+	{
+		case ETH_P_IP:
+		{
+			struct iphdr* ip = (void*)(eth + 1);
+			if ((void*)(ip + 1) > data_end)
+				return XDP_PASS;
+			if (bind->family != AF_INET || ip->protocol != IPPROTO_UDP || ip->ihl != 5)
+				return XDP_PASS;
+			// Fragments are left to the stack
+			if (ip->frag_off & bpf_htons(0x3fff))
+				return XDP_PASS;
+			if (!db_xdp_match_address((const __u8*)&ip->daddr, bind, 4))
+				return XDP_PASS;
+			udp = (void*)(ip + 1);
+			break;
+		}
+		case ETH_P_IPV6:
+		{
+			struct ipv6hdr* ip6 = (void*)(eth + 1);
+			if ((void*)(ip6 + 1) > data_end)
+				return XDP_PASS;
+			if (bind->family != AF_INET6 || ip6->nexthdr != IPPROTO_UDP)
+				return XDP_PASS;
+			if (!db_xdp_match_address(ip6->daddr.in6_u.u6_addr8, bind, 16))
+				return XDP_PASS;
+			udp = (void*)(ip6 + 1);
+			break;
+		}
+		default:
+			return XDP_PASS;
+	}
+
+	if ((void*)(udp + 1) > data_end)
+		return XDP_PASS;
+	if (udp->dest != bind->port)
+		return XDP_PASS;
+
+	// Queues without AF_XDP socket fall back to the regular stack
+	return bpf_redirect_map(&xsks_map, _ctx->rx_queue_index, XDP_PASS);
+}
+
+char _license[] SEC("license") = "GPL";
+
@@ -0,0 +1,43 @@
+/* vim: set tabstop=4:softtabstop=4:shiftwidth=4:noexpandtab */
+
+/*
+ * dnsbalancer - daemon to balance UDP DNS requests over DNS servers
+ * Copyright (C) 2015-2016 Lanet Network
+ * Programmed by Oleksandr Natalenko <o.natalenko@lanet.ua>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifndef __DNSBALANCER_XDP_H__
+#define __DNSBALANCER_XDP_H__
+
+#include <linux/types.h>
+
+#define DB_XDP_PROGRAM_SECTION		"xdp"
+#define DB_XDP_XSKS_MAP				"xsks_map"
+#define DB_XDP_BIND_MAP				"bind_map"
+#define DB_XDP_MAX_QUEUES			64
+
+// Shared between the XDP program and userspace, keep it in sync
+struct db_xdp_bind
+{
+	__u32 family;
+	__u16 port;
+	__u16 any_address;
+	__u8 address[16];
+};
+
+#endif /* __DNSBALANCER_XDP_H__ */
+
@@ -0,0 +1,127 @@
+#!/bin/sh
+# vim: set tabstop=4:softtabstop=4:shiftwidth=4:noexpandtab
+
+#
+# dnsbalancer - daemon to balance UDP DNS requests over DNS servers
+# Copyright (C) 2015-2016 Lanet Network
+# Programmed by Oleksandr Natalenko <o.natalenko@lanet.ua>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+# Serves set_a answers over generic XDP on a veth pair, then reloads the daemon
+# and checks it keeps answering. Needs root, iproute2 and dig.
+#
+# usage: veth_test.sh <dnsbalancer binary> <dnsbalancer_xdp.o>
+
+set -eu
+
+DB_BINARY="${1:?dnsbalancer binary}"
+DB_XDP_PROGRAM="${2:?dnsbalancer_xdp.o}"
+DB_NETNS="dbvethtest$$"
+DB_WORKDIR="$(mktemp -d)"
+DB_PID=""
+
+cleanup()
+{
+	[ -n "${DB_PID}" ] && kill "${DB_PID}" 2>/dev/null && wait "${DB_PID}" 2>/dev/null
+	ip link del dbveth0 2>/dev/null
+	ip netns del "${DB_NETNS}" 2>/dev/null
+	rm -rf "${DB_WORKDIR}"
+}
+trap cleanup EXIT
+
+query()
+{
+	ANSWER="$(ip netns exec "${DB_NETNS}" dig +short +tries=1 +time=2 @10.0.0.1 example.com A)"
+	if [ "${ANSWER}" != "10.0.0.99" ]
+	then
+		echo "FAIL: $1, got '${ANSWER}'"
+		exit 1
+	fi
+	echo "OK: $1"
+}
+
+ip netns add "${DB_NETNS}"
+ip link add dbveth0 type veth peer name dbveth1
+ip link set dbveth1 netns "${DB_NETNS}"
+ip addr add 10.0.0.1/24 dev dbveth0
+ip link set dbveth0 up
+ip netns exec "${DB_NETNS}" ip addr add 10.0.0.2/24 dev dbveth1
+ip netns exec "${DB_NETNS}" ip link set dbveth1 up
+ip netns exec "${DB_NETNS}" ip link set lo up
+
+cat > "${DB_WORKDIR}/dnsbalancer.conf" <<CONFIG
+[general]
+rlimit=32768
+frontends=fe_xdp
+request_ttl=1000
+timer_resolution=10
+watchdog_interval=1000
+reload_retry=100
+
+[stats]
+enabled=0
+
+[fe_xdp]
+workers=1
+dns_max_packet_length=4096
+batch_size=1
+io_engine=xdp
+xdp_interface=dbveth0
+xdp_mode=skb
+xdp_program=${DB_XDP_PROGRAM}
+layer3=ipv4
+bind=10.0.0.1
+port=53
+backend=be_xdp
+acl=local/acl_xdp
+
+[acl_xdp]
+set_a_all=ipv4/0.0.0.0/0/regex/list_all/set_a/10.0.0.99,60
+
+[list_all]
+0=all/^.*$
+
+[be_xdp]
+mode=rr
+forwarders=frw_xdp
+
+[frw_xdp]
+layer3=ipv4
+host=10.0.0.2
+port=53
+check_attempts=3
+check_timeout=500
+check_query=. IN SOA
+weight=1
+CONFIG
+
+"${DB_BINARY}" --config="${DB_WORKDIR}/dnsbalancer.conf" &
+DB_PID=$!
+sleep 1
+query "before reload"
+
+# Reload tears down the old AF_XDP sockets and program before attaching the new ones
+kill -USR1 "${DB_PID}"
+sleep 2
+if ! kill -0 "${DB_PID}" 2>/dev/null
+then
+	echo "FAIL: daemon exited on reload"
+	exit 1
+fi
+query "after reload"
+
+kill -USR1 "${DB_PID}"
+sleep 2
+query "after second reload"